@@ -0,0 +1,93 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt_localization/scan_likelihood_kernel.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+namespace mrpt::maps
+{
+class CBeaconMap;
+}
+namespace mrpt::obs
+{
+class CObservationBeaconRanges;
+}
+
+/**
+ * Evaluates the log-likelihood of range-only beacon observations for many
+ * particles at once, like CBeaconMap::computeObservationLikelihood() does
+ * for beacons with a Gaussian position: each positive range adds the
+ * log-density of a Gaussian centered at the distance from the sensor to the
+ * mean of the beacon, of variance likelihoodOptions.rangeStd^2 plus that of
+ * the beacon position along the line of sight. Other ranges add nothing,
+ * and ranges to beacons not in the map add the density of a uniform range.
+ * Beacons are looked up by ID in a hash table, hence the cost grows with
+ * the measurements but not with the size of the map.
+ * Uses AVX2 (with runtime detection) or NEON when available, and plain C++
+ * otherwise.
+ **/
+class BeaconLikelihoodKernel
+{
+   public:
+	/** Indexes the beacons of the map, replacing the previous ones. None is
+	 * indexed unless all the beacons have a Gaussian position and distinct
+	 * IDs. */
+	void setMap(const mrpt::maps::CBeaconMap& map);
+	/** Forgets all the beacons */
+	void clear();
+	/** Number of indexed beacons */
+	size_t size() const { return beacons_.size(); }
+
+	/**
+	 * Adds to log_lik[i] the log-likelihood of all the ranges with the
+	 * robot at the pose of particle i
+	 * @param log_lik output array with particles.size() elements
+	 **/
+	void evaluate(
+		const ParticlesSoA& particles,
+		const mrpt::obs::CObservationBeaconRanges& obs, double* log_lik) const;
+
+   private:
+	struct Beacon
+	{
+		float x, y, z;	///< mean position
+		float cxx, cxy, cxz, cyy, cyz, czz;  ///< position covariance
+	};
+	std::unordered_map<int64_t, Beacon> beacons_;
+	float range_std_ = 1;
+};
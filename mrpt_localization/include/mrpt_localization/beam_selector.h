@@ -0,0 +1,90 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt/obs/CObservation2DRangeScan.h>
+#include <mrpt/obs/CSensoryFrame.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/**
+ * Observation preprocessor which bounds the cost of weighting laser scans.
+ * It learns the average time of one beam-particle likelihood evaluation and,
+ * given the number of particles to weight, invalidates rays of copies of
+ * the scans so that the estimated cost (rays x particles x time per
+ * evaluation) stays within a time budget. The kept rays are picked with
+ * stratified angular sampling among the valid, non max-range ones.
+ **/
+class BeamSelector
+{
+   public:
+	double time_budget = 0;	 ///< seconds for weighting all particles, 0
+	/// disables the selection
+	size_t min_rays = 10;  ///< minimum number of evaluated rays per update
+
+	/**
+	 * Updates the cost model
+	 * @param time seconds spent evaluating the likelihood
+	 * @param evaluations number of beam-particle evaluations in that time
+	 **/
+	void addMeasurement(double time, size_t evaluations);
+
+	/** Average time of one evaluation (ns), 0 if unknown yet */
+	double nsPerEvaluation() const { return ns_per_evaluation_; }
+
+	/**
+	 * Fills out with the observations of sf, with its 2D scans replaced by
+	 *copies where the rays that do not fit the budget are invalid. Invalid
+	 *and max-range rays are always discarded. The scans of sf, which may be
+	 *shared with other users, are not modified.
+	 * @param num_particles most particles that will be weighted
+	 * @param decimation the likelihood model only evaluates one out of this
+	 *number of valid rays
+	 * @return number of rays that will be evaluated
+	 **/
+	size_t apply(
+		const mrpt::obs::CSensoryFrame& sf, size_t num_particles,
+		size_t decimation, mrpt::obs::CSensoryFrame& out);
+
+   private:
+	double ns_per_evaluation_ = 0;
+	std::minstd_rand rng_;
+	std::vector<mrpt::obs::CObservation2DRangeScan*> scans_;
+	/** Scan copies, reused once the last output frame released them */
+	std::vector<mrpt::obs::CObservation2DRangeScan::Ptr> copies_;
+	std::vector<size_t> candidates_;
+	std::vector<size_t> scan_candidates_;
+};
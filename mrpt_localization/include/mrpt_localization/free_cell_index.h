@@ -0,0 +1,102 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt/math/TPoint2D.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mrpt::maps
+{
+class COccupancyGridMap2D;
+}
+namespace mrpt::random
+{
+class CRandomGenerator;
+}
+
+/**
+ * Free cells of an occupancy grid, grouped in square buckets of
+ * BUCKET_SIZE cells, to draw uniform samples of the free space of a box
+ * with a cost that depends on the number of samples and the perimeter of
+ * the box, instead of on the area of the map.
+ **/
+class FreeCellIndex
+{
+   public:
+	static constexpr int BUCKET_SIZE = 32;	///< cells per side of a bucket
+
+	/**
+	 * Indexes the cells of the grid whose probability of being free is at
+	 *least min_free_prob (the same default as resetUniformFreeSpace())
+	 **/
+	void build(
+		const mrpt::maps::COccupancyGridMap2D& grid,
+		float min_free_prob = 0.7f);
+	void clear();
+
+	/** Number of free cells */
+	size_t size() const { return cells_.size(); }
+
+	/** Grid sized mask with 1 in the free cells and 0 elsewhere */
+	void freeMask(std::vector<uint8_t>& mask) const;
+
+	/**
+	 * Draws points uniformly distributed over the free cells whose centers
+	 *are in the box
+	 * @param points output, count points (map coordinates)
+	 * @return false if there are no free cells in the box
+	 **/
+	bool sample(
+		size_t count, float x_min, float x_max, float y_min, float y_max,
+		mrpt::random::CRandomGenerator& rng,
+		std::vector<mrpt::math::TPoint2D>& points) const;
+
+	/**
+	 * Uniform integer in [0, n), n > 0, without the bias of
+	 *rng.drawUniform32bit() % n towards the lowest values
+	 **/
+	static uint32_t drawIndex(
+		mrpt::random::CRandomGenerator& rng, uint32_t n);
+
+   private:
+	int size_x_ = 0, size_y_ = 0;
+	int buckets_x_ = 0, buckets_y_ = 0;
+	float x_min_ = 0, y_min_ = 0, resolution_ = 1;
+	std::vector<uint32_t> cells_;  ///< free cells, grouped by bucket
+	std::vector<uint32_t> bucket_start_;  ///< first cell of each bucket in
+	/// cells_, plus the end of the last one
+};
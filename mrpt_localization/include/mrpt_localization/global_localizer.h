@@ -0,0 +1,150 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt/math/TPose2D.h>
+#include <mrpt_localization/likelihood_field.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Global localization of a scan in a LikelihoodField by branch and bound,
+ * like the correlative scan matcher of Cartographer: for each heading, the
+ * translations of the whole map are searched coarse to fine over a
+ * max-pooled pyramid of the field, whose sums are upper bounds of the
+ * log-likelihood of any pose in a window. Windows are expanded best first,
+ * and the search stops once none can beat the best hypotheses found.
+ **/
+class GlobalLocalizer
+{
+   public:
+	struct Params
+	{
+		double angular_resolution = 0.0175;	 ///< rad
+		size_t max_points = 90;	 ///< scan points used, evenly subsampled
+		size_t num_hypotheses = 5;	///< best poses returned
+		double min_hypotheses_distance = 1.0;  ///< meters between hypotheses
+		double min_hypotheses_angle = 0.35;	 ///< or radians between them
+	};
+
+	struct Hypothesis
+	{
+		mrpt::math::TPose2D pose;
+		double score;  ///< mean log-likelihood per point
+	};
+
+	/**
+	 * Max-pooled pyramid of a likelihood field, built once per map and
+	 *shared by all the searches. Level h > 0 holds one value per block of
+	 *2^h x 2^h cells, the maximum of the field over the 2 x 2 blocks starting
+	 *there, so that any window of 2^h cells is bounded by a single value;
+	 *the coarse levels take a third of the cells of the field together.
+	 *The top level covers the whole map with one block.
+	 **/
+	class Pyramid
+	{
+	   public:
+		using ConstPtr = std::shared_ptr<const Pyramid>;
+
+		/**
+		 * @param free_cells optional row-major mask of the field cells the
+		 *robot may be in (non-zero), nullptr to allow all of them
+		 **/
+		Pyramid(
+			LikelihoodField::ConstPtr field,
+			const std::vector<uint8_t>* free_cells = nullptr);
+
+		const LikelihoodField& field() const { return *field_; }
+		int numLevels() const { return static_cast<int>(levels_.size()) + 1; }
+
+		/**
+		 * Upper bound of the field over the window [x, x + 2^level) x
+		 *[y, y + 2^level), out-of-map cells included
+		 **/
+		float bound(int level, int x, int y) const
+		{
+			const int size_x = field_->sizeX(), size_y = field_->sizeY();
+			if (x + (1 << level) <= 0 || y + (1 << level) <= 0 ||
+				x >= size_x || y >= size_y)
+				return field_->outOfMapValue();
+			if (level == 0) return field_->cell(x, y);
+			// The window starts in block (x >> level) or in block -1
+			const Level& l = levels_[level - 1];
+			return l.max[static_cast<size_t>((y >> level) + 1) * l.width +
+						 (x >> level) + 1];
+		}
+
+		/**
+		 * False if no cell of the block [x, x + 2^level) x [y, y + 2^level)
+		 *is free, for x and y multiples of 2^level in the map
+		 **/
+		bool hasFreeCell(int level, int x, int y) const
+		{
+			if (level == 0)
+			{
+				const size_t i = static_cast<size_t>(y) * field_->sizeX() + x;
+				return free_.empty() || ((free_[i >> 6] >> (i & 63)) & 1);
+			}
+			const Level& l = levels_[level - 1];
+			return l.free.empty() ||
+				l.free[static_cast<size_t>(y >> level) * (l.width - 1) +
+					   (x >> level)];
+		}
+
+	   private:
+		struct Level
+		{
+			int width = 0;	///< blocks per row of max, one more than in free
+			std::vector<float> max;	 ///< from block -1 in both axes
+			std::vector<uint8_t> free;	///< any free cell in each block
+		};
+		LikelihoodField::ConstPtr field_;
+		std::vector<uint64_t> free_;  ///< bits of the cells, empty if all
+		/// are free
+		std::vector<Level> levels_;	 ///< levels 1 and above
+	};
+
+	Params params;
+
+	/**
+	 * Finds the best poses of a scan in the whole field of the pyramid
+	 * @param xs,ys scan points in the robot frame (meters)
+	 * @return hypotheses sorted by decreasing score, empty if none
+	 **/
+	std::vector<Hypothesis> localize(
+		const Pyramid& pyramid, const std::vector<float>& xs,
+		const std::vector<float>& ys) const;
+};
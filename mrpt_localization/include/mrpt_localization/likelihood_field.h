@@ -0,0 +1,267 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mrpt::maps
+{
+class COccupancyGridMap2D;
+}
+
+/**
+ * Precomputed log-likelihood of a range endpoint falling in each cell of an
+ * occupancy grid, following the "likelihood field" (LF_Trun) sensor model
+ * of COccupancyGridMap2D. Unlike the lazy cache inside MRPT, the whole table
+ * is computed at once with an exact distance transform, so that it can be
+ * read by ScanLikelihoodKernel without branches.
+ *
+ * The table is stored in square tiles, so that the cells around the robot
+ * span a few pages, and the cells of each tile in Morton (Z) order, so that
+ * each cache line holds a square block of cells. Memory-mapped fields of
+ * large maps only need the tiles near the particles to be resident, see
+ * prefetch(). Quantized fields store a byte per cell instead of a float,
+ * which cuts the memory (and memory bandwidth) used by the table by 4.
+ **/
+class LikelihoodField
+{
+   public:
+	using Ptr = std::shared_ptr<LikelihoodField>;
+	using ConstPtr = std::shared_ptr<const LikelihoodField>;
+
+	static constexpr int TILE_SHIFT = 6;
+	static constexpr int TILE_SIZE = 1 << TILE_SHIFT;  ///< cells per side
+	static constexpr size_t TILE_CELLS = size_t(1) << (2 * TILE_SHIFT);
+
+	/** Parameters of the sensor model (see
+	 * COccupancyGridMap2D::TLikelihoodOptions) */
+	struct Params
+	{
+		float std_hit = 0.35f;	///< LF_stdHit (meters)
+		float z_hit = 0.95f;  ///< LF_zHit
+		float z_random = 0.05f;  ///< LF_zRandom
+		float max_range = 81.0f;  ///< LF_maxRange (meters)
+		float max_corrs_distance = 0.3f;  ///< LF_maxCorrsDistance (meters)
+		unsigned int decimation = 5;  ///< LF_decimation
+		float horizontal_tolerance =
+			0.0f;  ///< scans tilted more than this (rad) are ignored
+	};
+
+	/**
+	 * Returns true if the likelihood of 2D scans in this grid can be
+	 * evaluated with a LikelihoodField, i.e. the grid uses the LF_Trun
+	 * model without the alternate average method.
+	 **/
+	static bool isApplicable(const mrpt::maps::COccupancyGridMap2D& grid);
+
+	/**
+	 * Builds the field from the cells and likelihood options of the grid.
+	 * @param cache_dir if not empty, a field previously computed for the same
+	 *grid cells and options is memory-mapped (read-only) from a file in this
+	 *directory instead of computed; new fields are saved there.
+	 * @param quantized store the table as quantizedData()
+	 **/
+	static Ptr Create(
+		const mrpt::maps::COccupancyGridMap2D& grid,
+		const std::string& cache_dir = std::string(), bool quantized = false);
+
+	/**
+	 * Builds the field from a raw occupancy mask (row-major, non-zero means
+	 * occupied)
+	 * @param occupied size_x * size_y cells
+	 **/
+	static Ptr Create(
+		const std::vector<uint8_t>& occupied, int size_x, int size_y,
+		float x_min, float y_min, float resolution, const Params& params,
+		bool quantized = false);
+
+	int sizeX() const { return size_x_; }
+	int sizeY() const { return size_y_; }
+	int tilesX() const { return tiles_x_; }
+	int tilesY() const { return tiles_y_; }
+	float xMin() const { return x_min_; }
+	float yMin() const { return y_min_; }
+	float resolution() const { return resolution_; }
+	const Params& params() const { return params_; }
+
+	/** log-likelihood for endpoints outside of the map. Like
+	 * COccupancyGridMap2D, the cells of the last row and column get it too. */
+	float outOfMapValue() const { return out_of_map_; }
+
+	/**
+	 * Table of log-likelihood values: tilesX() * tilesY() row-major tiles of
+	 *TILE_CELLS cells in Morton order, see cellIndex(). nullptr if the field
+	 *is quantized.
+	 **/
+	const float* data() const { return cells_; }
+
+	/** True if the table is quantizedData() instead of data() */
+	bool isQuantized() const { return qcells_ != nullptr; }
+
+	/**
+	 * Table of a quantized field, nullptr otherwise: same layout as data(),
+	 *with cells of log-likelihood outOfMapValue() + quantizationScale() * q.
+	 *The lowest value (far from obstacles and out of the map) is q = 0.
+	 **/
+	const uint8_t* quantizedData() const { return qcells_; }
+	float quantizationScale() const { return scale_; }
+
+	/** Bits of v (less than TILE_SIZE) moved to the even positions */
+	static unsigned int spreadBits(unsigned int v)
+	{
+		v = (v | (v << 4)) & 0x0f0f;
+		v = (v | (v << 2)) & 0x3333;
+		return (v | (v << 1)) & 0x5555;
+	}
+
+	/** Position of the cell (cx, cy) in the table, which must be in the map */
+	size_t cellIndex(int cx, int cy) const
+	{
+		const size_t tile = static_cast<size_t>(cy >> TILE_SHIFT) * tiles_x_ +
+			(cx >> TILE_SHIFT);
+		return (tile << (2 * TILE_SHIFT)) | spreadBits(cx & (TILE_SIZE - 1)) |
+			(spreadBits(cy & (TILE_SIZE - 1)) << 1);
+	}
+
+	/** log-likelihood of the cell (cx, cy), which must be in the map */
+	float cell(int cx, int cy) const
+	{
+		const size_t i = cellIndex(cx, cy);
+		return qcells_ ? out_of_map_ + scale_ * qcells_[i] : cells_[i];
+	}
+
+	/** Hash of the occupancy, geometry and parameters the field was built
+	 * from */
+	uint64_t key() const { return key_; }
+
+	/** True if data() points to a memory-mapped cache file */
+	bool isMemoryMapped() const { return static_cast<bool>(mapping_); }
+
+	/** Name of the cache file of this field, within a cache directory */
+	std::string cacheFileName() const;
+
+	/**
+	 * Saves the field in the binary format read by Create() from its cache
+	 * directory. The file is written under a temporary name and then
+	 *renamed, so that other processes never map a partial file.
+	 * @return false on I/O errors
+	 **/
+	bool saveToFile(const std::string& file) const;
+
+	/**
+	 * Deletes the least recently used cache files of the directory so that
+	 *at most max_files remain. Create() marks the files it maps as used.
+	 **/
+	static void evictCache(const std::string& cache_dir, size_t max_files);
+
+	/** log-likelihood of an endpoint at (x,y) in map coordinates */
+	float logLikelihood(float x, float y) const
+	{
+		const int cx = static_cast<int>(std::floor((x - x_min_) / resolution_));
+		const int cy = static_cast<int>(std::floor((y - y_min_) / resolution_));
+		if (cx < 0 || cy < 0 || cx >= size_x_ || cy >= size_y_)
+			return out_of_map_;
+		return cell(cx, cy);
+	}
+
+	/** Axis-aligned box, in map coordinates */
+	struct Box
+	{
+		float x_min, x_max, y_min, y_max;
+	};
+
+	/**
+	 * Asks the kernel to page in the tiles of a memory-mapped field in the
+	 *boxes, where the next evaluations will be. Tiles not in the boxes of
+	 *the last calls are paged out. It does nothing if the field is not
+	 *memory-mapped. The filters of several robots can share the field and
+	 *call it concurrently.
+	 **/
+	void prefetch(const std::vector<Box>& boxes) const;
+
+	/** Pages out all the tiles of a memory-mapped field */
+	void release() const;
+
+   private:
+	LikelihoodField() = default;
+
+	void setGeometry(
+		const std::vector<uint8_t>& occupied, int size_x, int size_y,
+		float x_min, float y_min, float resolution, const Params& params,
+		bool quantized);
+	void compute(const std::vector<uint8_t>& occupied);
+	bool mapFile(const std::string& file);
+
+	int size_x_ = 0;
+	int size_y_ = 0;
+	int tiles_x_ = 0;
+	int tiles_y_ = 0;
+	float x_min_ = 0;
+	float y_min_ = 0;
+	float resolution_ = 1;
+	Params params_;
+	float out_of_map_ = 0;
+	float scale_ = 0;  ///< of quantized cells
+	bool quantized_ = false;
+	uint64_t key_ = 0;
+	const float* cells_ = nullptr;
+	const uint8_t* qcells_ = nullptr;
+	/** Storage, if not memory-mapped (only one of them is used) */
+	std::vector<float> own_cells_;
+	std::vector<uint8_t> own_qcells_;
+	std::shared_ptr<const void> mapping_;  ///< keeps the cache file mapped
+	/** prefetch() call that last used each tile, 0 if not paged in by it */
+	mutable std::vector<uint32_t> tile_last_use_;
+	mutable uint32_t prefetch_count_ = 0;
+	mutable std::mutex prefetch_mutex_;	 ///< guards the two members above
+
+	size_t numTableCells() const
+	{
+		return static_cast<size_t>(tiles_x_) * tiles_y_ * TILE_CELLS;
+	}
+	size_t cellBytes() const { return quantized_ ? 1 : sizeof(float); }
+	const char* table() const
+	{
+		return quantized_ ? reinterpret_cast<const char*>(qcells_)
+						  : reinterpret_cast<const char*>(cells_);
+	}
+	/** Calls madvise() for the tiles [first, first + count) */
+	void advise(size_t first, size_t count, int advice) const;
+};
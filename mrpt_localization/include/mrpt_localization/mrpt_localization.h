@@ -40,7 +40,12 @@
 #include <mrpt_localization/mrpt_localization_core.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 class PFLocalization : public PFLocalizationCore
 {
@@ -55,6 +60,8 @@ class PFLocalization : public PFLocalizationCore
 		std::string sensor_sources;	 //!< A list of topics (e.g. laser scanners)
 		//! to subscribe to for sensory data. Split
 		//! with "," (e.g. "laser1,laser2")
+		double update_min_d;  //!< meters, negative to read it from ini_file
+		double update_min_a;  //!< radians, negative to read it from ini_file
 		bool* use_motion_model_default_options;
 		CActionRobotMovement2D::TMotionModelOptions* motion_model_options;
 		CActionRobotMovement2D::TMotionModelOptions*
@@ -65,8 +72,15 @@ class PFLocalization : public PFLocalizationCore
 
    protected:
 	Parameters* param_;
+	const PFLocalization* map_owner_ = nullptr;	 ///< init() shares its map
+	/// instead of loading one
 	void init();
+	/** Creates the 3D window and starts the render thread */
 	void init3DDebug();
+	/**
+	 * Hands the particles and the observations of the last update to the
+	 *render thread, which draws them at SHOW_PROGRESS_3D_FPS_
+	 **/
 	void show3DDebug(CSensoryFrame::Ptr _observations);
 	void configureFilter(const mrpt::config::CConfigFile& _configFile);
 	virtual bool waitForMap() { return false; }
@@ -76,5 +90,23 @@ class PFLocalization : public PFLocalizationCore
 	int SCENE3D_FREQ_;
 	bool SCENE3D_FOLLOW_;
 	bool SHOW_PROGRESS_3D_REAL_TIME_;
-	int SHOW_PROGRESS_3D_REAL_TIME_DELAY_MS_;
+	int SHOW_PROGRESS_3D_FPS_;	///< frames per second of the render thread
+
+   private:
+	/** What the render thread draws, taken after an update */
+	struct DebugFrame
+	{
+		mrpt::system::TTimeStamp stamp = INVALID_TIMESTAMP;
+		PoseStatistics stats;
+		std::vector<float> xs, ys;	///< particles
+		CSensoryFrame observations;	 ///< deep copy, not shared with the node
+	};
+	/** Latest frame, immutable once published */
+	std::shared_ptr<const DebugFrame> debug_frame_;
+	std::mutex debug_frame_mutex_;	///< guards the swaps of debug_frame_
+	std::atomic<bool> stop_render_{false};
+	std::thread render_thread_;	 ///< the only user of win3D_ once started
+
+	void renderThread();
+	void render3DDebug(const DebugFrame& frame);
 };
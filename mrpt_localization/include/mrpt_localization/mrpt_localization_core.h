@@ -43,8 +43,16 @@
 #include <mrpt/poses/CPosePDFGaussian.h>
 #include <mrpt/slam/CMonteCarloLocalization2D.h>
 #include <mrpt/system/CTicTac.h>
+#include <mrpt_localization/beam_selector.h>
+#include <mrpt_localization/free_cell_index.h>
+#include <mrpt_localization/global_localizer.h>
+#include <mrpt_localization/mrpt_localization_pdf.h>
+#include <mrpt_localization/particle_clusterer.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <iostream>
 using namespace mrpt::maps;
 using namespace mrpt::obs;
@@ -60,6 +68,47 @@ class PFLocalizationCore
 		IDLE
 	};
 
+	/** Weighted statistics of the particles, computed once per update */
+	struct PoseStatistics
+	{
+		mrpt::poses::CPose2D mean;
+		mrpt::math::CMatrixDouble33 cov;
+		double ess = 0;	 ///< effective sample size
+		size_t num_particles = 0;
+		/** Heaviest clusters of particles, by decreasing weight */
+		std::vector<ParticleClusterer::Cluster> clusters;
+
+		/** Mean of the heaviest cluster, or the overall mean without clusters */
+		const mrpt::poses::CPose2D& dominantPose() const
+		{
+			return clusters.empty() ? mean : clusters.front().mean;
+		}
+		/** Covariance of the heaviest cluster, matching dominantPose() */
+		const mrpt::math::CMatrixDouble33& dominantCov() const
+		{
+			return clusters.empty() ? cov : clusters.front().cov;
+		}
+	};
+
+	/** Duration of the stages of the last update, and state of the filter */
+	struct UpdateDiagnostics
+	{
+		double beam_selection_time = 0;	 ///< seconds
+		double prefetch_time = 0;  ///< paging in the likelihood field
+		double prediction_time = 0;	 ///< motion model
+		double weighting_time = 0;
+		double resampling_time = 0;	 ///< rest of the filter step
+		bool stages_measured = false;  ///< the three times above are only
+		/// measured when a kernel weights the particles
+		double filter_time = 0;	 ///< whole particle filter step
+		double statistics_time = 0;	 ///< pose statistics, clustering, sample
+		/// size adaptation and random particles
+		double total_time = 0;
+		double ess = 0;	 ///< effective sample size ratio before resampling
+		size_t num_particles = 0;  ///< after the update
+		size_t num_evaluations = 0;	 ///< beam-particle evaluations
+	};
+
 	PFLocalizationCore();
 	~PFLocalizationCore();
 
@@ -90,16 +139,17 @@ class PFLocalizationCore
 		pf_;  ///< common interface for particle filters
 	mrpt::bayes::CParticleFilter::TParticleFilterStats
 		pf_stats_;	///< filter statistics
-	mrpt::slam::CMonteCarloLocalization2D pdf_;	 ///< the filter
+	PFLocalizationPDF pdf_;	 ///< the filter
+	PoseStatistics pose_stats_;	 ///< statistics of pdf_ after the last update
 	mrpt::poses::CPosePDFGaussian
 		initial_pose_;	///< initial posed used in initializeFilter()
 	int initial_particle_count_;  ///< number of particles for initialization
 	mrpt::system::TTimeStamp time_last_update_;	 ///< time of the last update
 	mrpt::system::CTicTac tictac_;	///< timer to measure performance
-	size_t update_counter_;	 ///< internal counter to count the number of filter
-	/// updates
-	PFStates state_;  ///< filter states to perform things like init on the
-	/// correct time
+	std::atomic<size_t> update_counter_;  ///< internal counter to count the
+	/// number of filter updates
+	std::atomic<PFStates> state_;  ///< filter states to perform things like
+	/// init on the correct time
 	mrpt::poses::CPose2D
 		odom_last_observation_;	 ///< pose at the last observation
 	bool init_PDF_mode;	 ///< Initial PDF mode: 0 for free space cells, 1 for
@@ -108,6 +158,109 @@ class PFLocalizationCore
 	float init_PDF_max_x;
 	float init_PDF_min_y;
 	float init_PDF_max_y;
+	std::string likelihood_cache_dir_;	///< where likelihood fields are
+	/// persisted, empty to disable the cache
+	size_t likelihood_cache_max_files_ = 4;	 ///< the least recently used
+	/// fields beyond this are deleted from the cache
+	bool quantize_likelihood_field_ = false;  ///< 8 bit likelihood field
+	BeamSelector beam_selector_;  ///< bounds the time spent weighting scans
+	CSensoryFrame beam_frame_;	///< observations thinned by beam_selector_
+	double update_time_target_ = 0;	 ///< seconds per update the sample size
+	/// is adapted to, 0 to disable it
+	unsigned int kld_max_sample_size_ = 0;	///< configured KLD_maxSampleSize
+	double update_time_ = 0;  ///< duration of the last filter update (s)
+	UpdateDiagnostics update_diagnostics_;	///< of the last update
+	double time_per_particle_ = 0;	///< smoothed update time per particle (s)
+	double update_min_d_ = 0;  ///< translation (m) and rotation (rad) since
+	double update_min_a_ = 0;  ///< the last update required for a new one
+	GlobalLocalizer global_localizer_;
+	/** Pyramid searched by global_localizer_, shared by shareMap() */
+	struct LocalizationPyramid
+	{
+		std::mutex mutex;  ///< guards the lazy build of pyramid
+		GlobalLocalizer::Pyramid::ConstPtr pyramid;
+	};
+	std::shared_ptr<LocalizationPyramid> localization_pyramid_ =
+		std::make_shared<LocalizationPyramid>();
+	/** Free cells of the grid map, for sampling */
+	std::shared_ptr<const FreeCellIndex> free_cells_ =
+		std::make_shared<FreeCellIndex>();
+	ParticleClusterer clusterer_;  ///< modes of the particles, every update
+	/** Areas of the likelihood field paged in before an update */
+	std::vector<LikelihoodField::Box> prefetch_boxes_;
+	double random_particles_ratio_ = 0;	 ///< fraction of the particles
+	/// replaced by uniform samples of the free space after each update
+	bool concurrent_updates_ = false;  ///< filters of other robots in the
+	/// process are updated at the same time, sharing the map and the global
+	/// random generator of MRPT
+
+	/**
+	 * Rebuilds the structures derived from the map, it must be called every
+	 *time the contents of metric_map_ change
+	 **/
+	void onMapUpdated();
+
+	/**
+	 * (Re)builds the likelihood field used to weight laser scans, called by
+	 *onMapUpdated()
+	 **/
+	void updateLikelihoodField();
+
+	/**
+	 * Pyramid of the grid map searched by the global localization. It is
+	 *built by the first call after a map update, since most robots never
+	 *need it; the filters that share the map share it too.
+	 * @return nullptr without a grid map
+	 **/
+	GlobalLocalizer::Pyramid::ConstPtr localizationPyramid();
+
+	/**
+	 * Uses the map of owner and the structures derived from it instead of
+	 *loading one, so that the filters of several robots keep a single copy.
+	 *The owner must already have its map, which must not change afterwards.
+	 **/
+	void shareMap(const PFLocalizationCore& owner);
+
+	/**
+	 * Computes pose_stats_ in a single pass over the particles, and clusters
+	 *them; it is called after every update
+	 **/
+	void updatePoseStatistics();
+
+	/**
+	 * Searches the scans of the frame in the whole grid map and resets the
+	 *filter with a tight Gaussian around each of the best poses found
+	 * @return false if there is no grid map, no scan points or no pose
+	 **/
+	bool globalLocalization(const CSensoryFrame& sf);
+
+	/**
+	 * Lowers (or restores up to kld_max_sample_size_) the KLD_maxSampleSize
+	 *of the filter so that the next updates take about update_time_target_
+	 **/
+	void adaptSampleSize();
+
+	/**
+	 * Pages in the tiles of a memory-mapped likelihood field the scans of the
+	 *frame can reach from the clusters of particles
+	 **/
+	void prefetchLikelihoodField(const CSensoryFrame& sf);
+
+	/**
+	 * Resets the filter with count particles uniformly distributed over the
+	 *free cells in the box
+	 * @return false if the free cell index has no cell in the box
+	 **/
+	bool resetUniformFreeCells(
+		size_t count, float min_x, float max_x, float min_y, float max_y,
+		float min_phi, float max_phi);
+
+	/**
+	 * Replaces random_particles_ratio_ of the particles with uniform samples
+	 *of the free space (augmented MCL), so that the filter can recover from
+	 *a wrong convergence
+	 **/
+	void injectRandomParticles();
 
    private:
 	/**
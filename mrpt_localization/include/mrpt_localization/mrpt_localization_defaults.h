@@ -37,3 +37,6 @@
 #define MRPT_LOCALIZATION_DEFAULT_INI_FILE "pf-localization.ini"
 #define MRPT_LOCALIZATION_DEFAULT_MAP_FILE ""
 #define MRPT_LOCALIZATION_DEFAULT_SENSOR_SOURCES "scan,scan1,scan2"
+// negative: taken from the ini file
+#define MRPT_LOCALIZATION_DEFAULT_UPDATE_MIN_D -1.0
+#define MRPT_LOCALIZATION_DEFAULT_UPDATE_MIN_A -1.0
@@ -0,0 +1,161 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt/obs/CActionRobotMovement2D.h>
+#include <mrpt/obs/CObservation2DRangeScan.h>
+#include <mrpt/obs/CObservationBeaconRanges.h>
+#include <mrpt/slam/CMonteCarloLocalization2D.h>
+#include <mrpt/system/CTicTac.h>
+#include <mrpt_localization/beacon_likelihood_kernel.h>
+#include <mrpt_localization/likelihood_field.h>
+#include <mrpt_localization/particle_arena.h>
+#include <mrpt_localization/scan_likelihood_kernel.h>
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * Monte Carlo localization filter which, with the standard proposal,
+ * weights 2D laser scans with ScanLikelihoodKernel over a precomputed
+ * LikelihoodField instead of calling
+ * CMetricMap::computeObservationLikelihood() once per particle, and beacon
+ * ranges with a BeaconLikelihoodKernel. Any other observation, map or
+ * algorithm falls back to the MRPT implementation.
+ *
+ * With use_particle_arena, those updates run on a ParticleArena instead of
+ * the particle list of MRPT: the particles are copied into it, the KLD
+ * resampling (systematic or stratified) and the prediction work on its
+ * arrays, and the resulting particles are copied back to m_particles.
+ * Resampling by the particle filter (without adaptive sample size) goes
+ * through the arena as well. It is experimental and off by default: the
+ * copies of loadArena() and storeArena() are paid in every update, and
+ * m_particles still allocates whenever it grows, so only the allocations of
+ * the resampling itself are avoided.
+ **/
+class PFLocalizationPDF : public mrpt::slam::CMonteCarloLocalization2D
+{
+   public:
+	PFLocalizationPDF(size_t M = 1) : CMonteCarloLocalization2D(M) {}
+
+	bool use_scan_kernel = true;  ///< enables the vectorized scan likelihood
+	LikelihoodField::ConstPtr
+		likelihood_field;  ///< field of the map, empty if not applicable
+	bool use_particle_arena = false;  ///< see the class description
+	bool use_beacon_kernel = true;	///< enables the beacon range kernel
+	BeaconLikelihoodKernel
+		beacon_kernel;	///< beacons of the map, empty if not applicable
+
+	/**
+	 * Lends the filter, for the lifetime of the object, the lock the caller
+	 *holds while the filter draws from the global random generator; the
+	 *filter releases it while the kernels weight the particles
+	 **/
+	class RandomLockScope
+	{
+	   public:
+		RandomLockScope(
+			PFLocalizationPDF& pdf, std::unique_lock<std::mutex>* lock)
+			: pdf_(pdf)
+		{
+			pdf_.random_lock_ = lock;
+		}
+		~RandomLockScope() { pdf_.random_lock_ = nullptr; }
+		RandomLockScope(const RandomLockScope&) = delete;
+		RandomLockScope& operator=(const RandomLockScope&) = delete;
+
+	   private:
+		PFLocalizationPDF& pdf_;
+	};
+
+	/** Preallocates the arena for this number of particles */
+	void reserveParticles(size_t count) { arena_.reserve(count); }
+
+	/** Measurements of the last call to the standard proposal */
+	struct UpdateStats
+	{
+		bool used_scan_kernel = false;	///< weighting by the scan kernel only
+		bool used_beacon_kernel = false;
+		double prediction_time = 0;	 ///< seconds, without the arena KLD
+		double weighting_time = 0;	///< seconds, only with the kernel
+		size_t num_evaluations = 0;	 ///< beam-particle evaluations
+	};
+	UpdateStats last_update_stats;
+
+	void prediction_and_update_pfStandardProposal(
+		const mrpt::obs::CActionCollection* action,
+		const mrpt::obs::CSensoryFrame* observation,
+		const mrpt::bayes::CParticleFilter::TParticleFilterOptions& PF_options)
+		override;
+
+	void performSubstitution(const std::vector<size_t>& indx) override;
+
+   private:
+	/**
+	 * Loads the beam endpoints of all the scans in the frame into kernel_,
+	 *and the beacon observations into beacon_observations_
+	 * @return false if the frame has observations the kernels can not handle
+	 **/
+	bool loadObservations(const mrpt::obs::CSensoryFrame& observation);
+
+	/** Copies m_particles into arena_ */
+	void loadArena();
+	/** Copies arena_ into m_particles, reusing its elements */
+	void storeArena();
+	/**
+	 * KLD-sampling of arena_: resamples it and moves the particles, as many
+	 *as needed for the bins occupied by the moved ones
+	 * @return the seconds spent in predict()
+	 **/
+	double sampleKLD(
+		const mrpt::bayes::CParticleFilter::TParticleFilterOptions&
+			PF_options,
+		const mrpt::obs::CActionRobotMovement2D& movement);
+	/** Moves the particles in arena_ by samples of the robot movement */
+	void predict(const mrpt::obs::CActionRobotMovement2D& movement);
+	/** Number of KLD bins of the particles in arena_ */
+	size_t countBins();
+
+	mrpt::system::CTicTac tictac_;
+	ScanLikelihoodKernel kernel_;
+	ParticlesSoA particles_soa_;
+	std::vector<double> log_lik_;
+	std::vector<const mrpt::obs::CObservationBeaconRanges*>
+		beacon_observations_;
+	ParticleArena arena_;
+	std::vector<uint64_t> bins_;  ///< open addressing set of countBins()
+	std::unique_lock<std::mutex>* random_lock_ = nullptr;  ///< see
+	/// RandomLockScope
+};
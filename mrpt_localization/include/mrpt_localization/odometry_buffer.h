@@ -0,0 +1,85 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt/poses/CPose2D.h>
+#include <mrpt/system/datetime.h>
+
+#include <deque>
+#include <mutex>
+
+/**
+ * Thread-safe history of the odometry of the robot, which answers the pose
+ * at any time in the buffered interval by linear interpolation (with a
+ * short linear extrapolation past the newest sample), without waiting.
+ **/
+class OdometryBuffer
+{
+   public:
+	OdometryBuffer(size_t capacity = 1000) : capacity_(capacity) {}
+
+	/** Samples older than time - this (seconds) are dropped */
+	double max_age = 5.0;
+	/** Queries up to this time (seconds) after the newest sample are
+	 * answered extrapolating the last velocity */
+	double max_extrapolation = 0.1;
+
+	/**
+	 * Adds a sample. A stamp older than the newest one (e.g. a restarted
+	 *bag or simulation) clears the buffer.
+	 **/
+	void insert(
+		mrpt::system::TTimeStamp time, const mrpt::poses::CPose2D& pose);
+
+	/**
+	 * Odometry at the given time
+	 * @return false if the time is out of the buffered interval
+	 **/
+	bool interpolate(
+		mrpt::system::TTimeStamp time, mrpt::poses::CPose2D& pose) const;
+
+	void clear();
+	bool empty() const;
+
+   private:
+	struct Sample
+	{
+		mrpt::system::TTimeStamp time;
+		mrpt::poses::CPose2D pose;
+	};
+
+	size_t capacity_;
+	std::deque<Sample> samples_;
+	mutable std::mutex mutex_;
+};
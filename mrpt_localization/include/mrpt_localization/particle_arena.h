@@ -0,0 +1,113 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace mrpt::random
+{
+class CRandomGenerator;
+}
+
+/**
+ * Particle poses and log-weights stored in preallocated arrays (structure
+ * of arrays), plus a second set of arrays that resampling writes into
+ * before swapping both. Once reserve() was called with the maximum number
+ * of particles, resampling does not allocate memory.
+ **/
+class ParticleArena
+{
+   public:
+	enum class Resampling
+	{
+		SYSTEMATIC,	 ///< one random offset for all the samples
+		STRATIFIED	///< one random offset per sample
+	};
+
+	/** Allocates room for capacity particles, if there is not already */
+	void reserve(size_t capacity);
+	size_t capacity() const { return front_.x.size(); }
+
+	size_t size() const { return size_; }
+	/** Changes the number of particles, which must be below capacity() */
+	void resize(size_t n);
+
+	double* x() { return front_.x.data(); }
+	double* y() { return front_.y.data(); }
+	double* phi() { return front_.phi.data(); }
+	double* logW() { return front_.log_w.data(); }
+	const double* x() const { return front_.x.data(); }
+	const double* y() const { return front_.y.data(); }
+	const double* phi() const { return front_.phi.data(); }
+	const double* logW() const { return front_.log_w.data(); }
+
+	/**
+	 * Draws count particle indices with probability proportional to their
+	 *weights, in increasing order. Only the last selection is kept.
+	 * @param count at most capacity()
+	 * @return the indices, valid until the next call
+	 **/
+	const size_t* select(
+		size_t count, Resampling method, mrpt::random::CRandomGenerator& rng);
+
+	/**
+	 * Replaces the particles with the ones at the given indices (repeated
+	 *indices make copies), keeping their weights. The arena grows if count
+	 *is larger than capacity().
+	 **/
+	void gather(const size_t* indices, size_t count);
+	/** Undoes the last gather(): the particles it replaced, unchanged, are
+	 * the current ones again */
+	void restore();
+
+   private:
+	struct Buffer
+	{
+		std::vector<double> x, y, phi, log_w;
+		void resize(size_t n)
+		{
+			x.resize(n);
+			y.resize(n);
+			phi.resize(n);
+			log_w.resize(n);
+		}
+	};
+	Buffer front_;
+	Buffer back_;  ///< destination of gather()
+	size_t size_ = 0;
+	size_t back_size_ = 0;	///< particles in back_
+	std::vector<double> cumulative_;  ///< of the weights, for select()
+	std::vector<size_t> indices_;  ///< result of select()
+};
@@ -0,0 +1,117 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt/math/CMatrixFixed.h>
+#include <mrpt/poses/CPose2D.h>
+#include <mrpt/poses/CPosePDFParticles.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Groups the particles of the filter into clusters of connected cells of a
+ * (x, y, yaw) grid: the occupied cells are kept in a hash table and merged
+ * with their occupied neighbors with union-find, so the cost is linear in
+ * the number of particles. It exposes the modes of multimodal distributions,
+ * whose overall mean may lie in between them, e.g. inside a wall.
+ **/
+class ParticleClusterer
+{
+   public:
+	struct Cluster
+	{
+		double weight = 0;	///< normalized, the weights of all clusters add 1
+		mrpt::poses::CPose2D mean;
+		mrpt::math::CMatrixDouble33 cov;
+		size_t num_particles = 0;
+	};
+
+	/** Axis-aligned bounding box of the positions of a cluster */
+	struct Box
+	{
+		double x_min, x_max, y_min, y_max;
+	};
+
+	double bin_size_xy = 0.5;  ///< meters
+	double bin_size_phi = 0.1745;  ///< radians
+	size_t max_clusters = 5;  ///< heaviest clusters returned, 0 disables it
+
+	/**
+	 * Clusters the particles
+	 * @param clusters output, the heaviest clusters by decreasing weight
+	 **/
+	void cluster(
+		const mrpt::poses::CPosePDFParticles::CParticleList& particles,
+		std::vector<Cluster>& clusters);
+
+	/**
+	 * Bounding boxes of all the clusters of the last call to cluster(), not
+	 *only of the heaviest ones; empty if clustering is disabled
+	 **/
+	const std::vector<Box>& boxes() const { return boxes_; }
+
+   private:
+	static constexpr uint64_t EMPTY = ~uint64_t(0);
+
+	/** Weighted moments of a cluster, relative to its first particle */
+	struct Moments
+	{
+		mrpt::math::TPose2D ref;
+		double sw = 0, sx = 0, sy = 0, sa = 0;
+		double sxx = 0, syy = 0, saa = 0, sxy = 0, sxa = 0, sya = 0;
+		double sin_sum = 0, cos_sum = 0;
+		size_t count = 0;
+		Box box;
+	};
+
+	int num_phi_bins_ = 1;
+	int hash_bits_ = 0;
+	std::vector<uint64_t> hash_keys_;  ///< open addressing table of bins
+	std::vector<uint32_t> hash_bins_;
+	std::vector<uint64_t> bin_keys_;
+	std::vector<uint32_t> parent_;	///< union-find forest of bins
+	std::vector<uint32_t> particle_bin_;
+	std::vector<int32_t> bin_cluster_;
+	std::vector<Moments> moments_;
+	std::vector<uint32_t> order_;
+	std::vector<Box> boxes_;
+
+	uint64_t key(int64_t x, int64_t y, int64_t phi) const;
+	/** Bin of the key, or -1 if it is empty */
+	int64_t find(uint64_t key) const;
+	uint32_t insert(uint64_t key);
+	uint32_t root(uint32_t bin);
+};
@@ -0,0 +1,116 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt_localization/likelihood_field.h>
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace mrpt::obs
+{
+class CObservation2DRangeScan;
+}
+
+/**
+ * Particle poses stored as a structure of arrays, so that SIMD code can
+ * process several particles with each instruction.
+ **/
+struct ParticlesSoA
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> cos_phi;
+	std::vector<float> sin_phi;
+
+	size_t size() const { return x.size(); }
+	void resize(size_t n)
+	{
+		x.resize(n);
+		y.resize(n);
+		cos_phi.resize(n);
+		sin_phi.resize(n);
+	}
+	void set(size_t i, double _x, double _y, double _phi)
+	{
+		x[i] = static_cast<float>(_x);
+		y[i] = static_cast<float>(_y);
+		cos_phi[i] = static_cast<float>(std::cos(_phi));
+		sin_phi[i] = static_cast<float>(std::sin(_phi));
+	}
+};
+
+/**
+ * Evaluates the log-likelihood of a set of range endpoints for many
+ * particles at once, reading a precomputed LikelihoodField.
+ * Uses AVX2 (with runtime detection) or NEON when available, and plain C++
+ * otherwise.
+ **/
+class ScanLikelihoodKernel
+{
+   public:
+	/** Removes all the beam endpoints */
+	void clear();
+	/** Adds a beam endpoint, in robot coordinates (meters) */
+	void addBeam(float x, float y);
+	/**
+	 * Adds the endpoints of the valid beams of a scan, in robot coordinates
+	 * @param decimation one of every decimation valid beams is kept, or all
+	 *of them if there are less than 10, as in
+	 *COccupancyGridMap2D::computeLikelihoodField_Thrun()
+	 **/
+	void addScan(
+		const mrpt::obs::CObservation2DRangeScan& scan,
+		unsigned int decimation);
+	/** Number of beam endpoints */
+	size_t size() const { return beam_x_.size(); }
+
+	/**
+	 * Writes in log_lik[i] the sum of the log-likelihood of all beams with
+	 * the robot at the pose of particle i
+	 * @param log_lik output array with particles.size() elements
+	 **/
+	void evaluate(
+		const ParticlesSoA& particles, const LikelihoodField& field,
+		double* log_lik) const;
+
+	/** Name of the instruction set used by evaluate(): "avx2", "neon" or
+	 * "scalar" */
+	static const char* implementation();
+
+   private:
+	std::vector<float> beam_x_;
+	std::vector<float> beam_y_;
+};
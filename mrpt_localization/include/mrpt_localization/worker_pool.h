@@ -0,0 +1,82 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Threads running the tasks of several clients, such as the updates of the
+ * filters of several robots. A task never runs in two threads at once, and
+ * tasks run in the order they were notified, so that a busy client does not
+ * starve the others.
+ **/
+class WorkerPool
+{
+   public:
+	explicit WorkerPool(size_t num_threads);
+	/** Waits for the running tasks; the notified ones are not run */
+	~WorkerPool();
+
+	/** Registers a task, the id returned is used to notify() it */
+	size_t add(std::function<void()> task);
+
+	/**
+	 * Runs the task as soon as a thread is free. Notifications of a task
+	 *that is waiting are merged, a task notified while it runs is run again.
+	 **/
+	void notify(size_t id);
+
+	size_t numThreads() const { return threads_.size(); }
+
+   private:
+	struct Task
+	{
+		std::function<void()> run;
+		bool queued = false;
+		bool running = false;
+	};
+	std::deque<Task> tasks_;  ///< add() does not move the existing ones
+	std::deque<size_t> ready_;	///< notified tasks, not running
+	bool stop_ = false;
+	std::mutex mutex_;	///< guards the members above
+	std::condition_variable cv_;
+	std::vector<std::thread> threads_;
+
+	void work();
+};
@@ -33,22 +33,43 @@
 
 #pragma once
 
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <dynamic_reconfigure/server.h>
+#include <geometry_msgs/PoseArray.h>
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <mrpt/obs/CObservation2DRangeScan.h>
 #include <mrpt/obs/CObservationOdometry.h>
 #include <nav_msgs/GetMap.h>
 #include <nav_msgs/MapMetaData.h>
 #include <nav_msgs/OccupancyGrid.h>
 #include <nav_msgs/Odometry.h>
+#include <ros/callback_queue.h>
 #include <ros/ros.h>
 #include <sensor_msgs/LaserScan.h>
+#include <std_msgs/Float32MultiArray.h>
+#include <std_msgs/Float64.h>
+#include <std_msgs/Float64MultiArray.h>
 #include <std_msgs/Header.h>
+#include <std_msgs/UInt32.h>
+#include <std_srvs/Empty.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>	// size_t
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
 
 #include "geometry_msgs/TransformStamped.h"
 #include "mrpt_localization/MotionConfig.h"
 #include "mrpt_localization/mrpt_localization.h"
+#include "mrpt_localization/odometry_buffer.h"
+#include "mrpt_localization/worker_pool.h"
 #include "mrpt_msgs/ObservationRangeBeacon.h"
 #include "tf2_geometry_msgs/tf2_geometry_msgs.h"
 #include "tf2_ros/buffer.h"
@@ -65,7 +86,8 @@ class PFLocalizationNode : public PFLocalization
 	{
 		static const int MOTION_MODEL_GAUSSIAN = 0;
 		static const int MOTION_MODEL_THRUN = 1;
-		Parameters(PFLocalizationNode* p);
+		/** @param ns namespace of the parameters */
+		Parameters(PFLocalizationNode* p, const std::string& ns = "~");
 		ros::NodeHandle node;
 		void callbackParameters(
 			mrpt_localization::MotionConfig& config, uint32_t level);
@@ -83,13 +105,15 @@ class PFLocalizationNode : public PFLocalization
 		/// we wait before start complaining
 		int parameter_update_skip;
 		int particlecloud_update_skip;
-		int map_update_skip;
 		std::string base_frame_id;
 		std::string odom_frame_id;
 		std::string global_frame_id;
+		std::string tf_prefix;	///< of the odom and base frames, if set
 		bool update_while_stopped;
 		bool update_sensor_pose;
 		bool pose_broadcast;
+		bool pose_extrapolation;  ///< publish the pose with every odometry
+		/// message, moving the last estimate by the odometry since its update
 		bool tf_broadcast;
 		bool use_map_topic;
 		bool first_map_only;
@@ -98,55 +122,271 @@ class PFLocalizationNode : public PFLocalization
 		double init_phi; //radians
 		double init_std_xy = 0.20; // m
 		double init_std_phi = 0.10; // rad
+		bool async_update;	///< run the filter in its own thread
+		int observation_queue_size;	 ///< observations waiting for the filter
+		/// thread, the oldest ones are dropped
+		double sensor_sync_window;	///< scans of different lasers closer in
+		/// time than this (seconds) are fused in one update, 0 to disable it
+		double robot_pose_min_period;  ///< external poses of a source closer
+		/// in time than this (seconds) only update the filter with the latest
+		/// one, 0 to use all of them
+		double robot_pose_tf_check_period;	///< seconds between lookups of
+		/// the transform from the global frame to each external pose source
+		double sensor_pose_check_period;  ///< seconds between lookups of
+		/// the pose of each sensor, with update_sensor_pose
+		std::string particlecloud_decimation;  ///< particles sent in the
+		/// PoseArray: "none", "top_k" (heaviest ones) or "binned" (heaviest
+		/// one per cell of particlecloud_bin_size and yaw sector)
+		int particlecloud_max_poses;  ///< limit of the PoseArray, 0: no limit
+		double particlecloud_bin_size;	///< meters
+		double diagnostics_period;	///< seconds aggregated in each message
+		/// on /diagnostics, 0 (the default) to disable them
+		std::string diagnostics_trace_file;	 ///< CSV file with the
+		/// measurements of every update, empty to disable it
 	};
 
-	PFLocalizationNode(ros::NodeHandle& n);
+	/**
+	 * Filter estimate read by the publishers. A new one is created after every
+	 * update, so it can be shared without locking the filter.
+	 **/
+	struct PoseSnapshot
+	{
+		PoseStatistics stats;
+		mrpt::system::TTimeStamp stamp;	 ///< time of the last update
+		size_t update_counter = 0;
+		double update_time = 0;	 ///< duration of the last update (seconds)
+		unsigned int max_sample_size = 0;  ///< KLD_maxSampleSize
+		/** Odometry at stamp, if the last update had odometry */
+		std::optional<mrpt::poses::CPose2D> odometry;
+	};
+
+	/**
+	 * @param n topics are advertised and subscribed in its namespace
+	 * @param robot name of the robot in a multi-robot server, its
+	 *parameters are read from the private namespace "~robot"
+	 * @param map_owner filter of another robot whose map is shared
+	 * @param worker_pool runs the updates, instead of the callbacks or a
+	 *thread of this filter
+	 **/
+	PFLocalizationNode(
+		ros::NodeHandle& n, const std::string& robot = "",
+		const PFLocalizationNode* map_owner = nullptr,
+		WorkerPool* worker_pool = nullptr);
 	virtual ~PFLocalizationNode();
 	void init();
 	void loop();
+	/** One iteration of loop(), without spinning the callbacks */
+	void loopOnce();
 	void callbackLaser(const sensor_msgs::LaserScan&);
 	void callbackBeacon(const mrpt_msgs::ObservationRangeBeacon&);
 	void callbackRobotPose(const geometry_msgs::PoseWithCovarianceStamped&);
-	void odometryForCallback(
+	/**
+	 * Odometry at the time of an observation, from the odom topic or from
+	 *tf, without waiting for it
+	 * @return false if tf has odometry, but not yet at that time; true with
+	 *an empty pointer if there is no odometry at all
+	 **/
+	bool odometryForCallback(
 		CObservationOdometry::Ptr&, const std_msgs::Header&);
 	void callbackInitialpose(const geometry_msgs::PoseWithCovarianceStamped&);
+	/** True if a pose of callbackInitialpose() waits for the next update */
+	bool initialPosePending();
 	void callbackOdometry(const nav_msgs::Odometry&);
 	void callbackMap(const nav_msgs::OccupancyGrid&);
 	void updateMap(const nav_msgs::OccupancyGrid&);
 	void publishTF();
 	void publishPose();
+	/** Publishes the last estimate moved by the odometry since its update */
+	void publishExtrapolatedPose(
+		const ros::Time& stamp, const mrpt::poses::CPose2D& odometry);
+
+	/** The latest filter estimate */
+	std::shared_ptr<const PoseSnapshot> snapshot();
 
    private:
 	ros::NodeHandle nh_;
+	std::string robot_;	 ///< empty unless in a multi-robot server
+	WorkerPool* worker_pool_;
+	size_t worker_id_ = 0;	///< of the updates of this filter in worker_pool_
 	bool first_map_received_;
 	ros::Time time_last_input_;
 	unsigned long long loop_count_;
-	nav_msgs::GetMap::Response resp_;
 	ros::Subscriber sub_init_pose_;
 	ros::Subscriber sub_odometry_;
 	std::vector<ros::Subscriber> sub_sensors_;
 	ros::Subscriber sub_map_;
 	ros::ServiceClient client_map_;
 	ros::Publisher pub_particles_;
+	ros::Publisher pub_particles_compact_;
+	geometry_msgs::PoseArray particle_poses_;  ///< reused between publishes
+	std_msgs::Float32MultiArray particles_compact_;
+	std::vector<double> particle_weights_;	///< normalized weights
+	std::vector<size_t> particle_selection_;  ///< particles in the PoseArray
 	ros::Publisher pub_map_;
 	ros::Publisher pub_metadata_;
 	ros::Publisher pub_pose_;
+	ros::Publisher pub_sample_size_;
+	ros::Publisher pub_update_time_;
+	size_t timing_update_counter_;	///< last update published by
+	/// publishFilterTiming()
+	ros::Publisher pub_clusters_;
+	ros::Publisher pub_cluster_stats_;
+	geometry_msgs::PoseArray cluster_poses_;  ///< reused between publishes
+	std_msgs::Float64MultiArray cluster_stats_;
+	size_t clusters_update_counter_;  ///< last update published by
+	/// publishClusters()
+
+	/** Measurements of the updates since the last publishDiagnostics() */
+	struct DiagnosticsWindow
+	{
+		/** Minimum, mean and maximum of a measurement */
+		struct Stat
+		{
+			double sum = 0, min = 0, max = 0;
+			size_t count = 0;
+			void add(double v)
+			{
+				min = count ? std::min(min, v) : v;
+				max = count ? std::max(max, v) : v;
+				sum += v;
+				count++;
+			}
+			double mean() const { return count ? sum / count : 0; }
+		};
+		Stat total, beam_selection, prefetch, prediction, weighting,
+			resampling, filter, statistics;	 ///< seconds
+		Stat ess, observation_age;
+		size_t updates = 0;
+		size_t num_particles = 0;  ///< after the last update
+		size_t dropped_observations = 0;  ///< by the async_update queue
+		size_t no_odometry_observations = 0;  ///< dropped, see
+		/// odometryForCallback()
+	};
+	DiagnosticsWindow diagnostics_;
+	std::mutex diagnostics_mutex_;	///< guards diagnostics_
+	ros::Time diagnostics_since_;  ///< start of the current window
+	ros::Publisher pub_diagnostics_;
+	std::ofstream diagnostics_trace_;  ///< written by the filter thread
+
+	/** Observation waiting for the filter thread */
+	struct PendingObservation
+	{
+		CSensoryFrame::Ptr sf;
+		std_msgs::Header header;
+	};
+	std::deque<PendingObservation> queue_;
+	std::optional<mrpt::poses::CPosePDFGaussian> pending_initial_pose_;
+	bool stop_filter_thread_ = false;
+	std::mutex queue_mutex_;  ///< guards the three members above
+	std::condition_variable queue_cv_;
+	std::thread filter_thread_;
+	std::mutex filter_mutex_;  ///< guards the filter and the map
+	std::shared_ptr<const PoseSnapshot> snapshot_;
+	std::mutex snapshot_mutex_;
 	ros::ServiceServer service_map_;
+	ros::ServiceServer service_reset_sensor_poses_;
+	ros::ServiceServer service_global_localization_;
+	/** Latest scan of each laser, for global localization */
+	std::map<std::string, CObservation2DRangeScan::Ptr> last_scans_;
+	OdometryBuffer odom_buffer_;  ///< odometry received on the odom topic
+	/** ROS time (seconds) at which the last odometry message arrived */
+	std::atomic<double> odometry_received_{0};
+	/** Odometry of the last update, guarded by filter_mutex_ */
+	std::optional<mrpt::poses::CPose2D> update_odometry_;
+	/** Odometry callbacks run in their own thread with pose_extrapolation */
+	ros::CallbackQueue odometry_queue_;
+	std::unique_ptr<ros::AsyncSpinner> odometry_spinner_;
 
 	tf2_ros::Buffer tf_buffer_;
 	tf2_ros::TransformListener tf_listener_{tf_buffer_};
 
 	tf2_ros::TransformBroadcaster tf_broadcaster_;
 
+	/** Scans of several lasers waiting to be fused in one update */
+	size_t num_scan_sources_;
+	CSensoryFrame::Ptr pending_scans_;
+	std_msgs::Header pending_scans_header_;	 ///< header of the first scan
+	ros::Time pending_scans_since_;	 ///< arrival time of the first scan
+	std::set<std::string> pending_scan_frames_;
+
+	/** Source of external poses (callbackRobotPose()) */
+	struct RobotPoseSource
+	{
+		geometry_msgs::Pose global_to_source;  ///< cached transform
+		bool has_transform = false;
+		ros::Time transform_checked;  ///< time of the last lookup
+		ros::Time last_update;	///< time the last pose was processed
+		/** Latest pose, waiting for robot_pose_min_period to elapse */
+		std::optional<geometry_msgs::PoseWithCovarianceStamped> pending;
+	};
+	std::map<std::string, RobotPoseSource> robot_pose_sources_;
+
 	std::map<std::string, mrpt::poses::CPose3D> laser_poses_;
 	std::map<std::string, mrpt::poses::CPose3D> beacon_poses_;
+	/** Time of the last lookup of each sensor pose with update_sensor_pose */
+	std::map<std::string, ros::Time> sensor_pose_checked_;
 
 	// methods
 	Parameters* param();
 	void update();
 	void updateSensorPose(std::string frame_id);
+	/** Looks the sensor pose up again, if sensor_pose_check_period elapsed
+	 * since the last time */
+	void refreshSensorPose(const std::string& frame_id);
+
+	/**
+	 * Runs the filter with an observation, or queues it for the filter thread
+	 *if Parameters::async_update is set
+	 **/
+	void processObservation(
+		CSensoryFrame::Ptr sf, const std_msgs::Header& header);
+	/** Updates the filter, filter_mutex_ must not be locked */
+	void updateWithObservation(
+		const CSensoryFrame::Ptr& sf, const std_msgs::Header& header);
+	void filterThread();
+	/**
+	 * Runs the filter with the oldest queued observation, in a thread of
+	 *worker_pool_, which is notified again if more are left
+	 **/
+	void processNextObservation();
+	/**
+	 * Adds the scan to the batch of the current sync window, which is
+	 *processed as soon as all the lasers have contributed to it
+	 **/
+	void aggregateScan(
+		const CObservation2DRangeScan::Ptr& scan,
+		const std_msgs::Header& header);
+	/** Processes the pending batch of scans, if any */
+	void flushScans();
+	/** Converts the pose into an observation for the filter */
+	void processRobotPose(
+		RobotPoseSource& source,
+		const geometry_msgs::PoseWithCovarianceStamped& pose);
+	/**
+	 * Looks up the transform from the global frame to the source again, if
+	 *robot_pose_tf_check_period elapsed since the last time
+	 * @return false if the transform is not known
+	 **/
+	bool updateRobotPoseTransform(
+		RobotPoseSource& source, const std::string& frame_id);
+	/** Processes the pending poses whose robot_pose_min_period elapsed */
+	void flushRobotPoses();
+	/** Stores the current estimate, filter_mutex_ must be locked */
+	void updateSnapshot();
+	/**
+	 * Adds the measurements of the last update to diagnostics_ and to the
+	 *trace file, filter_mutex_ must be locked
+	 **/
+	void recordDiagnostics(const std_msgs::Header& header);
 
 	void publishParticles();
+	void publishCompactParticles();
+	void publishParticlePoses();
+	/** Fills particle_selection_ according to particlecloud_decimation */
+	void selectParticles();
+	void publishFilterTiming();
+	void publishDiagnostics();
+	void publishClusters();
 	void useROSLogLevel();
 
 	bool waitForTransform(
@@ -156,6 +396,15 @@ class PFLocalizationNode : public PFLocalization
 		const ros::Duration& polling_sleep_duration = ros::Duration(0.01));
 	bool mapCallback(
 		nav_msgs::GetMap::Request& req, nav_msgs::GetMap::Response& res);
+	/** Resets the filter around the best poses of the latest scans */
+	bool globalLocalizationCallback(
+		std_srvs::Empty::Request& req, std_srvs::Empty::Response& res);
+	/** Forgets the cached sensor poses, they are looked up again in tf */
+	bool resetSensorPosesCallback(
+		std_srvs::Empty::Request& req, std_srvs::Empty::Response& res);
+	/** Publishes the grid map, the filter must not be updated meanwhile */
 	void publishMap();
+	/** The grid as a message in the global frame */
+	nav_msgs::OccupancyGrid gridMessage(const COccupancyGridMap2D& grid);
 	virtual bool waitForMap();
 };
@@ -37,6 +37,8 @@
 #define MRPT_LOCALIZATION_NODE_DEFAULT_RATE 10.0
 #define MRPT_LOCALIZATION_NODE_DEFAULT_PARAMETER_UPDATE_SKIP 1
 #define MRPT_LOCALIZATION_NODE_DEFAULT_PARTICLECLOUD_UPDATE_SKIP 5
-#define MRPT_LOCALIZATION_NODE_DEFAULT_MAP_UPDATE_SKIP 2
+#define MRPT_LOCALIZATION_NODE_DEFAULT_OBSERVATION_QUEUE_SIZE 1
+#define MRPT_LOCALIZATION_NODE_DEFAULT_PARTICLECLOUD_MAX_POSES 0
+#define MRPT_LOCALIZATION_NODE_DEFAULT_PARTICLECLOUD_BIN_SIZE 0.25
 
 #endif  // MRPT_LOCALIZATION_NODE_DEFAULTS_H
@@ -0,0 +1,282 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/maps/CBeaconMap.h>
+#include <mrpt/obs/CObservationBeaconRanges.h>
+#include <mrpt_localization/beacon_likelihood_kernel.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__GNUC__) || defined(__clang__))
+#define BEACON_KERNEL_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define BEACON_KERNEL_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+/**
+ * One range, with the beacon relative to the sensor height. With d the
+ *vector from the beacon to the sensor, the variance of the range is
+ *var_r + d^T.C.d / |d|^2 (C the covariance of the beacon), and
+ *d^T.C.d = dx (cxx dx + cxy2 dy + ax) + dy (cyy dy + ay) + a0.
+ **/
+struct RangeArgs
+{
+	float sx, sy;  ///< sensor position on the robot
+	float bx, by;  ///< beacon position
+	float dz_sq;  ///< squared height of the sensor over the beacon
+	float range;
+	float var_r;  ///< rangeStd^2
+	float cxx, cxy2, cyy;  ///< cxy2 = 2 cxy
+	float ax, ay, a0;  ///< 2 cxz dz, 2 cyz dz and czz dz^2
+};
+
+/** Avoids 0 / 0 with the sensor on the beacon */
+constexpr float MIN_DIST_SQ = 1e-12f;
+
+void evaluateScalar(
+	const ParticlesSoA& p, const RangeArgs& r, double* out, size_t first)
+{
+	for (size_t i = first; i < p.size(); i++)
+	{
+		const float c = p.cos_phi[i], s = p.sin_phi[i];
+		const float dx = p.x[i] + c * r.sx - s * r.sy - r.bx;
+		const float dy = p.y[i] + s * r.sx + c * r.sy - r.by;
+		const float d_sq =
+			std::max(dx * dx + dy * dy + r.dz_sq, MIN_DIST_SQ);
+		const float e = std::sqrt(d_sq) - r.range;
+		const float q = dx * (r.cxx * dx + r.cxy2 * dy + r.ax) +
+			dy * (r.cyy * dy + r.ay) + r.a0;
+		out[i] += -0.5f * e * e * d_sq / (q + r.var_r * d_sq);
+	}
+}
+
+#ifdef BEACON_KERNEL_HAVE_AVX2
+bool cpuHasAVX2()
+{
+	static const bool has =
+		__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return has;
+}
+
+/** Processes particles in blocks of 8, returns how many were done */
+__attribute__((target("avx2,fma"))) size_t evaluateAVX2(
+	const ParticlesSoA& p, const RangeArgs& r, double* out)
+{
+	const size_t N = p.size() & ~size_t(7);
+	const __m256 sx = _mm256_set1_ps(r.sx);
+	const __m256 sy = _mm256_set1_ps(r.sy);
+	const __m256 bx = _mm256_set1_ps(r.bx);
+	const __m256 by = _mm256_set1_ps(r.by);
+	const __m256 dz_sq = _mm256_set1_ps(r.dz_sq);
+	const __m256 range = _mm256_set1_ps(r.range);
+	const __m256 var_r = _mm256_set1_ps(r.var_r);
+	const __m256 cxx = _mm256_set1_ps(r.cxx);
+	const __m256 cxy2 = _mm256_set1_ps(r.cxy2);
+	const __m256 cyy = _mm256_set1_ps(r.cyy);
+	const __m256 ax = _mm256_set1_ps(r.ax);
+	const __m256 ay = _mm256_set1_ps(r.ay);
+	const __m256 a0 = _mm256_set1_ps(r.a0);
+	const __m256 min_d_sq = _mm256_set1_ps(MIN_DIST_SQ);
+	const __m256 minus_half = _mm256_set1_ps(-0.5f);
+
+	for (size_t i = 0; i < N; i += 8)
+	{
+		const __m256 c = _mm256_loadu_ps(&p.cos_phi[i]);
+		const __m256 s = _mm256_loadu_ps(&p.sin_phi[i]);
+		const __m256 dx = _mm256_sub_ps(
+			_mm256_fmadd_ps(
+				c, sx, _mm256_fnmadd_ps(s, sy, _mm256_loadu_ps(&p.x[i]))),
+			bx);
+		const __m256 dy = _mm256_sub_ps(
+			_mm256_fmadd_ps(
+				s, sx, _mm256_fmadd_ps(c, sy, _mm256_loadu_ps(&p.y[i]))),
+			by);
+		const __m256 d_sq = _mm256_max_ps(
+			_mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, dz_sq)),
+			min_d_sq);
+		const __m256 e = _mm256_sub_ps(_mm256_sqrt_ps(d_sq), range);
+		const __m256 q = _mm256_fmadd_ps(
+			dx, _mm256_fmadd_ps(cxx, dx, _mm256_fmadd_ps(cxy2, dy, ax)),
+			_mm256_fmadd_ps(dy, _mm256_fmadd_ps(cyy, dy, ay), a0));
+		const __m256 ll = _mm256_div_ps(
+			_mm256_mul_ps(minus_half, _mm256_mul_ps(_mm256_mul_ps(e, e), d_sq)),
+			_mm256_fmadd_ps(var_r, d_sq, q));
+
+		_mm256_storeu_pd(
+			&out[i],
+			_mm256_add_pd(
+				_mm256_loadu_pd(&out[i]),
+				_mm256_cvtps_pd(_mm256_castps256_ps128(ll))));
+		_mm256_storeu_pd(
+			&out[i + 4],
+			_mm256_add_pd(
+				_mm256_loadu_pd(&out[i + 4]),
+				_mm256_cvtps_pd(_mm256_extractf128_ps(ll, 1))));
+	}
+	return N;
+}
+#endif
+
+#ifdef BEACON_KERNEL_HAVE_NEON
+/** Processes particles in blocks of 4, returns how many were done */
+size_t evaluateNEON(const ParticlesSoA& p, const RangeArgs& r, double* out)
+{
+	const size_t N = p.size() & ~size_t(3);
+	const float32x4_t dz_sq = vdupq_n_f32(r.dz_sq);
+	const float32x4_t range = vdupq_n_f32(r.range);
+	const float32x4_t min_d_sq = vdupq_n_f32(MIN_DIST_SQ);
+
+	for (size_t i = 0; i < N; i += 4)
+	{
+		const float32x4_t c = vld1q_f32(&p.cos_phi[i]);
+		const float32x4_t s = vld1q_f32(&p.sin_phi[i]);
+		const float32x4_t dx = vsubq_f32(
+			vmlaq_n_f32(vmlsq_n_f32(vld1q_f32(&p.x[i]), s, r.sy), c, r.sx),
+			vdupq_n_f32(r.bx));
+		const float32x4_t dy = vsubq_f32(
+			vmlaq_n_f32(vmlaq_n_f32(vld1q_f32(&p.y[i]), c, r.sy), s, r.sx),
+			vdupq_n_f32(r.by));
+		const float32x4_t d_sq = vmaxq_f32(
+			vmlaq_f32(vmlaq_f32(dz_sq, dy, dy), dx, dx), min_d_sq);
+		const float32x4_t e = vsubq_f32(vsqrtq_f32(d_sq), range);
+		const float32x4_t q = vmlaq_f32(
+			vmlaq_f32(vdupq_n_f32(r.a0), dy,
+				vmlaq_n_f32(vdupq_n_f32(r.ay), dy, r.cyy)),
+			dx,
+			vmlaq_n_f32(
+				vmlaq_n_f32(vdupq_n_f32(r.ax), dy, r.cxy2), dx, r.cxx));
+		const float32x4_t ll = vdivq_f32(
+			vmulq_n_f32(vmulq_f32(vmulq_f32(e, e), d_sq), -0.5f),
+			vmlaq_n_f32(q, d_sq, r.var_r));
+
+		const float64x2_t lo = vcvt_f64_f32(vget_low_f32(ll));
+		const float64x2_t hi = vcvt_high_f64_f32(ll);
+		vst1q_f64(&out[i], vaddq_f64(vld1q_f64(&out[i]), lo));
+		vst1q_f64(&out[i + 2], vaddq_f64(vld1q_f64(&out[i + 2]), hi));
+	}
+	return N;
+}
+#endif
+}  // namespace
+
+void BeaconLikelihoodKernel::setMap(const mrpt::maps::CBeaconMap& map)
+{
+	beacons_.clear();
+	range_std_ = map.likelihoodOptions.rangeStd;
+	// Particle and sum of Gaussians densities are left to CBeaconMap
+	for (const auto& beacon : map)
+		if (beacon.m_typePDF != mrpt::maps::CBeacon::pdfGauss) return;
+
+	beacons_.reserve(map.size());
+	for (const auto& beacon : map)
+	{
+		const auto& mean = beacon.m_locationGauss.mean;
+		const auto& C = beacon.m_locationGauss.cov;
+		// CBeaconMap adds the ranges to all the beacons with an ID
+		const bool inserted = beacons_.emplace(
+			beacon.m_ID,
+			Beacon{
+				static_cast<float>(mean.x()), static_cast<float>(mean.y()),
+				static_cast<float>(mean.z()), static_cast<float>(C(0, 0)),
+				static_cast<float>(C(0, 1)), static_cast<float>(C(0, 2)),
+				static_cast<float>(C(1, 1)), static_cast<float>(C(1, 2)),
+				static_cast<float>(C(2, 2))}).second;
+		if (!inserted)
+		{
+			beacons_.clear();
+			return;
+		}
+	}
+}
+
+void BeaconLikelihoodKernel::clear() { beacons_.clear(); }
+
+void BeaconLikelihoodKernel::evaluate(
+	const ParticlesSoA& particles,
+	const mrpt::obs::CObservationBeaconRanges& obs, double* log_lik) const
+{
+	// Ranges to unknown beacons add the same to all the particles
+	double unknown = 0;
+	const double uniform =
+		obs.maxSensorDistance != obs.minSensorDistance
+		? -std::log(obs.maxSensorDistance - obs.minSensorDistance)
+		: 0.0;
+
+	for (const auto& m : obs.sensedData)
+	{
+		const auto it = beacons_.find(m.beaconID);
+		if (it == beacons_.end())
+		{
+			unknown += uniform;
+			continue;
+		}
+		// Like CBeaconMap, only positive ranges (not NaN) are scored
+		if (!(m.sensedDistance > 0)) continue;
+
+		const auto& b = it->second;
+		const float dz = static_cast<float>(m.sensorLocationOnRobot.z()) - b.z;
+		const RangeArgs r{
+			static_cast<float>(m.sensorLocationOnRobot.x()),
+			static_cast<float>(m.sensorLocationOnRobot.y()),
+			b.x,
+			b.y,
+			dz * dz,
+			m.sensedDistance,
+			range_std_ * range_std_,
+			b.cxx,
+			2 * b.cxy,
+			b.cyy,
+			2 * b.cxz * dz,
+			2 * b.cyz * dz,
+			b.czz * dz * dz};
+
+		size_t done = 0;
+#if defined(BEACON_KERNEL_HAVE_AVX2)
+		if (cpuHasAVX2()) done = evaluateAVX2(particles, r, log_lik);
+#elif defined(BEACON_KERNEL_HAVE_NEON)
+		done = evaluateNEON(particles, r, log_lik);
+#endif
+		evaluateScalar(particles, r, log_lik, done);
+	}
+
+	if (unknown != 0)
+		for (size_t i = 0; i < particles.size(); i++) log_lik[i] += unknown;
+}
@@ -0,0 +1,151 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt_localization/beam_selector.h>
+
+#include <algorithm>
+#include <cmath>
+
+using mrpt::obs::CObservation2DRangeScan;
+
+void BeamSelector::addMeasurement(double time, size_t evaluations)
+{
+	if (evaluations == 0 || time <= 0) return;
+	const double ns = 1e9 * time / evaluations;
+	// Exponential moving average, to smooth out scheduling noise
+	ns_per_evaluation_ = ns_per_evaluation_ > 0
+		? 0.8 * ns_per_evaluation_ + 0.2 * ns
+		: ns;
+}
+
+size_t BeamSelector::apply(
+	const mrpt::obs::CSensoryFrame& sf, size_t num_particles,
+	size_t decimation, mrpt::obs::CSensoryFrame& out)
+{
+	decimation = std::max<size_t>(1, decimation);
+
+	// Copy the scans, discard useless rays and count the remaining ones:
+	out.clear();
+	scans_.clear();
+	scan_candidates_.clear();
+	size_t total_candidates = 0;
+	for (const auto& obs : sf)
+	{
+		const auto* original =
+			dynamic_cast<const CObservation2DRangeScan*>(obs.get());
+		if (!original)
+		{
+			out.insert(obs);
+			continue;
+		}
+		if (copies_.size() <= scans_.size())
+			copies_.push_back(CObservation2DRangeScan::Create());
+		auto& copy = copies_[scans_.size()];
+		if (copy.use_count() > 1) copy = CObservation2DRangeScan::Create();
+		*copy = *original;
+		out.insert(copy);
+		CObservation2DRangeScan* scan = copy.get();
+
+		size_t n = 0;
+		for (size_t i = 0; i < scan->getScanSize(); i++)
+		{
+			if (!scan->getScanRangeValidity(i)) continue;
+			if (scan->getScanRange(i) >= scan->maxRange)
+				scan->setScanRangeValidity(i, false);
+			else
+				n++;
+		}
+		scans_.push_back(scan);
+		scan_candidates_.push_back(n);
+		total_candidates += n;
+	}
+
+	if (time_budget <= 0 || ns_per_evaluation_ <= 0 || num_particles == 0)
+		return total_candidates / decimation;
+
+	const double max_evaluations = 1e9 * time_budget / ns_per_evaluation_;
+	const size_t max_rays = decimation *
+		std::max(
+			min_rays,
+			static_cast<size_t>(max_evaluations / num_particles));
+	if (total_candidates <= max_rays) return total_candidates / decimation;
+
+	// Split the rays among the scans and pick them with stratified sampling
+	std::uniform_real_distribution<double> jitter(0.0, 1.0);
+	size_t selected = 0;
+	for (size_t s = 0; s < scans_.size(); s++)
+	{
+		CObservation2DRangeScan& scan = *scans_[s];
+		const size_t K = scan_candidates_[s];
+		const size_t quota = std::min(
+			K,
+			static_cast<size_t>(
+				std::round(double(max_rays) * K / total_candidates)));
+		if (K == 0 || quota >= K)
+		{
+			selected += K;
+			continue;
+		}
+
+		candidates_.clear();
+		for (size_t i = 0; i < scan.getScanSize(); i++)
+			if (scan.getScanRangeValidity(i)) candidates_.push_back(i);
+
+		// Scans with too few rays for their share of the budget are left out
+		if (quota == 0)
+		{
+			for (size_t i : candidates_) scan.setScanRangeValidity(i, false);
+			continue;
+		}
+
+		// One ray per stratum of (K / quota) consecutive candidates
+		const double stratum = double(K) / quota;
+		size_t next = 0, kept = 0;
+		for (size_t q = 0; q < quota; q++)
+		{
+			const size_t pick = std::max(
+				next,
+				std::min(
+					K - 1, static_cast<size_t>((q + jitter(rng_)) * stratum)));
+			if (pick >= K) break;
+			for (; next < pick; next++)
+				scan.setScanRangeValidity(candidates_[next], false);
+			next = pick + 1;
+			kept++;
+		}
+		for (; next < K; next++)
+			scan.setScanRangeValidity(candidates_[next], false);
+		selected += kept;
+	}
+	return selected / decimation;
+}
@@ -0,0 +1,172 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/maps/COccupancyGridMap2D.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt_localization/free_cell_index.h>
+
+#include <algorithm>
+#include <cmath>
+
+void FreeCellIndex::build(
+	const mrpt::maps::COccupancyGridMap2D& grid, float min_free_prob)
+{
+	size_x_ = grid.getSizeX();
+	size_y_ = grid.getSizeY();
+	x_min_ = grid.getXMin();
+	y_min_ = grid.getYMin();
+	resolution_ = grid.getResolution();
+	buckets_x_ = (size_x_ + BUCKET_SIZE - 1) / BUCKET_SIZE;
+	buckets_y_ = (size_y_ + BUCKET_SIZE - 1) / BUCKET_SIZE;
+
+	cells_.clear();
+	bucket_start_.assign(1, 0);
+	for (int by = 0; by < buckets_y_; by++)
+		for (int bx = 0; bx < buckets_x_; bx++)
+		{
+			const int y1 = std::min(size_y_, (by + 1) * BUCKET_SIZE);
+			const int x1 = std::min(size_x_, (bx + 1) * BUCKET_SIZE);
+			for (int y = by * BUCKET_SIZE; y < y1; y++)
+				for (int x = bx * BUCKET_SIZE; x < x1; x++)
+					if (grid.getCell(x, y) >= min_free_prob)
+						cells_.push_back(
+							static_cast<uint32_t>(y) * size_x_ + x);
+			bucket_start_.push_back(cells_.size());
+		}
+	cells_.shrink_to_fit();
+}
+
+void FreeCellIndex::clear()
+{
+	*this = FreeCellIndex();
+}
+
+void FreeCellIndex::freeMask(std::vector<uint8_t>& mask) const
+{
+	mask.assign(static_cast<size_t>(size_x_) * size_y_, 0);
+	for (const uint32_t cell : cells_) mask[cell] = 1;
+}
+
+bool FreeCellIndex::sample(
+	size_t count, float x_min, float x_max, float y_min, float y_max,
+	mrpt::random::CRandomGenerator& rng,
+	std::vector<mrpt::math::TPoint2D>& points) const
+{
+	points.clear();
+	if (cells_.empty()) return false;
+
+	// Cells whose centers are in the box (clamped before the conversion, as
+	// the box may be unbounded)
+	const auto first = [this](float v, float v_min, int size) {
+		return static_cast<int>(std::clamp(
+			std::ceil((v - v_min) / resolution_ - 0.5f), 0.f, float(size)));
+	};
+	const auto last = [this](float v, float v_min, int size) {
+		return static_cast<int>(std::clamp(
+			std::floor((v - v_min) / resolution_ - 0.5f), -1.f,
+			float(size - 1)));
+	};
+	const int cx0 = first(x_min, x_min_, size_x_);
+	const int cx1 = last(x_max, x_min_, size_x_);
+	const int cy0 = first(y_min, y_min_, size_y_);
+	const int cy1 = last(y_max, y_min_, size_y_);
+	if (cx0 > cx1 || cy0 > cy1) return false;
+
+	// Buckets fully in the box are used as they are; the free cells of the
+	// others are filtered one by one
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;	// in cells_
+	std::vector<uint32_t> edge_cells;
+	for (int by = cy0 / BUCKET_SIZE; by <= cy1 / BUCKET_SIZE; by++)
+		for (int bx = cx0 / BUCKET_SIZE; bx <= cx1 / BUCKET_SIZE; bx++)
+		{
+			const size_t b = static_cast<size_t>(by) * buckets_x_ + bx;
+			const uint32_t begin = bucket_start_[b], end = bucket_start_[b + 1];
+			const bool inside = bx * BUCKET_SIZE >= cx0 &&
+				by * BUCKET_SIZE >= cy0 &&
+				std::min(size_x_, (bx + 1) * BUCKET_SIZE) - 1 <= cx1 &&
+				std::min(size_y_, (by + 1) * BUCKET_SIZE) - 1 <= cy1;
+			if (inside)
+			{
+				if (end > begin) ranges.emplace_back(begin, end);
+				continue;
+			}
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const int x = cells_[i] % size_x_, y = cells_[i] / size_x_;
+				if (x >= cx0 && x <= cx1 && y >= cy0 && y <= cy1)
+					edge_cells.push_back(cells_[i]);
+			}
+		}
+
+	std::vector<size_t> cumulative;
+	size_t total = 0;
+	for (const auto& r : ranges)
+		cumulative.push_back(total += r.second - r.first);
+	total += edge_cells.size();
+	if (total == 0) return false;
+
+	points.resize(count);
+	for (auto& p : points)
+	{
+		const size_t k = drawIndex(rng, static_cast<uint32_t>(total));
+		const auto it =
+			std::upper_bound(cumulative.begin(), cumulative.end(), k);
+		uint32_t cell;
+		if (it == cumulative.end())
+			cell = edge_cells[k - (cumulative.empty() ? 0 : cumulative.back())];
+		else
+		{
+			const size_t r = it - cumulative.begin();
+			const size_t offset = r == 0 ? k : k - cumulative[r - 1];
+			cell = cells_[ranges[r].first + offset];
+		}
+		p.x = x_min_ +
+			(cell % size_x_ + rng.drawUniform(0.0, 1.0)) * resolution_;
+		p.y = y_min_ +
+			(cell / size_x_ + rng.drawUniform(0.0, 1.0)) * resolution_;
+	}
+	return true;
+}
+
+uint32_t FreeCellIndex::drawIndex(
+	mrpt::random::CRandomGenerator& rng, uint32_t n)
+{
+	// Draws below 2^32 mod n are rejected, so that the accepted ones span a
+	// multiple of n values
+	const uint32_t threshold = (0u - n) % n;
+	for (;;)
+	{
+		const uint32_t r = rng.drawUniform32bit();
+		if (r >= threshold) return r % n;
+	}
+}
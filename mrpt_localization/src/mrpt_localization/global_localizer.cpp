@@ -0,0 +1,298 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt_localization/global_localizer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+using mrpt::math::TPose2D;
+
+GlobalLocalizer::Pyramid::Pyramid(
+	LikelihoodField::ConstPtr field, const std::vector<uint8_t>* free_cells)
+	: field_(std::move(field))
+{
+	const int size_x = field_->sizeX(), size_y = field_->sizeY();
+	const float oom = field_->outOfMapValue();
+	if (free_cells)
+	{
+		free_.assign((free_cells->size() + 63) / 64, 0);
+		for (size_t i = 0; i < free_cells->size(); i++)
+			if ((*free_cells)[i]) free_[i >> 6] |= uint64_t(1) << (i & 63);
+	}
+
+	// Maximum and free flag of the disjoint blocks of the previous level,
+	// starting with the cells; blocks past the map are out of it
+	int prev_x = size_x, prev_y = size_y;
+	std::vector<float> prev_max, block_max;
+	std::vector<uint8_t> prev_free, block_free;
+	const auto prevMax = [&](int x, int y) {
+		if (x >= prev_x || y >= prev_y) return oom;
+		return prev_max.empty() ? field_->cell(x, y)
+								: prev_max[static_cast<size_t>(y) * prev_x + x];
+	};
+	const auto prevFree = [&](int x, int y) -> bool {
+		if (!free_cells || x >= prev_x || y >= prev_y) return false;
+		if (prev_free.empty())
+			return (*free_cells)[static_cast<size_t>(y) * size_x + x];
+		return prev_free[static_cast<size_t>(y) * prev_x + x];
+	};
+
+	for (int level = 1; (1 << (level - 1)) < std::max(size_x, size_y);
+		 level++)
+	{
+		const int bw = (prev_x + 1) / 2, bh = (prev_y + 1) / 2;
+		block_max.resize(static_cast<size_t>(bw) * bh);
+		if (free_cells) block_free.resize(block_max.size());
+		for (int by = 0; by < bh; by++)
+			for (int bx = 0; bx < bw; bx++)
+			{
+				const size_t i = static_cast<size_t>(by) * bw + bx;
+				block_max[i] = std::max(
+					std::max(
+						prevMax(2 * bx, 2 * by), prevMax(2 * bx + 1, 2 * by)),
+					std::max(
+						prevMax(2 * bx, 2 * by + 1),
+						prevMax(2 * bx + 1, 2 * by + 1)));
+				if (free_cells)
+					block_free[i] = prevFree(2 * bx, 2 * by) ||
+						prevFree(2 * bx + 1, 2 * by) ||
+						prevFree(2 * bx, 2 * by + 1) ||
+						prevFree(2 * bx + 1, 2 * by + 1);
+			}
+
+		// Pairs of blocks in both axes, from block -1
+		Level l;
+		l.width = bw + 1;
+		l.max.resize(static_cast<size_t>(bw + 1) * (bh + 1));
+		const auto blockMax = [&](int bx, int by) {
+			if (bx < 0 || by < 0 || bx >= bw || by >= bh) return oom;
+			return block_max[static_cast<size_t>(by) * bw + bx];
+		};
+		for (int by = -1; by < bh; by++)
+			for (int bx = -1; bx < bw; bx++)
+				l.max[static_cast<size_t>(by + 1) * l.width + bx + 1] =
+					std::max(
+						std::max(blockMax(bx, by), blockMax(bx + 1, by)),
+						std::max(
+							blockMax(bx, by + 1), blockMax(bx + 1, by + 1)));
+		l.free = block_free;
+		levels_.push_back(std::move(l));
+
+		prev_x = bw, prev_y = bh;
+		prev_max.swap(block_max);
+		prev_free.swap(block_free);
+	}
+}
+
+namespace
+{
+/** Set of translation windows of one heading, 2^level cells wide */
+struct Candidate
+{
+	int heading;
+	int cx, cy;
+	int level;
+	double bound;
+
+	bool operator<(const Candidate& o) const { return bound < o.bound; }
+};
+
+/** Search state of one scan */
+class Search
+{
+   public:
+	Search(
+		const GlobalLocalizer::Pyramid& pyramid,
+		const GlobalLocalizer::Params& params)
+		: pyramid_(pyramid), field_(pyramid.field()), params_(params)
+	{
+	}
+
+	std::vector<GlobalLocalizer::Hypothesis> run(
+		const std::vector<float>& xs, const std::vector<float>& ys);
+
+   private:
+	void computeOffsets(
+		const std::vector<float>& xs, const std::vector<float>& ys);
+	double bound(int heading, int cx, int cy, int level) const;
+	void addLeaf(int heading, int cx, int cy, double score);
+	double threshold() const
+	{
+		return results_.size() < params_.num_hypotheses
+			? -std::numeric_limits<double>::infinity()
+			: results_.back().score;
+	}
+
+	const GlobalLocalizer::Pyramid& pyramid_;
+	const LikelihoodField& field_;
+	const GlobalLocalizer::Params& params_;
+	int num_headings_ = 0;
+	size_t num_points_ = 0;
+	/** Cell offsets of the points, num_points_ per heading */
+	std::vector<int> offset_x_, offset_y_;
+	std::vector<GlobalLocalizer::Hypothesis> results_;
+};
+
+std::vector<GlobalLocalizer::Hypothesis> Search::run(
+	const std::vector<float>& xs, const std::vector<float>& ys)
+{
+	const int size_x = field_.sizeX(), size_y = field_.sizeY();
+	if (size_x <= 0 || size_y <= 0 || xs.empty() ||
+		params_.num_hypotheses == 0)
+		return {};
+
+	computeOffsets(xs, ys);
+
+	// Best first, creating the candidates as they are needed: the best
+	// window left is split down to a cell along its best children, so that
+	// hypotheses (and a pruning threshold) are found early, and the other
+	// children are queued
+	const int top = pyramid_.numLevels() - 1;
+	std::priority_queue<Candidate> queue;
+	for (int h = 0; h < num_headings_; h++)
+		queue.push({h, 0, 0, top, bound(h, 0, 0, top)});
+
+	while (!queue.empty() && queue.top().bound > threshold())
+	{
+		Candidate c = queue.top();
+		queue.pop();
+		while (c.level > 0 && c.bound > threshold())
+		{
+			const int level = c.level - 1;
+			const int half = 1 << level;
+			Candidate best{c.heading, 0, 0, level, -HUGE_VAL};
+			for (int dy = 0; dy < 2; dy++)
+				for (int dx = 0; dx < 2; dx++)
+				{
+					const int cx = c.cx + dx * half, cy = c.cy + dy * half;
+					if (cx >= size_x || cy >= size_y ||
+						!pyramid_.hasFreeCell(level, cx, cy))
+						continue;
+					Candidate child{
+						c.heading, cx, cy, level,
+						bound(c.heading, cx, cy, level)};
+					if (child.bound <= threshold()) continue;
+					if (best.bound < child.bound) std::swap(best, child);
+					if (child.bound > threshold()) queue.push(child);
+				}
+			c = best;
+		}
+		if (c.level == 0 && c.bound > threshold())
+			addLeaf(c.heading, c.cx, c.cy, c.bound);
+	}
+
+	for (auto& r : results_) r.score /= num_points_;
+	return results_;
+}
+
+void Search::computeOffsets(
+	const std::vector<float>& xs, const std::vector<float>& ys)
+{
+	const size_t n = std::min(xs.size(), ys.size());
+	const size_t max_points = std::max<size_t>(1, params_.max_points);
+	const size_t stride = (n + max_points - 1) / max_points;
+
+	const double res = field_.resolution();
+	num_headings_ = std::max(
+		1, static_cast<int>(std::ceil(
+			   2 * M_PI / std::max(1e-3, params_.angular_resolution))));
+	num_points_ = (n + stride - 1) / stride;
+	offset_x_.resize(num_headings_ * num_points_);
+	offset_y_.resize(num_headings_ * num_points_);
+
+	for (int h = 0; h < num_headings_; h++)
+	{
+		const double phi = 2 * M_PI * h / num_headings_;
+		const double c = std::cos(phi), s = std::sin(phi);
+		for (size_t i = 0, k = h * num_points_; i < n; i += stride, k++)
+		{
+			// Relative to the center of the cell of the robot
+			offset_x_[k] = static_cast<int>(
+				std::floor(0.5 + (c * xs[i] - s * ys[i]) / res));
+			offset_y_[k] = static_cast<int>(
+				std::floor(0.5 + (s * xs[i] + c * ys[i]) / res));
+		}
+	}
+}
+
+double Search::bound(int heading, int cx, int cy, int level) const
+{
+	const int* ox = offset_x_.data() + heading * num_points_;
+	const int* oy = offset_y_.data() + heading * num_points_;
+
+	double sum = 0;
+	for (size_t i = 0; i < num_points_; i++)
+		sum += pyramid_.bound(level, cx + ox[i], cy + oy[i]);
+	return sum;
+}
+
+void Search::addLeaf(int heading, int cx, int cy, double score)
+{
+	const double res = field_.resolution();
+	const TPose2D pose(
+		field_.xMin() + (cx + 0.5) * res, field_.yMin() + (cy + 0.5) * res,
+		mrpt::math::wrapToPi(2 * M_PI * heading / num_headings_));
+
+	// Keep only the best of close hypotheses
+	for (auto it = results_.begin(); it != results_.end(); ++it)
+	{
+		if (std::hypot(it->pose.x - pose.x, it->pose.y - pose.y) >=
+				params_.min_hypotheses_distance ||
+			std::abs(mrpt::math::wrapToPi(it->pose.phi - pose.phi)) >=
+				params_.min_hypotheses_angle)
+			continue;
+		if (it->score >= score) return;
+		results_.erase(it);
+		break;
+	}
+
+	const auto pos = std::find_if(
+		results_.begin(), results_.end(),
+		[score](const GlobalLocalizer::Hypothesis& r) {
+			return r.score < score;
+		});
+	results_.insert(pos, {pose, score});
+	if (results_.size() > params_.num_hypotheses) results_.pop_back();
+}
+}  // namespace
+
+std::vector<GlobalLocalizer::Hypothesis> GlobalLocalizer::localize(
+	const Pyramid& pyramid, const std::vector<float>& xs,
+	const std::vector<float>& ys) const
+{
+	return Search(pyramid, params).run(xs, ys);
+}
@@ -0,0 +1,496 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/core/format.h>
+#include <mrpt/maps/COccupancyGridMap2D.h>
+#include <mrpt/system/CDirectoryExplorer.h>
+#include <mrpt/system/filesystem.h>
+#include <mrpt_localization/likelihood_field.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+using mrpt::maps::COccupancyGridMap2D;
+
+namespace
+{
+/** Layout of the beginning of a cache file, the cells start at
+ * CACHE_DATA_OFFSET */
+struct CacheFileHeader
+{
+	char magic[8];
+	uint64_t key;
+	int32_t size_x;
+	int32_t size_y;
+	float out_of_map;
+	float scale;
+	int32_t cell_bytes;  ///< 1 if quantized, 4 otherwise
+	uint8_t reserved[28];
+};
+static_assert(sizeof(CacheFileHeader) == 64, "Unexpected header padding");
+
+const char CACHE_FILE_MAGIC[8] = {'M', 'R', 'P', 'T', 'L', 'F', '0', '4'};
+
+/** Tiles are page aligned in the file, hence in its mapping */
+const size_t CACHE_DATA_OFFSET = 4096;
+
+/** prefetch() calls after which unused tiles are paged out */
+const uint32_t TILE_RELEASE_AGE = 50;
+
+/** FNV-1a over 64-bit words, with an extra shift to mix high bits down */
+uint64_t hashBytes(uint64_t h, const void* data, size_t n)
+{
+	const uint64_t prime = 0x100000001b3ULL;
+	const auto* p = static_cast<const uint8_t*>(data);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint64_t w;
+		std::memcpy(&w, p + i, sizeof(w));
+		h = (h ^ w) * prime;
+		h ^= h >> 32;
+	}
+	for (; i < n; i++) h = (h ^ p[i]) * prime;
+	return h;
+}
+
+template <typename T>
+uint64_t hashValue(uint64_t h, const T& v)
+{
+	return hashBytes(h, &v, sizeof(v));
+}
+
+/**
+ * 1D squared Euclidean distance transform (Felzenszwalb & Huttenlocher),
+ * computed in place over n elements of f separated by stride.
+ **/
+void distanceTransform1D(
+	float* f, int n, size_t stride, std::vector<double>& fq,
+	std::vector<int>& v, std::vector<double>& z)
+{
+	for (int q = 0; q < n; q++) fq[q] = f[q * stride];
+
+	int k = 0;
+	v[0] = 0;
+	z[0] = -std::numeric_limits<double>::infinity();
+	z[1] = std::numeric_limits<double>::infinity();
+	for (int q = 1; q < n; q++)
+	{
+		auto intersection = [&](int p) {
+			return ((fq[q] + double(q) * q) - (fq[p] + double(p) * p)) /
+				(2.0 * (q - p));
+		};
+		double s = intersection(v[k]);
+		// z[0] is -inf, so k never goes below zero:
+		while (s <= z[k]) s = intersection(v[--k]);
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = std::numeric_limits<double>::infinity();
+	}
+
+	k = 0;
+	for (int q = 0; q < n; q++)
+	{
+		while (z[k + 1] < q) k++;
+		const int p = v[k];
+		f[q * stride] = static_cast<float>(double(q - p) * (q - p) + fq[p]);
+	}
+}
+}  // namespace
+
+bool LikelihoodField::isApplicable(const COccupancyGridMap2D& grid)
+{
+	return grid.likelihoodOptions.likelihoodMethod ==
+			   COccupancyGridMap2D::lmLikelihoodField_Thrun &&
+		!grid.likelihoodOptions.LF_alternateAverageMethod;
+}
+
+LikelihoodField::Ptr LikelihoodField::Create(
+	const COccupancyGridMap2D& grid, const std::string& cache_dir,
+	bool quantized)
+{
+	const int size_x = static_cast<int>(grid.getSizeX());
+	const int size_y = static_cast<int>(grid.getSizeY());
+
+	// Same threshold than COccupancyGridMap2D::computeLikelihoodField_Thrun()
+	const COccupancyGridMap2D::cellType threshold =
+		COccupancyGridMap2D::p2l(0.5f);
+
+	std::vector<uint8_t> occupied(static_cast<size_t>(size_x) * size_y);
+	for (int cy = 0; cy < size_y; cy++)
+	{
+		const COccupancyGridMap2D::cellType* row = grid.getRow(cy);
+		uint8_t* out = &occupied[static_cast<size_t>(cy) * size_x];
+		for (int cx = 0; cx < size_x; cx++) out[cx] = row[cx] < threshold;
+	}
+
+	const auto& lo = grid.likelihoodOptions;
+	Params params;
+	params.std_hit = lo.LF_stdHit;
+	params.z_hit = lo.LF_zHit;
+	params.z_random = lo.LF_zRandom;
+	params.max_range = lo.LF_maxRange;
+	params.max_corrs_distance = lo.LF_maxCorrsDistance;
+	params.decimation = lo.LF_decimation;
+	params.horizontal_tolerance = grid.insertionOptions.horizontalTolerance;
+
+	Ptr lf(new LikelihoodField());
+	lf->setGeometry(
+		occupied, size_x, size_y, grid.getXMin(), grid.getYMin(),
+		grid.getResolution(), params, quantized);
+	const std::string file = cache_dir + "/" + lf->cacheFileName();
+	if (!cache_dir.empty() && lf->mapFile(file))
+	{
+		// The modification time orders the files for evictCache()
+		::utime(file.c_str(), nullptr);
+		return lf;
+	}
+
+	lf->compute(occupied);
+	return lf;
+}
+
+LikelihoodField::Ptr LikelihoodField::Create(
+	const std::vector<uint8_t>& occupied, int size_x, int size_y, float x_min,
+	float y_min, float resolution, const Params& params, bool quantized)
+{
+	Ptr lf(new LikelihoodField());
+	lf->setGeometry(
+		occupied, size_x, size_y, x_min, y_min, resolution, params,
+		quantized);
+	lf->compute(occupied);
+	return lf;
+}
+
+std::string LikelihoodField::cacheFileName() const
+{
+	return mrpt::format("likelihood_field_%016" PRIx64 ".bin", key_);
+}
+
+bool LikelihoodField::saveToFile(const std::string& file) const
+{
+	const std::string tmp_file = file + ".tmp" + std::to_string(::getpid());
+	{
+		std::ofstream f(tmp_file, std::ios::binary);
+		if (!f) return false;
+
+		CacheFileHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+		header.key = key_;
+		header.size_x = size_x_;
+		header.size_y = size_y_;
+		header.out_of_map = out_of_map_;
+		header.scale = scale_;
+		header.cell_bytes = static_cast<int32_t>(cellBytes());
+
+		const std::vector<char> padding(
+			CACHE_DATA_OFFSET - sizeof(header), 0);
+		f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		f.write(padding.data(), padding.size());
+		f.write(table(), cellBytes() * numTableCells());
+		if (!f)
+		{
+			f.close();
+			std::remove(tmp_file.c_str());
+			return false;
+		}
+	}
+	if (std::rename(tmp_file.c_str(), file.c_str()) != 0)
+	{
+		std::remove(tmp_file.c_str());
+		return false;
+	}
+	return true;
+}
+
+void LikelihoodField::evictCache(const std::string& cache_dir, size_t max_files)
+{
+	mrpt::system::CDirectoryExplorer::TFileInfoList files;
+	mrpt::system::CDirectoryExplorer::explore(
+		cache_dir, FILE_ATTRIB_ARCHIVE, files);
+	files.erase(
+		std::remove_if(
+			files.begin(), files.end(),
+			[](const mrpt::system::CDirectoryExplorer::TFileInfo& f) {
+				return f.name.compare(0, 17, "likelihood_field_") != 0 ||
+					mrpt::system::extractFileExtension(f.name) != "bin";
+			}),
+		files.end());
+	if (files.size() <= max_files) return;
+
+	std::sort(
+		files.begin(), files.end(),
+		[](const auto& a, const auto& b) { return a.modTime > b.modTime; });
+	// Processes that mapped a deleted file keep it until they unmap it
+	for (size_t i = max_files; i < files.size(); i++)
+		std::remove(files[i].wholePath.c_str());
+}
+
+bool LikelihoodField::mapFile(const std::string& file)
+{
+	namespace bip = boost::interprocess;
+
+	if (!mrpt::system::fileExists(file)) return false;
+
+	std::shared_ptr<bip::mapped_region> region;
+	try
+	{
+		const bip::file_mapping fm(file.c_str(), bip::read_only);
+		region = std::make_shared<bip::mapped_region>(fm, bip::read_only);
+	}
+	catch (const bip::interprocess_exception&)
+	{
+		return false;
+	}
+
+	if (region->get_size() !=
+		CACHE_DATA_OFFSET + numTableCells() * cellBytes())
+		return false;
+
+	const auto* addr = static_cast<const char*>(region->get_address());
+	CacheFileHeader header;
+	std::memcpy(&header, addr, sizeof(header));
+	if (std::memcmp(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic)) ||
+		header.key != key_ || header.size_x != size_x_ ||
+		header.size_y != size_y_ ||
+		header.cell_bytes != static_cast<int32_t>(cellBytes()))
+		return false;
+
+	out_of_map_ = header.out_of_map;
+	scale_ = header.scale;
+	cells_ = nullptr;
+	qcells_ = nullptr;
+	if (quantized_)
+		qcells_ = reinterpret_cast<const uint8_t*>(addr + CACHE_DATA_OFFSET);
+	else
+		cells_ = reinterpret_cast<const float*>(addr + CACHE_DATA_OFFSET);
+	own_cells_.clear();
+	own_qcells_.clear();
+	mapping_ = region;
+	tile_last_use_.assign(static_cast<size_t>(tiles_x_) * tiles_y_, 0);
+	prefetch_count_ = 0;
+	return true;
+}
+
+void LikelihoodField::advise(size_t first, size_t count, int advice) const
+{
+	// madvise() needs page aligned addresses; with pages larger than tiles
+	// the neighbors are affected as well, which is harmless for read-only
+	// mappings
+	static const uintptr_t page = ::sysconf(_SC_PAGESIZE);
+	const size_t tile_bytes = TILE_CELLS * cellBytes();
+	const auto begin =
+		reinterpret_cast<uintptr_t>(table() + first * tile_bytes);
+	const auto end = begin + count * tile_bytes;
+	const uintptr_t aligned = begin & ~(page - 1);
+	::madvise(reinterpret_cast<void*>(aligned), end - aligned, advice);
+}
+
+void LikelihoodField::prefetch(const std::vector<Box>& boxes) const
+{
+	if (!mapping_) return;
+	const auto tile = [this](float v, float v_min, int tiles) {
+		const float t = std::floor((v - v_min) / (resolution_ * TILE_SIZE));
+		return static_cast<int>(
+			std::clamp(t, 0.0f, static_cast<float>(tiles - 1)));
+	};
+
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+	const uint32_t now = ++prefetch_count_;
+	for (const Box& box : boxes)
+	{
+		const int tx0 = tile(box.x_min, x_min_, tiles_x_);
+		const int tx1 = tile(box.x_max, x_min_, tiles_x_);
+		const int ty0 = tile(box.y_min, y_min_, tiles_y_);
+		const int ty1 = tile(box.y_max, y_min_, tiles_y_);
+		for (int ty = ty0; ty <= ty1; ty++)
+		{
+			const size_t row = static_cast<size_t>(ty) * tiles_x_;
+			// Consecutive tiles that were not resident are advised at once
+			int first_new = -1;
+			for (int tx = tx0; tx <= tx1 + 1; tx++)
+			{
+				const bool is_new =
+					tx <= tx1 && tile_last_use_[row + tx] == 0;
+				if (is_new && first_new < 0) first_new = tx;
+				if (!is_new && first_new >= 0)
+				{
+					advise(row + first_new, tx - first_new, MADV_WILLNEED);
+					first_new = -1;
+				}
+				if (tx <= tx1) tile_last_use_[row + tx] = now;
+			}
+		}
+	}
+
+	if (now % TILE_RELEASE_AGE) return;
+	for (size_t t = 0; t < tile_last_use_.size(); t++)
+	{
+		if (!tile_last_use_[t] || now - tile_last_use_[t] < TILE_RELEASE_AGE)
+			continue;
+		advise(t, 1, MADV_DONTNEED);
+		tile_last_use_[t] = 0;
+	}
+}
+
+void LikelihoodField::release() const
+{
+	if (!mapping_) return;
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+	advise(0, tile_last_use_.size(), MADV_DONTNEED);
+	std::fill(tile_last_use_.begin(), tile_last_use_.end(), 0);
+}
+
+void LikelihoodField::setGeometry(
+	const std::vector<uint8_t>& occupied, int size_x, int size_y, float x_min,
+	float y_min, float resolution, const Params& params, bool quantized)
+{
+	size_x_ = size_x;
+	size_y_ = size_y;
+	tiles_x_ = (size_x + TILE_SIZE - 1) >> TILE_SHIFT;
+	tiles_y_ = (size_y + TILE_SIZE - 1) >> TILE_SHIFT;
+	x_min_ = x_min;
+	y_min_ = y_min;
+	resolution_ = resolution;
+	params_ = params;
+	quantized_ = quantized;
+
+	// Everything the cell values depend on:
+	uint64_t h = 0xcbf29ce484222325ULL;
+	h = hashBytes(h, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+	h = hashValue(h, size_x_);
+	h = hashValue(h, size_y_);
+	h = hashValue(h, x_min_);
+	h = hashValue(h, y_min_);
+	h = hashValue(h, resolution_);
+	h = hashValue(h, params_.std_hit);
+	h = hashValue(h, params_.z_hit);
+	h = hashValue(h, params_.z_random);
+	h = hashValue(h, params_.max_range);
+	h = hashValue(h, params_.max_corrs_distance);
+	h = hashValue(h, quantized_);
+	key_ = hashBytes(h, occupied.data(), occupied.size());
+}
+
+void LikelihoodField::compute(const std::vector<uint8_t>& occupied)
+{
+	const size_t N = static_cast<size_t>(size_x_) * size_y_;
+
+	// Distances are truncated at max_corrs_distance, hence any cell farther
+	// than K cells from an obstacle gets the same value. Using a finite
+	// "infinity" keeps the transform exact up to K.
+	const int K =
+		static_cast<int>(std::ceil(params_.max_corrs_distance / resolution_));
+	const float far_sq = static_cast<float>((K + 1) * (K + 1));
+
+	// Look-up table: squared distance (in cells) -> log-likelihood
+	const double z_random_term = params_.z_random / params_.max_range;
+	const double Q = -1.0 / (2.0 * params_.std_hit * params_.std_hit);
+	const double max_corrs_sq =
+		double(params_.max_corrs_distance) * params_.max_corrs_distance;
+	std::vector<float> lut(static_cast<size_t>(far_sq) + 1);
+	for (size_t i = 0; i < lut.size(); i++)
+	{
+		const double d_sq =
+			std::min(double(i) * resolution_ * resolution_, max_corrs_sq);
+		lut[i] = static_cast<float>(
+			std::log(z_random_term + params_.z_hit * std::exp(Q * d_sq)));
+	}
+	out_of_map_ = lut.back();
+
+	std::vector<float> cells(N);
+	for (size_t i = 0; i < N; i++) cells[i] = occupied[i] ? 0.0f : far_sq;
+
+	const int n_max = std::max(size_x_, size_y_);
+	std::vector<double> fq(n_max);
+	std::vector<int> v(n_max);
+	std::vector<double> z(n_max + 1);
+
+	// Columns, then rows:
+	for (int cx = 0; cx < size_x_; cx++)
+		distanceTransform1D(&cells[cx], size_y_, size_x_, fq, v, z);
+	for (int cy = 0; cy < size_y_; cy++)
+		distanceTransform1D(
+			&cells[static_cast<size_t>(cy) * size_x_], size_x_, 1, fq, v, z);
+
+	// Quantization: linear from out_of_map_ (the lowest value, q = 0) to
+	// lut[0] (the highest one, q = 255)
+	const float range = lut.front() - out_of_map_;
+	scale_ = range > 0 ? range / 255 : 1.0f;
+	std::vector<uint8_t> qlut(lut.size());
+	for (size_t i = 0; i < lut.size(); i++)
+		qlut[i] = static_cast<uint8_t>(std::clamp(
+			std::lround((lut[i] - out_of_map_) / scale_), 0L, 255L));
+
+	// Padding cells of the tiles at the borders are never read
+	own_cells_.clear();
+	own_qcells_.clear();
+	cells_ = nullptr;
+	qcells_ = nullptr;
+	if (quantized_)
+		own_qcells_.assign(numTableCells(), 0);
+	else
+		own_cells_.assign(numTableCells(), out_of_map_);
+	for (int cy = 0; cy < size_y_; cy++)
+		for (int cx = 0; cx < size_x_; cx++)
+		{
+			// COccupancyGridMap2D takes the last row and column as out of
+			// the map
+			const bool border = cx == size_x_ - 1 || cy == size_y_ - 1;
+			const float d = border
+				? far_sq
+				: cells[static_cast<size_t>(cy) * size_x_ + cx];
+			const size_t d_sq = static_cast<size_t>(std::min(d, far_sq) + 0.5f);
+			if (quantized_)
+				own_qcells_[cellIndex(cx, cy)] = qlut[d_sq];
+			else
+				own_cells_[cellIndex(cx, cy)] = lut[d_sq];
+		}
+	if (quantized_)
+		qcells_ = own_qcells_.data();
+	else
+		cells_ = own_cells_.data();
+	mapping_.reset();
+	tile_last_use_.clear();
+}
@@ -36,12 +36,13 @@
 #include <mrpt/opengl/CEllipsoid2D.h>
 #include <mrpt/opengl/COpenGLScene.h>
 #include <mrpt/opengl/CPointCloud.h>
-#include <mrpt/ros1bridge/map.h>
 #include <mrpt/system/filesystem.h>
 #include <mrpt_localization/mrpt_localization.h>
 #include <mrpt_localization/mrpt_localization_defaults.h>
+#include <mrpt_map/map_cache.h>
 #include <ros/console.h>
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
@@ -62,7 +63,11 @@ using namespace mrpt::config;
 using mrpt::maps::COccupancyGridMap2D;
 using mrpt::maps::CSimplePointsMap;
 
-PFLocalization::~PFLocalization() {}
+PFLocalization::~PFLocalization()
+{
+	stop_render_ = true;
+	if (render_thread_.joinable()) render_thread_.join();
+}
 PFLocalization::PFLocalization(Parameters* param)
 	: PFLocalizationCore(), param_(param)
 {
@@ -96,6 +101,18 @@ void PFLocalization::init()
 	{
 		param_->map_file = ini_file.read_string(iniSectionName, "map_file", "");
 	}
+	if (param_->update_min_d < 0)
+	{
+		param_->update_min_d =
+			ini_file.read_double(iniSectionName, "update_min_d", 0);
+	}
+	if (param_->update_min_a < 0)
+	{
+		param_->update_min_a = DEG2RAD(
+			ini_file.read_double(iniSectionName, "update_min_a_deg", 0));
+	}
+	update_min_d_ = param_->update_min_d;
+	update_min_a_ = param_->update_min_a;
 
 	// Non-mandatory entries:
 	SCENE3D_FREQ_ = ini_file.read_int(iniSectionName, "3DSceneFrequency", 10);
@@ -104,8 +121,36 @@ void PFLocalization::init()
 
 	SHOW_PROGRESS_3D_REAL_TIME_ =
 		ini_file.read_bool(iniSectionName, "SHOW_PROGRESS_3D_REAL_TIME", false);
-	SHOW_PROGRESS_3D_REAL_TIME_DELAY_MS_ = ini_file.read_int(
-		iniSectionName, "SHOW_PROGRESS_3D_REAL_TIME_DELAY_MS", 1);
+	SHOW_PROGRESS_3D_FPS_ =
+		ini_file.read_int(iniSectionName, "SHOW_PROGRESS_3D_FPS", 20);
+	pdf_.use_scan_kernel = ini_file.read_bool(
+		iniSectionName, "use_scan_likelihood_kernel", true);
+	pdf_.use_beacon_kernel = ini_file.read_bool(
+		iniSectionName, "use_beacon_likelihood_kernel", true);
+	pdf_.use_particle_arena =
+		ini_file.read_bool(iniSectionName, "use_particle_arena", false);
+	likelihood_cache_dir_ =
+		ini_file.read_string(iniSectionName, "likelihood_cache_dir", "");
+	likelihood_cache_max_files_ = std::max(
+		1, ini_file.read_int(iniSectionName, "likelihood_cache_max_files", 4));
+	quantize_likelihood_field_ = ini_file.read_bool(
+		iniSectionName, "quantize_likelihood_field", false);
+	beam_selector_.time_budget =
+		1e-3 * ini_file.read_double(iniSectionName, "beam_time_budget_ms", 0);
+	update_time_target_ =
+		1e-3 * ini_file.read_double(iniSectionName, "update_time_target_ms", 0);
+	global_localizer_.params.angular_resolution = DEG2RAD(ini_file.read_double(
+		iniSectionName, "global_localization_angular_step_deg", 1.0));
+	global_localizer_.params.num_hypotheses = ini_file.read_int(
+		iniSectionName, "global_localization_hypotheses", 5);
+	random_particles_ratio_ = ini_file.read_double(
+		iniSectionName, "random_particles_ratio", 0);
+	clusterer_.max_clusters =
+		ini_file.read_int(iniSectionName, "max_pose_clusters", 5);
+	clusterer_.bin_size_xy =
+		ini_file.read_double(iniSectionName, "pose_cluster_bin_size", 0.5);
+	clusterer_.bin_size_phi = DEG2RAD(ini_file.read_double(
+		iniSectionName, "pose_cluster_bin_size_phi_deg", 10.0));
 
 #if !MRPT_HAS_WXWIDGETS
 	SHOW_PROGRESS_3D_REAL_TIME_ = false;
@@ -157,12 +202,24 @@ void PFLocalization::init()
 
 	ASSERT_(metric_map_);
 
-	if (!mrpt::ros1bridge::MapHdl::loadMap(
+	const std::string map_cache_dir =
+		ini_file.read_string(iniSectionName, "map_cache_dir", "");
+	const int map_cache_max_files =
+		ini_file.read_int(iniSectionName, "map_cache_max_files", 4);
+	if (map_owner_)
+	{
+		shareMap(*map_owner_);
+	}
+	else if (!mrpt_map::loadMap(
 			*metric_map_, ini_file, param_->map_file, "metricMap",
-			param_->debug))
+			map_cache_dir, param_->debug, std::max(1, map_cache_max_files)))
 	{
 		waitForMap();
 	}
+	else
+	{
+		onMapUpdated();
+	}
 
 	initial_particle_count_ = *particles_count.begin();
 
@@ -189,6 +246,18 @@ void PFLocalization::configureFilter(const CConfigFile& _configFile)
 	pdf_.options = pdfPredictionOptions;
 
 	pdf_.options.metricMap = metric_map_;
+	auto& kld = pdf_.options.KLD_params;
+	if (kld.KLD_minSampleSize > kld.KLD_maxSampleSize)
+	{
+		ROS_WARN(
+			"KLD_minSampleSize (%u) is larger than KLD_maxSampleSize (%u), "
+			"using it as the maximum as well",
+			kld.KLD_minSampleSize, kld.KLD_maxSampleSize);
+		kld.KLD_maxSampleSize = kld.KLD_minSampleSize;
+	}
+	kld_max_sample_size_ = kld.KLD_maxSampleSize;
+	if (pdf_.use_particle_arena) pdf_.reserveParticles(kld_max_sample_size_);
+	time_per_particle_ = 0;
 
 	// Create the PF object:
 	pf_.m_options = pfOptions;
@@ -242,6 +311,8 @@ void PFLocalization::init3DDebug()
 			win3D_->unlockAccess3DScene();
 		}
 	}  // Show 3D?
+	if (!render_thread_.joinable())
+		render_thread_ = std::thread(&PFLocalization::renderThread, this);
 	if (param_->debug)
 		ROS_INFO(" --------------------------- init3DDebug done \n");
 	if (param_->debug) fflush(stdout);
@@ -249,129 +320,163 @@ void PFLocalization::init3DDebug()
 
 void PFLocalization::show3DDebug(CSensoryFrame::Ptr _observations)
 {
-	// Create 3D window if requested:
-	if (SHOW_PROGRESS_3D_REAL_TIME_)
+	if (!SHOW_PROGRESS_3D_REAL_TIME_ || !render_thread_.joinable()) return;
+
+	// Only a copy for the render thread, the update does not wait for it
+	auto frame = std::make_shared<DebugFrame>();
+	if (_observations->size() > 0)
+		frame->stamp = _observations->getObservationByIndex(0)->timestamp;
+	frame->stats = pose_stats_;
+	const auto& particles = pdf_.m_particles;
+	frame->xs.resize(particles.size());
+	frame->ys.resize(particles.size());
+	for (size_t i = 0; i < particles.size(); i++)
 	{
-		TTimeStamp cur_obs_timestamp = INVALID_TIMESTAMP;
-		if (_observations->size() > 0)
-			cur_obs_timestamp =
-				_observations->getObservationByIndex(0)->timestamp;
-
-		const auto [cov, meanPose] = pdf_.getCovarianceAndMean();
-
-		COpenGLScene::Ptr ptr_scene = win3D_->get3DSceneAndLock();
-
-		win3D_->setCameraPointingToPoint(meanPose.x(), meanPose.y(), 0);
-
-		mrpt::opengl::TFontParams fp;
-		fp.color = TColorf(.8f, .8f, .8f);
-		fp.vfont_name = "mono";
-		fp.vfont_scale = 15;
-
-		win3D_->addTextMessage(
-			10, 10,
-			mrpt::format(
-				"timestamp: %s",
-				cur_obs_timestamp != INVALID_TIMESTAMP
-					? mrpt::system::dateTimeLocalToString(cur_obs_timestamp)
-						  .c_str()
-					: "(none)"),
-			6001, fp);
-
-		win3D_->addTextMessage(
-			10, 33,
-			mrpt::format(
-				"#particles= %7u", static_cast<unsigned int>(pdf_.size())),
-			6002, fp);
-
-		win3D_->addTextMessage(
-			10, 55,
-			mrpt::format(
-				"mean pose (x y phi_deg)= %s", meanPose.asString().c_str()),
-			6003, fp);
-
-		// The particles:
-		{
-			CRenderizable::Ptr parts = ptr_scene->getByName("particles");
-			if (parts) ptr_scene->removeObject(parts);
+		frame->xs[i] = static_cast<float>(particles[i].d.x);
+		frame->ys[i] = static_cast<float>(particles[i].d.y);
+	}
+	// The node may still modify the observations, e.g. the beam selection
+	for (const auto& obs : *_observations)
+		frame->observations.insert(
+			std::dynamic_pointer_cast<CObservation>(
+				obs->duplicateGetSmartPtr()));
 
-			CSetOfObjects::Ptr p = pdf_.getAs3DObject<CSetOfObjects::Ptr>();
-			p->setName("particles");
-			ptr_scene->insert(p);
-		}
+	std::shared_ptr<const DebugFrame> published(std::move(frame));
+	{
+		std::lock_guard<std::mutex> lock(debug_frame_mutex_);
+		debug_frame_.swap(published);
+	}
+	// The previous frame, if the render thread is done with it, is freed
+	// here, out of the lock
+}
 
-		// The particles' cov:
+void PFLocalization::renderThread()
+{
+	const auto period = std::chrono::microseconds(
+		static_cast<int64_t>(1e6 / std::max(1, SHOW_PROGRESS_3D_FPS_)));
+	std::shared_ptr<const DebugFrame> last;
+	while (!stop_render_)
+	{
+		const auto next = std::chrono::steady_clock::now() + period;
+		std::shared_ptr<const DebugFrame> frame;
 		{
-			CRenderizable::Ptr ellip = ptr_scene->getByName("parts_cov");
-			if (!ellip)
-			{
-				auto o = CEllipsoid2D::Create();
-				ellip = o;
-				ellip->setName("parts_cov");
-				ellip->setColor(1, 0, 0, 0.6);
-
-				o->setLineWidth(2);
-				o->setQuantiles(3);
-				o->set2DsegmentsCount(60);
-				ptr_scene->insert(ellip);
-			}
-			ellip->setLocation(meanPose.x(), meanPose.y(), 0.05);
-			dynamic_cast<CEllipsoid2D*>(ellip.get())
-				->setCovMatrix(cov.blockCopy<2, 2>());
+			std::lock_guard<std::mutex> lock(debug_frame_mutex_);
+			frame = debug_frame_;
 		}
+		if (frame && frame != last) render3DDebug(*frame);
+		last = std::move(frame);
+		std::this_thread::sleep_until(next);
+	}
+}
 
-		// The laser scan:
+void PFLocalization::render3DDebug(const DebugFrame& frame)
+{
+	const auto& cov = frame.stats.cov;
+	const auto& meanPose = frame.stats.mean;
+
+	COpenGLScene::Ptr ptr_scene = win3D_->get3DSceneAndLock();
+
+	win3D_->setCameraPointingToPoint(meanPose.x(), meanPose.y(), 0);
+
+	mrpt::opengl::TFontParams fp;
+	fp.color = TColorf(.8f, .8f, .8f);
+	fp.vfont_name = "mono";
+	fp.vfont_scale = 15;
+
+	win3D_->addTextMessage(
+		10, 10,
+		mrpt::format(
+			"timestamp: %s",
+			frame.stamp != INVALID_TIMESTAMP
+				? mrpt::system::dateTimeLocalToString(frame.stamp).c_str()
+				: "(none)"),
+		6001, fp);
+
+	win3D_->addTextMessage(
+		10, 33,
+		mrpt::format(
+			"#particles= %7u  ESS= %7.1f",
+			static_cast<unsigned int>(frame.stats.num_particles),
+			frame.stats.ess),
+		6002, fp);
+
+	win3D_->addTextMessage(
+		10, 55,
+		mrpt::format(
+			"mean pose (x y phi_deg)= %s", meanPose.asString().c_str()),
+		6003, fp);
+
+	// The particles:
+	{
+		CRenderizable::Ptr parts = ptr_scene->getByName("particles");
+		if (!parts)
 		{
-			CRenderizable::Ptr scan_pts = ptr_scene->getByName("scan");
-			if (!scan_pts)
-			{
-				auto o = CPointCloud::Create();
-				scan_pts = o;
-				scan_pts->setName("scan");
-				scan_pts->setColor(1, 0, 0, 0.9);
-				o->enableColorFromZ(false);
-				o->setPointSize(4);
-				ptr_scene->insert(scan_pts);
-			}
-
-			CSimplePointsMap map;
-			static CSimplePointsMap last_map;
-
-			CPose3D robot_pose_3D(meanPose);
-
-			map.clear();
-			_observations->insertObservationsInto(map);
-
-			dynamic_cast<CPointCloud*>(scan_pts.get())
-				->loadFromPointsMap(&last_map);
-			dynamic_cast<CPointCloud*>(scan_pts.get())->setPose(robot_pose_3D);
-			last_map = map;
+			auto o = CPointCloud::Create();
+			parts = o;
+			parts->setName("particles");
+			parts->setColor(0, 0, 1);
+			o->setPointSize(2);
+			ptr_scene->insert(parts);
 		}
+		const std::vector<float> zs(frame.xs.size(), 0.0f);
+		dynamic_cast<CPointCloud*>(parts.get())
+			->setAllPoints(frame.xs, frame.ys, zs);
+	}
 
-		// The camera:
-		ptr_scene->enableFollowCamera(true);
-
-		// Views:
-		COpenGLViewport::Ptr view1 = ptr_scene->getViewport("main");
+	// The particles' cov:
+	{
+		CRenderizable::Ptr ellip = ptr_scene->getByName("parts_cov");
+		if (!ellip)
 		{
-			CCamera& cam = view1->getCamera();
-			cam.setAzimuthDegrees(-90);
-			cam.setElevationDegrees(90);
-			cam.setPointingAt(meanPose);
-			cam.setZoomDistance(5);
-			cam.setOrthogonal();
+			auto o = CEllipsoid2D::Create();
+			ellip = o;
+			ellip->setName("parts_cov");
+			ellip->setColor(1, 0, 0, 0.6);
+
+			o->setLineWidth(2);
+			o->setQuantiles(3);
+			o->set2DsegmentsCount(60);
+			ptr_scene->insert(ellip);
 		}
+		ellip->setLocation(meanPose.x(), meanPose.y(), 0.05);
+		dynamic_cast<CEllipsoid2D*>(ellip.get())
+			->setCovMatrix(cov.blockCopy<2, 2>());
+	}
 
-		win3D_->unlockAccess3DScene();
+	// The laser scan, at the mean pose:
+	{
+		CRenderizable::Ptr scan_pts = ptr_scene->getByName("scan");
+		if (!scan_pts)
+		{
+			auto o = CPointCloud::Create();
+			scan_pts = o;
+			scan_pts->setName("scan");
+			scan_pts->setColor(1, 0, 0, 0.9);
+			o->enableColorFromZ(false);
+			o->setPointSize(4);
+			ptr_scene->insert(scan_pts);
+		}
 
-		// Move camera:
-		// win3D_->setCameraPointingToPoint( curRobotPose.x, curRobotPose.y,
-		// curRobotPose.z );
+		CSimplePointsMap map;
+		frame.observations.insertObservationsInto(map);
+		dynamic_cast<CPointCloud*>(scan_pts.get())->loadFromPointsMap(&map);
+		scan_pts->setPose(CPose3D(meanPose));
+	}
 
-		// Update:
-		win3D_->forceRepaint();
+	// The camera:
+	ptr_scene->enableFollowCamera(true);
 
-		std::this_thread::sleep_for(
-			std::chrono::milliseconds(SHOW_PROGRESS_3D_REAL_TIME_DELAY_MS_));
+	// Views:
+	COpenGLViewport::Ptr view1 = ptr_scene->getViewport("main");
+	{
+		CCamera& cam = view1->getCamera();
+		cam.setAzimuthDegrees(-90);
+		cam.setElevationDegrees(90);
+		cam.setPointingAt(meanPose);
+		cam.setZoomDistance(5);
+		cam.setOrthogonal();
 	}
+
+	win3D_->unlockAccess3DScene();
+	win3D_->forceRepaint();
 }
@@ -31,11 +31,20 @@
  **                       *
  ***********************************************************************************/
 
+#include <mrpt/maps/CBeaconMap.h>
 #include <mrpt/maps/CLandmarksMap.h>
 #include <mrpt/maps/COccupancyGridMap2D.h>
+#include <mrpt/maps/CSimplePointsMap.h>
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt/system/filesystem.h>
 #include <mrpt_localization/mrpt_localization_core.h>
 #include <ros/console.h>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 using namespace mrpt;
 using namespace mrpt::slam;
 using namespace mrpt::opengl;
@@ -43,9 +52,17 @@ using namespace mrpt::math;
 using namespace mrpt::system;
 using namespace std;
 
+using mrpt::maps::CBeaconMap;
 using mrpt::maps::CLandmarksMap;
 using mrpt::maps::COccupancyGridMap2D;
 
+/** MRPT draws all the random samples from one global generator */
+static std::mutex& randomGeneratorMutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
 PFLocalizationCore::~PFLocalizationCore() {}
 PFLocalizationCore::PFLocalizationCore() : state_(NA) {}
 void PFLocalizationCore::init()
@@ -78,10 +95,13 @@ void PFLocalizationCore::initializeFilter()
 
 	if (metric_map_->countMapsByClass<COccupancyGridMap2D>() && !init_PDF_mode)
 	{
-		pdf_.resetUniformFreeSpace(
-			metric_map_->mapByClass<COccupancyGridMap2D>().get(), 0.7f,
-			initial_particle_count_, min_x, max_x, min_y, max_y, min_phi,
-			max_phi);
+		if (!resetUniformFreeCells(
+				initial_particle_count_, min_x, max_x, min_y, max_y, min_phi,
+				max_phi))
+			pdf_.resetUniformFreeSpace(
+				metric_map_->mapByClass<COccupancyGridMap2D>().get(), 0.7f,
+				initial_particle_count_, min_x, max_x, min_y, max_y, min_phi,
+				max_phi);
 	}
 	else if (metric_map_->countMapsByClass<CLandmarksMap>() || init_PDF_mode)
 	{
@@ -92,16 +112,480 @@ void PFLocalizationCore::initializeFilter()
 	state_ = RUN;
 }
 
+bool PFLocalizationCore::resetUniformFreeCells(
+	size_t count, float min_x, float max_x, float min_y, float max_y,
+	float min_phi, float max_phi)
+{
+	auto& rng = mrpt::random::getRandomGenerator();
+	std::vector<mrpt::math::TPoint2D> points;
+	if (!free_cells_->sample(count, min_x, max_x, min_y, max_y, rng, points))
+		return false;
+
+	pdf_.m_particles.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		auto& p = pdf_.m_particles[i];
+		p.d = mrpt::math::TPose2D(
+			points[i].x, points[i].y, rng.drawUniform(min_phi, max_phi));
+		p.log_w = 0;
+	}
+	return true;
+}
+
+void PFLocalizationCore::injectRandomParticles()
+{
+	auto& particles = pdf_.m_particles;
+	if (random_particles_ratio_ <= 0 || free_cells_->size() == 0 ||
+		particles.empty())
+		return;
+	const size_t count = std::min(
+		particles.size(),
+		static_cast<size_t>(
+			std::round(random_particles_ratio_ * particles.size())));
+	if (count == 0) return;
+
+	auto& rng = mrpt::random::getRandomGenerator();
+	std::vector<mrpt::math::TPoint2D> points;
+	const float inf = std::numeric_limits<float>::max();
+	if (!free_cells_->sample(count, -inf, inf, -inf, inf, rng, points))
+		return;
+
+	// The new particles get the average weight, so they neither take over
+	// the filter nor vanish before the next observation weights them
+	double max_log_w = -std::numeric_limits<double>::infinity();
+	for (const auto& p : particles) max_log_w = std::max(max_log_w, p.log_w);
+	double sum_w = 0;
+	for (const auto& p : particles) sum_w += std::exp(p.log_w - max_log_w);
+	const double mean_log_w = max_log_w + std::log(sum_w / particles.size());
+
+	for (const auto& point : points)
+	{
+		auto& p = particles[FreeCellIndex::drawIndex(
+			rng, static_cast<uint32_t>(particles.size()))];
+		p.d = mrpt::math::TPose2D(
+			point.x, point.y, rng.drawUniform(-M_PI, M_PI));
+		p.log_w = mean_log_w;
+	}
+}
+
+void PFLocalizationCore::onMapUpdated()
+{
+	auto free_cells = std::make_shared<FreeCellIndex>();
+	if (const auto grid = metric_map_->mapByClass<COccupancyGridMap2D>())
+	{
+		CTicTac tictac;
+		free_cells->build(*grid);
+		ROS_INFO(
+			"Free cell index: %zu cells in %.3fs", free_cells->size(),
+			tictac.Tac());
+
+		// Its lazily filled cache could not be read by concurrent updates
+		if (concurrent_updates_)
+			grid->likelihoodOptions.enableLikelihoodCache = false;
+	}
+	free_cells_ = free_cells;
+	updateLikelihoodField();
+	// Built again by the next global localization
+	localization_pyramid_ = std::make_shared<LocalizationPyramid>();
+
+	// Like the likelihood field, the beacon kernel replaces the likelihood
+	// of the whole metric map
+	pdf_.beacon_kernel.clear();
+	if (metric_map_->maps.size() == 1)
+		if (const auto beacons = metric_map_->mapByClass<CBeaconMap>())
+		{
+			pdf_.beacon_kernel.setMap(*beacons);
+			if (pdf_.beacon_kernel.size())
+				ROS_INFO(
+					"Beacon likelihood kernel: %zu beacons indexed",
+					pdf_.beacon_kernel.size());
+			else
+				ROS_INFO(
+					"Beacon likelihood kernel: not all the beacons are "
+					"Gaussian with distinct IDs, using CBeaconMap");
+		}
+}
+
+void PFLocalizationCore::shareMap(const PFLocalizationCore& owner)
+{
+	metric_map_ = owner.metric_map_;
+	pdf_.options.metricMap = metric_map_;
+	free_cells_ = owner.free_cells_;
+	localization_pyramid_ = owner.localization_pyramid_;
+	if (pdf_.use_scan_kernel)
+		pdf_.likelihood_field = owner.pdf_.likelihood_field;
+	if (pdf_.use_beacon_kernel) pdf_.beacon_kernel = owner.pdf_.beacon_kernel;
+}
+
+void PFLocalizationCore::updateLikelihoodField()
+{
+	pdf_.likelihood_field.reset();
+	if (!pdf_.use_scan_kernel) return;
+
+	// The kernel replaces the likelihood of the whole metric map, hence it
+	// can only be used if the map is just one grid
+	if (metric_map_->maps.size() != 1 ||
+		!metric_map_->countMapsByClass<COccupancyGridMap2D>())
+		return;
+	const auto grid = metric_map_->mapByClass<COccupancyGridMap2D>();
+	if (!LikelihoodField::isApplicable(*grid))
+	{
+		ROS_INFO(
+			"Scan likelihood kernel disabled: it requires likelihoodMethod=%i "
+			"(LF_Trun) and LF_alternateAverageMethod=0",
+			static_cast<int>(COccupancyGridMap2D::lmLikelihoodField_Thrun));
+		return;
+	}
+
+	CTicTac tictac;
+	auto lf = LikelihoodField::Create(
+		*grid, likelihood_cache_dir_, quantize_likelihood_field_);
+	ROS_INFO(
+		"Likelihood field of %ix%i cells%s %s in %.3fs (scan kernel: %s)",
+		lf->sizeX(), lf->sizeY(), lf->isQuantized() ? " (8 bit)" : "",
+		lf->isMemoryMapped() ? "mapped from cache" : "built", tictac.Tac(),
+		ScanLikelihoodKernel::implementation());
+
+	if (!lf->isMemoryMapped() && !likelihood_cache_dir_.empty())
+	{
+		const std::string file =
+			likelihood_cache_dir_ + "/" + lf->cacheFileName();
+		if (!mrpt::system::createDirectory(likelihood_cache_dir_) ||
+			!lf->saveToFile(file))
+			ROS_WARN("Could not save likelihood field cache: %s", file.c_str());
+		else
+		{
+			ROS_INFO("Likelihood field saved to cache: %s", file.c_str());
+			// Use the mapped file, only its tiles near the particles will be
+			// resident
+			const auto mapped = LikelihoodField::Create(
+				*grid, likelihood_cache_dir_, quantize_likelihood_field_);
+			if (mapped->isMemoryMapped()) lf = mapped;
+		}
+		// Maps received from a topic may change at any time, do not let
+		// their fields fill the disk
+		LikelihoodField::evictCache(
+			likelihood_cache_dir_, likelihood_cache_max_files_);
+	}
+	pdf_.likelihood_field = lf;
+}
+
+GlobalLocalizer::Pyramid::ConstPtr PFLocalizationCore::localizationPyramid()
+{
+	std::lock_guard<std::mutex> lock(localization_pyramid_->mutex);
+	if (localization_pyramid_->pyramid) return localization_pyramid_->pyramid;
+	const auto grid = metric_map_->mapByClass<COccupancyGridMap2D>();
+	if (!grid) return nullptr;
+
+	CTicTac tictac;
+	// Without the field of the scan kernel, a quantized one is good enough
+	// for the search
+	LikelihoodField::ConstPtr field = pdf_.likelihood_field;
+	if (!field) field = LikelihoodField::Create(*grid, std::string(), true);
+
+	// Same free space than initializeFilter()
+	std::vector<uint8_t> free_cells;
+	free_cells_->freeMask(free_cells);
+	const auto pyramid = std::make_shared<GlobalLocalizer::Pyramid>(
+		field, free_cells.empty() ? nullptr : &free_cells);
+	// Building it read the whole field, the updates only need a few tiles
+	field->release();
+	ROS_INFO(
+		"Global localization pyramid of %i levels built in %.3fs",
+		pyramid->numLevels(), tictac.Tac());
+	localization_pyramid_->pyramid = pyramid;
+	return pyramid;
+}
+
+void PFLocalizationCore::prefetchLikelihoodField(const CSensoryFrame& sf)
+{
+	const auto& field = pdf_.likelihood_field;
+	if (!field || !field->isMemoryMapped() || pdf_.m_particles.empty()) return;
+
+	// Scan endpoints are within the sensor range of the particles, which
+	// move a bit in the prediction step
+	float range = 0;
+	for (const auto& obs : sf)
+		if (const auto* scan =
+				dynamic_cast<const CObservation2DRangeScan*>(obs.get()))
+			range = std::max(range, scan->maxRange);
+	if (range <= 0) return;
+	range = std::min(range, field->params().max_range) + 1.0f;
+
+	// Around each cluster of the last update: one box around all the
+	// particles would span the whole map as soon as they are spread, e.g.
+	// after a uniform initialization. Particles injected after the
+	// clustering are paged in on demand.
+	prefetch_boxes_.clear();
+	for (const auto& b : clusterer_.boxes())
+		prefetch_boxes_.push_back(
+			{static_cast<float>(b.x_min) - range,
+			 static_cast<float>(b.x_max) + range,
+			 static_cast<float>(b.y_min) - range,
+			 static_cast<float>(b.y_max) + range});
+	if (prefetch_boxes_.empty())
+	{
+		double min_x = std::numeric_limits<double>::max(), max_x = -min_x;
+		double min_y = min_x, max_y = -min_x;
+		for (const auto& p : pdf_.m_particles)
+		{
+			min_x = std::min(min_x, p.d.x), max_x = std::max(max_x, p.d.x);
+			min_y = std::min(min_y, p.d.y), max_y = std::max(max_y, p.d.y);
+		}
+		prefetch_boxes_.push_back(
+			{static_cast<float>(min_x) - range,
+			 static_cast<float>(max_x) + range,
+			 static_cast<float>(min_y) - range,
+			 static_cast<float>(max_y) + range});
+	}
+	field->prefetch(prefetch_boxes_);
+}
+
+/** Number of valid rays per evaluated ray in the likelihood of the grid */
+static size_t scanDecimation(const CMultiMetricMap& map)
+{
+	const auto grid = map.mapByClass<COccupancyGridMap2D>();
+	if (!grid) return 1;
+	const auto& lo = grid->likelihoodOptions;
+	if (lo.likelihoodMethod != COccupancyGridMap2D::lmLikelihoodField_Thrun &&
+		lo.likelihoodMethod != COccupancyGridMap2D::lmLikelihoodField_II)
+		return 1;
+	return std::max<size_t>(1, lo.LF_decimation);
+}
+
+bool PFLocalizationCore::globalLocalization(const CSensoryFrame& sf)
+{
+	const auto pyramid = localizationPyramid();
+	if (!pyramid)
+	{
+		ROS_WARN("Global localization requires an occupancy grid map");
+		return false;
+	}
+
+	// Scan points in the robot frame
+	mrpt::maps::CSimplePointsMap points;
+	sf.insertObservationsInto(points);
+	std::vector<float> xs, ys;
+	points.getAllPoints(xs, ys);
+	if (xs.empty())
+	{
+		ROS_WARN("Global localization: no valid scan points");
+		return false;
+	}
+
+	CTicTac tictac;
+	const LikelihoodField& field = pyramid->field();
+	const auto hypotheses = global_localizer_.localize(*pyramid, xs, ys);
+	// The search read cells all over the field, the updates only need a few
+	// tiles. Those of the filters of other robots, which share the field,
+	// are left resident.
+	if (!concurrent_updates_) field.release();
+	if (hypotheses.empty())
+	{
+		ROS_WARN("Global localization: no pose found");
+		return false;
+	}
+	for (const auto& h : hypotheses)
+		ROS_INFO(
+			"Global localization hypothesis: %s (score %.3f)",
+			h.pose.asString().c_str(), h.score);
+
+	std::unique_lock<std::mutex> random_lock(
+		randomGeneratorMutex(), std::defer_lock);
+	if (concurrent_updates_) random_lock.lock();
+	auto& rng = mrpt::random::getRandomGenerator();
+	const double std_xy = 2 * field.resolution();
+	const double std_phi = global_localizer_.params.angular_resolution;
+	pdf_.m_particles.resize(
+		std::max<size_t>(initial_particle_count_, hypotheses.size()));
+	for (size_t i = 0; i < pdf_.m_particles.size(); i++)
+	{
+		const auto& c = hypotheses[i % hypotheses.size()].pose;
+		auto& p = pdf_.m_particles[i];
+		p.d = mrpt::math::TPose2D(
+			c.x + rng.drawGaussian1D(0, std_xy),
+			c.y + rng.drawGaussian1D(0, std_xy),
+			mrpt::math::wrapToPi(c.phi + rng.drawGaussian1D(0, std_phi)));
+		p.log_w = 0;
+	}
+	if (random_lock.owns_lock()) random_lock.unlock();
+	state_ = RUN;
+	updatePoseStatistics();
+	ROS_INFO("Global localization done in %.3fs", tictac.Tac());
+	return true;
+}
+
 void PFLocalizationCore::updateFilter(
 	CActionCollection::Ptr _action, CSensoryFrame::Ptr _sf)
 {
-	if (state_ == INIT) initializeFilter();
+	// The global random generator is only locked by the stages that draw
+	// from it: the initialization, the filter step except the weighting by
+	// the kernels, and the injection of random particles
+	std::unique_lock<std::mutex> random_lock(
+		randomGeneratorMutex(), std::defer_lock);
+	const auto lockRandom = [&] {
+		if (concurrent_updates_) random_lock.lock();
+	};
+	const auto unlockRandom = [&] {
+		if (random_lock.owns_lock()) random_lock.unlock();
+	};
+	const PFLocalizationPDF::RandomLockScope random_lock_scope(
+		pdf_, concurrent_updates_ ? &random_lock : nullptr);
+
+	if (state_ == INIT)
+	{
+		lockRandom();
+		initializeFilter();
+		unlockRandom();
+		// The clusters locate the new particles for the prefetch
+		updatePoseStatistics();
+	}
+
+	CTicTac total;
+	auto& diag = update_diagnostics_;
+	diag = UpdateDiagnostics();
+
+	size_t evaluated_rays = 0;
+	const CSensoryFrame* sf = _sf.get();
+	tictac_.Tic();
+	if (beam_selector_.time_budget > 0)
+	{
+		// The KLD sampling of the update may grow the particle set up to its
+		// maximum size, budget for that
+		size_t num_particles = pdf_.particlesCount();
+		if (pf_.m_options.adaptiveSampleSize)
+			num_particles = std::max<size_t>(
+				num_particles, pdf_.options.KLD_params.KLD_maxSampleSize);
+		evaluated_rays = beam_selector_.apply(
+			*_sf, num_particles, scanDecimation(*metric_map_), beam_frame_);
+		sf = &beam_frame_;
+	}
+	diag.beam_selection_time = tictac_.Tac();
+
+	tictac_.Tic();
+	prefetchLikelihoodField(*_sf);
+	diag.prefetch_time = tictac_.Tac();
+
+	// Waiting for other filters does not count in the update time, which
+	// the sample size is adapted to
+	lockRandom();
 	tictac_.Tic();
-	pf_.executeOn(pdf_, _action.get(), _sf.get(), &pf_stats_);
+	pf_.executeOn(pdf_, _action.get(), sf, &pf_stats_);
+	update_time_ = tictac_.Tac();
+	unlockRandom();
+
+	tictac_.Tic();
+	updatePoseStatistics();
+	adaptSampleSize();
+	lockRandom();
+	injectRandomParticles();
+	unlockRandom();
+	diag.statistics_time = tictac_.Tac();
+
+	// Feed the cost model of the beam selection with this update
+	const auto& stats = pdf_.last_update_stats;
+	if (stats.used_scan_kernel)
+		beam_selector_.addMeasurement(
+			stats.weighting_time, stats.num_evaluations);
+	else if (beam_selector_.time_budget > 0)
+		beam_selector_.addMeasurement(
+			update_time_, evaluated_rays * pdf_.particlesCount());
+
+	diag.filter_time = update_time_;
+	if (stats.used_scan_kernel || stats.used_beacon_kernel)
+	{
+		diag.stages_measured = true;
+		diag.prediction_time = stats.prediction_time;
+		diag.weighting_time = stats.weighting_time;
+		diag.resampling_time = std::max(
+			0.0, update_time_ - stats.prediction_time - stats.weighting_time);
+	}
+	diag.ess = pf_stats_.ESS_beforeResample;
+	diag.num_particles = pdf_.particlesCount();
+	diag.num_evaluations = stats.num_evaluations;
+	diag.total_time = total.Tac();
+
 	time_last_update_ = _sf->getObservationByIndex(0)->timestamp;
 	update_counter_++;
 }
 
+void PFLocalizationCore::updatePoseStatistics()
+{
+	const auto& particles = pdf_.m_particles;
+	pose_stats_ = PoseStatistics();
+	pose_stats_.num_particles = particles.size();
+	if (particles.empty()) return;
+
+	// Moments relative to the first particle, to avoid cancellation with
+	// large coordinates and to deal with the angle wrapping. The weights are
+	// exp(log_w - max_log_w), rescaling the sums whenever the maximum grows.
+	const auto& ref = particles[0].d;
+	double max_log_w = particles[0].log_w;
+	double sw = 0, sw2 = 0, sx = 0, sy = 0, sa = 0;
+	double sxx = 0, syy = 0, saa = 0, sxy = 0, sxa = 0, sya = 0;
+	double sin_sum = 0, cos_sum = 0;
+	for (const auto& p : particles)
+	{
+		if (p.log_w > max_log_w)
+		{
+			const double k = std::exp(max_log_w - p.log_w);
+			sw *= k, sx *= k, sy *= k, sa *= k;
+			sxx *= k, syy *= k, saa *= k, sxy *= k, sxa *= k, sya *= k;
+			sin_sum *= k, cos_sum *= k;
+			sw2 *= k * k;
+			max_log_w = p.log_w;
+		}
+		const double w = std::exp(p.log_w - max_log_w);
+		const double dx = p.d.x - ref.x;
+		const double dy = p.d.y - ref.y;
+		const double da = mrpt::math::wrapToPi(p.d.phi - ref.phi);
+		sw += w;
+		sw2 += w * w;
+		sx += w * dx, sy += w * dy, sa += w * da;
+		sxx += w * dx * dx, syy += w * dy * dy, saa += w * da * da;
+		sxy += w * dx * dy, sxa += w * dx * da, sya += w * dy * da;
+		sin_sum += w * std::sin(p.d.phi);
+		cos_sum += w * std::cos(p.d.phi);
+	}
+
+	const double mx = sx / sw, my = sy / sw, ma = sa / sw;
+	pose_stats_.mean = mrpt::poses::CPose2D(
+		ref.x + mx, ref.y + my, std::atan2(sin_sum, cos_sum));
+	auto& cov = pose_stats_.cov;
+	cov(0, 0) = sxx / sw - mx * mx;
+	cov(1, 1) = syy / sw - my * my;
+	cov(2, 2) = saa / sw - ma * ma;
+	cov(0, 1) = cov(1, 0) = sxy / sw - mx * my;
+	cov(0, 2) = cov(2, 0) = sxa / sw - mx * ma;
+	cov(1, 2) = cov(2, 1) = sya / sw - my * ma;
+	pose_stats_.ess = sw * sw / sw2;
+
+	clusterer_.cluster(particles, pose_stats_.clusters);
+}
+
+void PFLocalizationCore::adaptSampleSize()
+{
+	const size_t num_particles = pdf_.particlesCount();
+	if (update_time_target_ <= 0 || kld_max_sample_size_ == 0 ||
+		num_particles == 0 || update_time_ <= 0)
+		return;
+
+	// The update cost is roughly linear in the number of particles
+	const double t = update_time_ / num_particles;
+	time_per_particle_ =
+		time_per_particle_ > 0 ? 0.8 * time_per_particle_ + 0.2 * t : t;
+
+	// Aim a bit below the target to absorb the jitter, and grow slowly to
+	// avoid oscillations
+	auto& kld = pdf_.options.KLD_params;
+	const double affordable = 0.9 * update_time_target_ / time_per_particle_;
+	const double lo = kld.KLD_minSampleSize;
+	const double hi = std::max(lo, static_cast<double>(kld_max_sample_size_));
+	const double max_sample_size = std::max(
+		lo, std::min(hi, std::min(affordable, 1.25 * kld.KLD_maxSampleSize)));
+	kld.KLD_maxSampleSize = static_cast<unsigned int>(max_sample_size);
+}
+
 void PFLocalizationCore::observation(
 	CSensoryFrame::Ptr _sf, CObservationOdometry::Ptr _odometry)
 {
@@ -116,6 +600,17 @@ void PFLocalizationCore::observation(
 		}
 		mrpt::poses::CPose2D incOdoPose =
 			_odometry->odometry - odom_last_observation_;
+
+		// Skip the observation, but keep accumulating the odometry, until
+		// the robot has moved enough (thresholds <= 0 are not used)
+		const bool small_d =
+			update_min_d_ <= 0 || incOdoPose.norm() < update_min_d_;
+		const bool small_a = update_min_a_ <= 0 ||
+			std::abs(incOdoPose.phi()) < update_min_a_;
+		if (state_ == RUN && (update_min_d_ > 0 || update_min_a_ > 0) &&
+			small_d && small_a)
+			return;
+
 		odom_last_observation_ = _odometry->odometry;
 		odom_move.computeFromOdometry(incOdoPose, motion_model_options_);
 		action->insert(odom_move);
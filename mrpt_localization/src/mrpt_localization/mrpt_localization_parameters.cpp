@@ -40,6 +40,8 @@ PFLocalization::Parameters::Parameters(PFLocalization* p)
 	  ini_file(MRPT_LOCALIZATION_DEFAULT_INI_FILE),
 	  map_file(MRPT_LOCALIZATION_DEFAULT_MAP_FILE),
 	  sensor_sources(MRPT_LOCALIZATION_DEFAULT_SENSOR_SOURCES),
+	  update_min_d(MRPT_LOCALIZATION_DEFAULT_UPDATE_MIN_D),
+	  update_min_a(MRPT_LOCALIZATION_DEFAULT_UPDATE_MIN_A),
 	  use_motion_model_default_options(&p->use_motion_model_default_options_),
 	  motion_model_options(&p->motion_model_options_),
 	  motion_model_default_options(&p->motion_model_default_options_)
@@ -0,0 +1,333 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/math/distributions.h>
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt/poses/CPose2D.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt_localization/mrpt_localization_pdf.h>
+
+#include <algorithm>
+#include <cmath>
+
+using mrpt::bayes::CParticleFilter;
+using mrpt::obs::CActionRobotMovement2D;
+using mrpt::obs::CObservation2DRangeScan;
+using mrpt::obs::CObservationBeaconRanges;
+using mrpt::obs::CSensoryFrame;
+
+namespace
+{
+/** Releases a lock, if any is held, for the lifetime of the object */
+class ScopedUnlock
+{
+   public:
+	explicit ScopedUnlock(std::unique_lock<std::mutex>* lock)
+		: lock_(lock && lock->owns_lock() ? lock : nullptr)
+	{
+		if (lock_) lock_->unlock();
+	}
+	~ScopedUnlock()
+	{
+		if (lock_) lock_->lock();
+	}
+	ScopedUnlock(const ScopedUnlock&) = delete;
+	ScopedUnlock& operator=(const ScopedUnlock&) = delete;
+
+   private:
+	std::unique_lock<std::mutex>* lock_;
+};
+}  // namespace
+
+void PFLocalizationPDF::prediction_and_update_pfStandardProposal(
+	const mrpt::obs::CActionCollection* action,
+	const mrpt::obs::CSensoryFrame* observation,
+	const mrpt::bayes::CParticleFilter::TParticleFilterOptions& PF_options)
+{
+	last_update_stats = UpdateStats();
+	if (!observation || !loadObservations(*observation))
+	{
+		CMonteCarloLocalization2D::prediction_and_update_pfStandardProposal(
+			action, observation, PF_options);
+		return;
+	}
+
+	const auto movement = action ? action->getBestMovementEstimation()
+								 : CActionRobotMovement2D::Ptr();
+	const bool use_arena = use_particle_arena && movement;
+
+	// Prediction stage only (the KLD resampling of the arena is not timed as
+	// part of it, unlike the one of CMonteCarloLocalization2D):
+	if (use_arena)
+	{
+		loadArena();
+		if (PF_options.adaptiveSampleSize)
+			last_update_stats.prediction_time =
+				sampleKLD(PF_options, *movement);
+		else
+		{
+			tictac_.Tic();
+			predict(*movement);
+			last_update_stats.prediction_time = tictac_.Tac();
+		}
+	}
+	else
+	{
+		tictac_.Tic();
+		CMonteCarloLocalization2D::prediction_and_update_pfStandardProposal(
+			action, nullptr, PF_options);
+		last_update_stats.prediction_time = tictac_.Tac();
+	}
+
+	// Update stage, all particles at once:
+	const ScopedUnlock unlock(random_lock_);
+	tictac_.Tic();
+	const size_t M = use_arena ? arena_.size() : m_particles.size();
+	particles_soa_.resize(M);
+	for (size_t i = 0; i < M; i++)
+	{
+		if (use_arena)
+			particles_soa_.set(
+				i, arena_.x()[i], arena_.y()[i], arena_.phi()[i]);
+		else
+		{
+			const auto& p = m_particles[i].d;
+			particles_soa_.set(i, p.x, p.y, p.phi);
+		}
+	}
+
+	log_lik_.resize(M);
+	if (kernel_.size())
+		kernel_.evaluate(particles_soa_, *likelihood_field, log_lik_.data());
+	else
+		std::fill(log_lik_.begin(), log_lik_.end(), 0.0);
+	for (const auto* beacons : beacon_observations_)
+		beacon_kernel.evaluate(particles_soa_, *beacons, log_lik_.data());
+
+	if (use_arena)
+	{
+		double* log_w = arena_.logW();
+		for (size_t i = 0; i < M; i++)
+			log_w[i] += log_lik_[i] * PF_options.powFactor;
+		storeArena();
+	}
+	else
+		for (size_t i = 0; i < M; i++)
+			m_particles[i].log_w += log_lik_[i] * PF_options.powFactor;
+
+	last_update_stats.used_scan_kernel = beacon_observations_.empty();
+	last_update_stats.used_beacon_kernel = !beacon_observations_.empty();
+	last_update_stats.weighting_time = tictac_.Tac();
+	last_update_stats.num_evaluations = kernel_.size() * M;
+}
+
+bool PFLocalizationPDF::loadObservations(const CSensoryFrame& observation)
+{
+	kernel_.clear();
+	beacon_observations_.clear();
+	if (observation.size() == 0) return false;
+
+	for (const auto& obs : observation)
+	{
+		if (const auto* beacons =
+				dynamic_cast<const CObservationBeaconRanges*>(obs.get()))
+		{
+			if (!use_beacon_kernel || !beacon_kernel.size()) return false;
+			beacon_observations_.push_back(beacons);
+			continue;
+		}
+
+		const auto* scan =
+			dynamic_cast<const CObservation2DRangeScan*>(obs.get());
+		if (!scan || !use_scan_kernel || !likelihood_field) return false;
+
+		// Like COccupancyGridMap2D, only horizontal scans are used
+		if (!scan->isPlanarScan(
+				likelihood_field->params().horizontal_tolerance))
+			continue;
+
+		kernel_.addScan(*scan, likelihood_field->params().decimation);
+	}
+	return true;
+}
+
+void PFLocalizationPDF::performSubstitution(const std::vector<size_t>& indx)
+{
+	if (!use_particle_arena)
+	{
+		CMonteCarloLocalization2D::performSubstitution(indx);
+		return;
+	}
+	loadArena();
+	arena_.gather(indx.data(), indx.size());
+	storeArena();
+}
+
+void PFLocalizationPDF::loadArena()
+{
+	const size_t M = m_particles.size();
+	arena_.resize(M);
+	for (size_t i = 0; i < M; i++)
+	{
+		const auto& p = m_particles[i];
+		arena_.x()[i] = p.d.x;
+		arena_.y()[i] = p.d.y;
+		arena_.phi()[i] = p.d.phi;
+		arena_.logW()[i] = p.log_w;
+	}
+}
+
+void PFLocalizationPDF::storeArena()
+{
+	const size_t M = arena_.size();
+	m_particles.resize(M);
+	for (size_t i = 0; i < M; i++)
+	{
+		auto& p = m_particles[i];
+		p.d.x = arena_.x()[i];
+		p.d.y = arena_.y()[i];
+		p.d.phi = arena_.phi()[i];
+		p.log_w = arena_.logW()[i];
+	}
+}
+
+double PFLocalizationPDF::sampleKLD(
+	const CParticleFilter::TParticleFilterOptions& PF_options,
+	const CActionRobotMovement2D& movement)
+{
+	if (arena_.size() == 0) return 0;
+
+	const auto& kld = options.KLD_params;
+	auto& rng = mrpt::random::getRandomGenerator();
+	const auto method =
+		PF_options.resamplingMethod == CParticleFilter::prStratified
+		? ParticleArena::Resampling::STRATIFIED
+		: ParticleArena::Resampling::SYSTEMATIC;
+	const size_t min_count = kld.KLD_minSampleSize;
+	const size_t max_count =
+		std::max(kld.KLD_minSampleSize, kld.KLD_maxSampleSize);
+
+	// Samples needed for the KL divergence to be below KLD_epsilon with
+	// probability 1 - KLD_delta (Fox, 2003), for K occupied bins
+	const auto needed = [&](size_t K) {
+		double N = min_count;
+		if (K > 1)
+		{
+			const double k = K - 1.0;
+			const double a = 2.0 / (9.0 * k);
+			const double z = mrpt::math::normalQuantile(1.0 - kld.KLD_delta);
+			N = k / (2.0 * kld.KLD_epsilon) *
+				std::pow(1.0 - a + std::sqrt(a) * z, 3);
+		}
+		N = std::max(N, kld.KLD_minSamplesPerBin * K);
+		return static_cast<size_t>(std::clamp(
+			std::ceil(N), static_cast<double>(min_count),
+			static_cast<double>(max_count)));
+	};
+
+	// Fox draws and moves one sample at a time until there are as many as
+	// needed for the bins of the moved ones. Drawing a whole set in one
+	// pass instead, the set grows from the minimum size to the number needed
+	// for the bins of the previous one, until it has enough.
+	const size_t MAX_ROUNDS = 8;
+	double prediction_time = 0;
+	size_t count = min_count;
+	for (size_t round = 1;; round++)
+	{
+		arena_.gather(arena_.select(count, method, rng), count);
+		tictac_.Tic();
+		predict(movement);
+		prediction_time += tictac_.Tac();
+
+		const size_t N = needed(countBins());
+		if (N <= count || round == MAX_ROUNDS) break;
+		arena_.restore();
+		count = N;
+	}
+	std::fill(arena_.logW(), arena_.logW() + count, 0.0);
+	return prediction_time;
+}
+
+void PFLocalizationPDF::predict(const CActionRobotMovement2D& movement)
+{
+	double* x = arena_.x();
+	double* y = arena_.y();
+	double* phi = arena_.phi();
+
+	movement.prepareFastDrawSingleSamples();
+	mrpt::poses::CPose2D incr;
+	for (size_t i = 0; i < arena_.size(); i++)
+	{
+		movement.fastDrawSingleSample(incr);
+		const double c = std::cos(phi[i]), s = std::sin(phi[i]);
+		x[i] += c * incr.x() - s * incr.y();
+		y[i] += s * incr.x() + c * incr.y();
+		phi[i] = mrpt::math::wrapToPi(phi[i] + incr.phi());
+	}
+}
+
+size_t PFLocalizationPDF::countBins()
+{
+	const size_t count = arena_.size();
+	const auto& kld = options.KLD_params;
+	size_t table_size = 64;
+	while (table_size < 2 * count) table_size *= 2;
+	if (bins_.size() < table_size) bins_.resize(table_size);
+	const uint64_t EMPTY = ~uint64_t(0);
+	std::fill(bins_.begin(), bins_.end(), EMPTY);
+	const size_t mask = bins_.size() - 1;
+
+	// 21 bits per coordinate, the top bit is never set
+	const auto bin = [](double v, double size) {
+		return static_cast<uint64_t>(
+				   static_cast<int64_t>(std::floor(v / size))) &
+			0x1fffff;
+	};
+
+	size_t K = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint64_t key = (bin(arena_.x()[i], kld.KLD_binSize_XY) << 42) |
+			(bin(arena_.y()[i], kld.KLD_binSize_XY) << 21) |
+			bin(arena_.phi()[i], kld.KLD_binSize_PHI);
+		size_t h =
+			static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+		while (bins_[h] != EMPTY && bins_[h] != key) h = (h + 1) & mask;
+		if (bins_[h] == EMPTY)
+		{
+			bins_[h] = key;
+			K++;
+		}
+	}
+	return K;
+}
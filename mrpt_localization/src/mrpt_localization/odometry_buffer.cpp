@@ -0,0 +1,109 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt_localization/odometry_buffer.h>
+
+#include <algorithm>
+
+using mrpt::poses::CPose2D;
+using mrpt::system::TTimeStamp;
+
+void OdometryBuffer::insert(TTimeStamp time, const CPose2D& pose)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!samples_.empty() && time <= samples_.back().time)
+	{
+		if (time == samples_.back().time) return;
+		samples_.clear();
+	}
+	samples_.push_back({time, pose});
+
+	while (samples_.size() > capacity_ ||
+		   mrpt::system::timeDifference(samples_.front().time, time) >
+			   max_age)
+		samples_.pop_front();
+}
+
+bool OdometryBuffer::interpolate(TTimeStamp time, CPose2D& pose) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (samples_.empty() || time < samples_.front().time) return false;
+
+	auto it = std::lower_bound(
+		samples_.begin(), samples_.end(), time,
+		[](const Sample& s, TTimeStamp t) { return s.time < t; });
+	if (it != samples_.end() && it->time == time)
+	{
+		pose = it->pose;
+		return true;
+	}
+
+	// Past the newest sample, extrapolate from the last two ones
+	if (it == samples_.end())
+	{
+		if (mrpt::system::timeDifference(samples_.back().time, time) >
+			max_extrapolation)
+			return false;
+		if (samples_.size() == 1)
+		{
+			pose = samples_.back().pose;
+			return true;
+		}
+		it = samples_.end() - 1;
+	}
+
+	const Sample& a = *(it - 1);
+	const Sample& b = *it;
+	const double dt = mrpt::system::timeDifference(a.time, b.time);
+	const double s =
+		dt > 0 ? mrpt::system::timeDifference(a.time, time) / dt : 1.0;
+	const double dphi = mrpt::math::wrapToPi(b.pose.phi() - a.pose.phi());
+	pose = CPose2D(
+		a.pose.x() + s * (b.pose.x() - a.pose.x()),
+		a.pose.y() + s * (b.pose.y() - a.pose.y()),
+		mrpt::math::wrapToPi(a.pose.phi() + s * dphi));
+	return true;
+}
+
+void OdometryBuffer::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	samples_.clear();
+}
+
+bool OdometryBuffer::empty() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return samples_.empty();
+}
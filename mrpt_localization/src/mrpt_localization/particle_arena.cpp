@@ -0,0 +1,107 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt_localization/particle_arena.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+void ParticleArena::reserve(size_t capacity)
+{
+	if (capacity <= this->capacity()) return;
+	front_.resize(capacity);
+	back_.resize(capacity);
+	cumulative_.resize(capacity);
+	indices_.resize(capacity);
+}
+
+void ParticleArena::resize(size_t n)
+{
+	reserve(n);
+	size_ = n;
+}
+
+const size_t* ParticleArena::select(
+	size_t count, Resampling method, mrpt::random::CRandomGenerator& rng)
+{
+	reserve(count);
+	if (size_ == 0 || count == 0) return indices_.data();
+
+	const double* log_w = front_.log_w.data();
+	const double max_log_w = *std::max_element(log_w, log_w + size_);
+	double total = 0;
+	for (size_t i = 0; i < size_; i++)
+	{
+		total += std::exp(log_w[i] - max_log_w);
+		cumulative_[i] = total;
+	}
+
+	// Both methods take one sample in each of count equal intervals of the
+	// cumulative weight, so the samples come out sorted
+	const double step = total / count;
+	const double offset = rng.drawUniform(0.0, step);
+	size_t i = 0;
+	for (size_t k = 0; k < count; k++)
+	{
+		const double target = k * step +
+			(method == Resampling::STRATIFIED ? rng.drawUniform(0.0, step)
+											  : offset);
+		while (i + 1 < size_ && cumulative_[i] < target) i++;
+		indices_[k] = i;
+	}
+	return indices_.data();
+}
+
+void ParticleArena::gather(const size_t* indices, size_t count)
+{
+	reserve(count);
+	for (size_t k = 0; k < count; k++)
+	{
+		const size_t i = indices[k];
+		back_.x[k] = front_.x[i];
+		back_.y[k] = front_.y[i];
+		back_.phi[k] = front_.phi[i];
+		back_.log_w[k] = front_.log_w[i];
+	}
+	std::swap(front_, back_);
+	back_size_ = size_;
+	size_ = count;
+}
+
+void ParticleArena::restore()
+{
+	std::swap(front_, back_);
+	std::swap(size_, back_size_);
+}
@@ -0,0 +1,208 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt_localization/particle_clusterer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Cell coordinates are packed in 21 bits each for x and y, and 22 for yaw
+uint64_t ParticleClusterer::key(int64_t x, int64_t y, int64_t phi) const
+{
+	phi = (phi % num_phi_bins_ + num_phi_bins_) % num_phi_bins_;
+	return (static_cast<uint64_t>(x & 0x1FFFFF) << 43) |
+		(static_cast<uint64_t>(y & 0x1FFFFF) << 22) |
+		static_cast<uint64_t>(phi);
+}
+
+int64_t ParticleClusterer::find(uint64_t key) const
+{
+	const uint64_t mask = hash_keys_.size() - 1;
+	for (uint64_t h = (key * 0x9E3779B97F4A7C15ull) >> (64 - hash_bits_);;
+		 h = (h + 1) & mask)
+	{
+		if (hash_keys_[h] == key) return hash_bins_[h];
+		if (hash_keys_[h] == EMPTY) return -1;
+	}
+}
+
+uint32_t ParticleClusterer::insert(uint64_t key)
+{
+	const uint64_t mask = hash_keys_.size() - 1;
+	for (uint64_t h = (key * 0x9E3779B97F4A7C15ull) >> (64 - hash_bits_);;
+		 h = (h + 1) & mask)
+	{
+		if (hash_keys_[h] == key) return hash_bins_[h];
+		if (hash_keys_[h] == EMPTY)
+		{
+			hash_keys_[h] = key;
+			hash_bins_[h] = bin_keys_.size();
+			bin_keys_.push_back(key);
+			parent_.push_back(hash_bins_[h]);
+			return hash_bins_[h];
+		}
+	}
+}
+
+uint32_t ParticleClusterer::root(uint32_t bin)
+{
+	while (parent_[bin] != bin)
+	{
+		parent_[bin] = parent_[parent_[bin]];  // path halving
+		bin = parent_[bin];
+	}
+	return bin;
+}
+
+void ParticleClusterer::cluster(
+	const mrpt::poses::CPosePDFParticles::CParticleList& particles,
+	std::vector<Cluster>& clusters)
+{
+	clusters.clear();
+	boxes_.clear();
+	if (particles.empty() || max_clusters == 0) return;
+
+	// Hash table with a load factor of at most 0.5
+	num_phi_bins_ = std::max(
+		1, static_cast<int>(std::ceil(2 * M_PI / bin_size_phi)));
+	hash_bits_ = 1;
+	while ((size_t(1) << hash_bits_) < 2 * particles.size()) hash_bits_++;
+	hash_keys_.assign(size_t(1) << hash_bits_, EMPTY);
+	hash_bins_.resize(hash_keys_.size());
+	bin_keys_.clear();
+	parent_.clear();
+
+	double max_log_w = -std::numeric_limits<double>::infinity();
+	particle_bin_.resize(particles.size());
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		const auto& p = particles[i].d;
+		particle_bin_[i] = insert(key(
+			static_cast<int64_t>(std::floor(p.x / bin_size_xy)),
+			static_cast<int64_t>(std::floor(p.y / bin_size_xy)),
+			static_cast<int64_t>(
+				std::floor(mrpt::math::wrapTo2Pi(p.phi) / bin_size_phi))));
+		max_log_w = std::max(max_log_w, particles[i].log_w);
+	}
+
+	// Merge every bin with its neighbors; half of the 26 of them suffice, as
+	// the other half does the same from the other side
+	for (uint32_t b = 0; b < bin_keys_.size(); b++)
+	{
+		const uint64_t k = bin_keys_[b];
+		const auto coordinate = [](uint64_t bits) {
+			const int64_t v = static_cast<int64_t>(bits & 0x1FFFFF);
+			return v & 0x100000 ? v - 0x200000 : v;
+		};
+		const int64_t x = coordinate(k >> 43), y = coordinate(k >> 22);
+		const int64_t phi = static_cast<int64_t>(k & 0x3FFFFF);
+		for (int dx = 0; dx <= 1; dx++)
+			for (int dy = dx ? -1 : 0; dy <= 1; dy++)
+				for (int dphi = (dx || dy) ? -1 : 1; dphi <= 1; dphi++)
+				{
+					const int64_t n = find(key(x + dx, y + dy, phi + dphi));
+					if (n < 0) continue;
+					const uint32_t ra = root(b), rb = root(n);
+					if (ra != rb) parent_[std::max(ra, rb)] = std::min(ra, rb);
+				}
+	}
+
+	// Weighted moments of each cluster, as in the pose statistics of the
+	// whole filter
+	bin_cluster_.assign(bin_keys_.size(), -1);
+	moments_.clear();
+	double total_w = 0;
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		const uint32_t r = root(particle_bin_[i]);
+		if (bin_cluster_[r] < 0)
+		{
+			bin_cluster_[r] = moments_.size();
+			moments_.emplace_back();
+			moments_.back().ref = particles[i].d;
+			const auto& p = particles[i].d;
+			moments_.back().box = {p.x, p.x, p.y, p.y};
+		}
+		Moments& m = moments_[bin_cluster_[r]];
+		const auto& p = particles[i].d;
+		m.box.x_min = std::min(m.box.x_min, p.x);
+		m.box.x_max = std::max(m.box.x_max, p.x);
+		m.box.y_min = std::min(m.box.y_min, p.y);
+		m.box.y_max = std::max(m.box.y_max, p.y);
+		const double w = std::exp(particles[i].log_w - max_log_w);
+		const double dx = p.x - m.ref.x;
+		const double dy = p.y - m.ref.y;
+		const double da = mrpt::math::wrapToPi(p.phi - m.ref.phi);
+		m.sw += w;
+		m.sx += w * dx, m.sy += w * dy, m.sa += w * da;
+		m.sxx += w * dx * dx, m.syy += w * dy * dy, m.saa += w * da * da;
+		m.sxy += w * dx * dy, m.sxa += w * dx * da, m.sya += w * dy * da;
+		m.sin_sum += w * std::sin(p.phi);
+		m.cos_sum += w * std::cos(p.phi);
+		m.count++;
+		total_w += w;
+	}
+
+	for (const auto& m : moments_) boxes_.push_back(m.box);
+
+	order_.resize(moments_.size());
+	for (uint32_t c = 0; c < order_.size(); c++) order_[c] = c;
+	const size_t n = std::min(max_clusters, order_.size());
+	std::partial_sort(
+		order_.begin(), order_.begin() + n, order_.end(),
+		[this](uint32_t a, uint32_t b) {
+			return moments_[a].sw > moments_[b].sw;
+		});
+
+	clusters.resize(n);
+	for (size_t c = 0; c < n; c++)
+	{
+		const Moments& m = moments_[order_[c]];
+		const double sw = m.sw;
+		const double mx = m.sx / sw, my = m.sy / sw, ma = m.sa / sw;
+		Cluster& cl = clusters[c];
+		cl.weight = sw / total_w;
+		cl.num_particles = m.count;
+		cl.mean = mrpt::poses::CPose2D(
+			m.ref.x + mx, m.ref.y + my, std::atan2(m.sin_sum, m.cos_sum));
+		auto& cov = cl.cov;
+		cov(0, 0) = m.sxx / sw - mx * mx;
+		cov(1, 1) = m.syy / sw - my * my;
+		cov(2, 2) = m.saa / sw - ma * ma;
+		cov(0, 1) = cov(1, 0) = m.sxy / sw - mx * my;
+		cov(0, 2) = cov(2, 0) = m.sxa / sw - mx * ma;
+		cov(1, 2) = cov(2, 1) = m.sya / sw - my * ma;
+	}
+}
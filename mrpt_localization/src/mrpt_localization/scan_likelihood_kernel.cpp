@@ -0,0 +1,422 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/obs/CObservation2DRangeScan.h>
+#include <mrpt_localization/scan_likelihood_kernel.h>
+
+#include <algorithm>
+#include <type_traits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__GNUC__) || defined(__clang__))
+#define SCAN_KERNEL_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define SCAN_KERNEL_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+constexpr int TILE_SHIFT = LikelihoodField::TILE_SHIFT;
+constexpr int TILE_MASK = LikelihoodField::TILE_SIZE - 1;
+
+/**
+ * Common inputs of all the implementations. Each beam adds the value of its
+ * cell, or out_of_cell if it is out of the map, to a sum S, and the result
+ * is offset * num_beams + scale * S: for quantized fields out-of-map beams
+ * add 0 and the offset is the out-of-map value.
+ **/
+struct KernelArgs
+{
+	const ParticlesSoA& p;
+	const float* bx;
+	const float* by;
+	size_t num_beams;
+	const float* cells;
+	const uint8_t* qcells;
+	int size_x;
+	int size_y;
+	int tiles_x;
+	float x_min;
+	float y_min;
+	float inv_res;
+	float out_of_map;
+	float out_of_cell;
+	double offset;
+	double scale;
+	double* out;
+
+	KernelArgs(
+		const ParticlesSoA& _p, const std::vector<float>& _bx,
+		const std::vector<float>& _by, const LikelihoodField& lf, double* _out)
+		: p(_p),
+		  bx(_bx.data()),
+		  by(_by.data()),
+		  num_beams(_bx.size()),
+		  cells(lf.data()),
+		  qcells(lf.quantizedData()),
+		  size_x(lf.sizeX()),
+		  size_y(lf.sizeY()),
+		  tiles_x(lf.tilesX()),
+		  x_min(lf.xMin()),
+		  y_min(lf.yMin()),
+		  inv_res(1.0f / lf.resolution()),
+		  out_of_map(lf.outOfMapValue()),
+		  out_of_cell(lf.isQuantized() ? 0 : lf.outOfMapValue()),
+		  offset(lf.isQuantized() ? lf.outOfMapValue() : 0),
+		  scale(lf.isQuantized() ? lf.quantizationScale() : 1),
+		  out(_out)
+	{
+	}
+
+	void store(size_t i, double sum) const
+	{
+		out[i] = offset * num_beams + scale * sum;
+	}
+};
+
+/** Sums are exact integers for quantized cells */
+template <typename Cell>
+using SumType =
+	std::conditional_t<std::is_same_v<Cell, uint8_t>, uint32_t, float>;
+
+template <typename Cell>
+void evaluateScalar(const KernelArgs& a, const Cell* cells, size_t first)
+{
+	const float fsize_x = static_cast<float>(a.size_x);
+	const float fsize_y = static_cast<float>(a.size_y);
+	const auto out_of_cell = static_cast<SumType<Cell>>(a.out_of_cell);
+	for (size_t i = first; i < a.p.size(); i++)
+	{
+		const float px = (a.p.x[i] - a.x_min) * a.inv_res;
+		const float py = (a.p.y[i] - a.y_min) * a.inv_res;
+		const float c = a.p.cos_phi[i] * a.inv_res;
+		const float s = a.p.sin_phi[i] * a.inv_res;
+
+		SumType<Cell> acc = 0;
+		for (size_t j = 0; j < a.num_beams; j++)
+		{
+			const float fx = px + c * a.bx[j] - s * a.by[j];
+			const float fy = py + s * a.bx[j] + c * a.by[j];
+			if (fx >= 0 && fy >= 0 && fx < fsize_x && fy < fsize_y)
+			{
+				const int cx = static_cast<int>(fx);
+				const int cy = static_cast<int>(fy);
+				const size_t tile =
+					static_cast<size_t>(cy >> TILE_SHIFT) * a.tiles_x +
+					(cx >> TILE_SHIFT);
+				acc += cells
+					[(tile << (2 * TILE_SHIFT)) |
+					 LikelihoodField::spreadBits(cx & TILE_MASK) |
+					 (LikelihoodField::spreadBits(cy & TILE_MASK) << 1)];
+			}
+			else
+				acc += out_of_cell;
+		}
+		a.store(i, acc);
+	}
+}
+
+#ifdef SCAN_KERNEL_HAVE_AVX2
+bool cpuHasAVX2()
+{
+	static const bool has =
+		__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return has;
+}
+
+/** LikelihoodField::spreadBits() of 8 values */
+__attribute__((target("avx2,fma"))) inline __m256i spreadBitsAVX2(__m256i v)
+{
+	v = _mm256_and_si256(
+		_mm256_or_si256(v, _mm256_slli_epi32(v, 4)),
+		_mm256_set1_epi32(0x0f0f));
+	v = _mm256_and_si256(
+		_mm256_or_si256(v, _mm256_slli_epi32(v, 2)),
+		_mm256_set1_epi32(0x3333));
+	return _mm256_and_si256(
+		_mm256_or_si256(v, _mm256_slli_epi32(v, 1)),
+		_mm256_set1_epi32(0x5555));
+}
+
+/** Processes particles in blocks of 8, returns how many were done */
+template <bool QUANTIZED>
+__attribute__((target("avx2,fma"))) size_t evaluateAVX2(const KernelArgs& a)
+{
+	const size_t N = a.p.size() & ~size_t(7);
+
+	const __m256 x_min = _mm256_set1_ps(a.x_min);
+	const __m256 y_min = _mm256_set1_ps(a.y_min);
+	const __m256 inv_res = _mm256_set1_ps(a.inv_res);
+	const __m256 out_of_map = _mm256_set1_ps(a.out_of_map);
+	const __m256i minus_one = _mm256_set1_epi32(-1);
+	const __m256i size_x = _mm256_set1_epi32(a.size_x);
+	const __m256i size_y = _mm256_set1_epi32(a.size_y);
+	const __m256i tiles_x = _mm256_set1_epi32(a.tiles_x);
+	const __m256i tile_mask = _mm256_set1_epi32(TILE_MASK);
+	const __m256i byte_mask = _mm256_set1_epi32(0xff);
+	const __m256i word_mask = _mm256_set1_epi32(~3);
+
+	for (size_t i = 0; i < N; i += 8)
+	{
+		// Particle poses, in cell units:
+		const __m256 px =
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&a.p.x[i]), x_min), inv_res);
+		const __m256 py =
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&a.p.y[i]), y_min), inv_res);
+		const __m256 c = _mm256_mul_ps(_mm256_loadu_ps(&a.p.cos_phi[i]), inv_res);
+		const __m256 s = _mm256_mul_ps(_mm256_loadu_ps(&a.p.sin_phi[i]), inv_res);
+
+		__m256 acc = _mm256_setzero_ps();
+		__m256i qacc = _mm256_setzero_si256();
+		for (size_t j = 0; j < a.num_beams; j++)
+		{
+			const __m256 bx = _mm256_set1_ps(a.bx[j]);
+			const __m256 by = _mm256_set1_ps(a.by[j]);
+			const __m256 fx = _mm256_fmadd_ps(c, bx, _mm256_fnmadd_ps(s, by, px));
+			const __m256 fy = _mm256_fmadd_ps(s, bx, _mm256_fmadd_ps(c, by, py));
+
+			// Out of range conversions give INT_MIN, hence are out of the map
+			const __m256i cx = _mm256_cvttps_epi32(_mm256_floor_ps(fx));
+			const __m256i cy = _mm256_cvttps_epi32(_mm256_floor_ps(fy));
+			const __m256i inside = _mm256_and_si256(
+				_mm256_and_si256(
+					_mm256_cmpgt_epi32(cx, minus_one),
+					_mm256_cmpgt_epi32(size_x, cx)),
+				_mm256_and_si256(
+					_mm256_cmpgt_epi32(cy, minus_one),
+					_mm256_cmpgt_epi32(size_y, cy)));
+			const __m256i tile = _mm256_add_epi32(
+				_mm256_mullo_epi32(_mm256_srai_epi32(cy, TILE_SHIFT), tiles_x),
+				_mm256_srai_epi32(cx, TILE_SHIFT));
+			const __m256i idx = _mm256_or_si256(
+				_mm256_slli_epi32(tile, 2 * TILE_SHIFT),
+				_mm256_or_si256(
+					spreadBitsAVX2(_mm256_and_si256(cx, tile_mask)),
+					_mm256_slli_epi32(
+						spreadBitsAVX2(_mm256_and_si256(cy, tile_mask)), 1)));
+
+			if constexpr (QUANTIZED)
+			{
+				// There is no byte gather: the aligned 32-bit words holding
+				// the cells are gathered, and the cells shifted down
+				const __m256i words = _mm256_mask_i32gather_epi32(
+					_mm256_setzero_si256(),
+					reinterpret_cast<const int*>(a.qcells),
+					_mm256_and_si256(idx, word_mask), inside, 1);
+				const __m256i shift = _mm256_slli_epi32(
+					_mm256_andnot_si256(word_mask, idx), 3);
+				const __m256i q =
+					_mm256_and_si256(_mm256_srlv_epi32(words, shift), byte_mask);
+				qacc = _mm256_add_epi32(qacc, q);
+			}
+			else
+				acc = _mm256_add_ps(
+					acc,
+					_mm256_mask_i32gather_ps(
+						out_of_map, a.cells, idx, _mm256_castsi256_ps(inside),
+						4));
+		}
+
+		if constexpr (QUANTIZED)
+		{
+			alignas(32) uint32_t sums[8];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(sums), qacc);
+			for (int k = 0; k < 8; k++) a.store(i + k, sums[k]);
+		}
+		else
+		{
+			_mm256_storeu_pd(
+				&a.out[i], _mm256_cvtps_pd(_mm256_castps256_ps128(acc)));
+			_mm256_storeu_pd(
+				&a.out[i + 4], _mm256_cvtps_pd(_mm256_extractf128_ps(acc, 1)));
+		}
+	}
+	return N;
+}
+#endif
+
+#ifdef SCAN_KERNEL_HAVE_NEON
+/** LikelihoodField::spreadBits() of 4 values */
+inline int32x4_t spreadBitsNEON(int32x4_t v)
+{
+	v = vandq_s32(vorrq_s32(v, vshlq_n_s32(v, 4)), vdupq_n_s32(0x0f0f));
+	v = vandq_s32(vorrq_s32(v, vshlq_n_s32(v, 2)), vdupq_n_s32(0x3333));
+	return vandq_s32(vorrq_s32(v, vshlq_n_s32(v, 1)), vdupq_n_s32(0x5555));
+}
+
+/** Processes particles in blocks of 4, returns how many were done. NEON has
+ * no gather instruction, so only the transformation is vectorized. */
+size_t evaluateNEON(const KernelArgs& a)
+{
+	const size_t N = a.p.size() & ~size_t(3);
+
+	const float32x4_t x_min = vdupq_n_f32(a.x_min);
+	const float32x4_t y_min = vdupq_n_f32(a.y_min);
+	const uint32x4_t size_x = vdupq_n_u32(static_cast<uint32_t>(a.size_x));
+	const uint32x4_t size_y = vdupq_n_u32(static_cast<uint32_t>(a.size_y));
+	const int32x4_t tiles_x = vdupq_n_s32(a.tiles_x);
+	const int32x4_t tile_mask = vdupq_n_s32(TILE_MASK);
+
+	int32_t idx[4];
+	uint32_t inside[4];
+	float vals[4];
+
+	for (size_t i = 0; i < N; i += 4)
+	{
+		const float32x4_t px =
+			vmulq_n_f32(vsubq_f32(vld1q_f32(&a.p.x[i]), x_min), a.inv_res);
+		const float32x4_t py =
+			vmulq_n_f32(vsubq_f32(vld1q_f32(&a.p.y[i]), y_min), a.inv_res);
+		const float32x4_t c = vmulq_n_f32(vld1q_f32(&a.p.cos_phi[i]), a.inv_res);
+		const float32x4_t s = vmulq_n_f32(vld1q_f32(&a.p.sin_phi[i]), a.inv_res);
+
+		float32x4_t acc = vdupq_n_f32(0);
+		for (size_t j = 0; j < a.num_beams; j++)
+		{
+			const float32x4_t fx =
+				vmlaq_n_f32(vmlsq_n_f32(px, s, a.by[j]), c, a.bx[j]);
+			const float32x4_t fy =
+				vmlaq_n_f32(vmlaq_n_f32(py, c, a.by[j]), s, a.bx[j]);
+
+			// Negative indices become huge unsigned values:
+			const int32x4_t cx = vcvtmq_s32_f32(fx);
+			const int32x4_t cy = vcvtmq_s32_f32(fy);
+			vst1q_u32(
+				inside,
+				vandq_u32(
+					vcltq_u32(vreinterpretq_u32_s32(cx), size_x),
+					vcltq_u32(vreinterpretq_u32_s32(cy), size_y)));
+			const int32x4_t tile = vmlaq_s32(
+				vshrq_n_s32(cx, TILE_SHIFT), vshrq_n_s32(cy, TILE_SHIFT),
+				tiles_x);
+			vst1q_s32(
+				idx,
+				vorrq_s32(
+					vshlq_n_s32(tile, 2 * TILE_SHIFT),
+					vorrq_s32(
+						spreadBitsNEON(vandq_s32(cx, tile_mask)),
+						vshlq_n_s32(
+							spreadBitsNEON(vandq_s32(cy, tile_mask)), 1))));
+
+			// Sums of quantized cells are exact in floats up to 2^24
+			for (int k = 0; k < 4; k++)
+				vals[k] = !inside[k] ? a.out_of_cell
+					: a.qcells       ? a.qcells[static_cast<uint32_t>(idx[k])]
+									 : a.cells[static_cast<uint32_t>(idx[k])];
+			acc = vaddq_f32(acc, vld1q_f32(vals));
+		}
+
+		float res[4];
+		vst1q_f32(res, acc);
+		for (int k = 0; k < 4; k++) a.store(i + k, res[k]);
+	}
+	return N;
+}
+#endif
+}  // namespace
+
+void ScanLikelihoodKernel::clear()
+{
+	beam_x_.clear();
+	beam_y_.clear();
+}
+
+void ScanLikelihoodKernel::addBeam(float x, float y)
+{
+	beam_x_.push_back(x);
+	beam_y_.push_back(y);
+}
+
+void ScanLikelihoodKernel::addScan(
+	const mrpt::obs::CObservation2DRangeScan& scan, unsigned int decimation)
+{
+	const size_t N = scan.getScanSize();
+
+	size_t num_valid = 0;
+	for (size_t i = 0; i < N; i++)
+		if (scan.getScanRangeValidity(i)) num_valid++;
+
+	// Same decimation than COccupancyGridMap2D::computeLikelihoodField_Thrun()
+	const size_t step = num_valid < 10 ? 1 : std::max(1u, decimation);
+
+	const double ang0 = (scan.rightToLeft ? -0.5 : 0.5) * scan.aperture;
+	const double dA = (N > 1 ? scan.aperture / (N - 1) : 0.0) *
+		(scan.rightToLeft ? 1.0 : -1.0);
+
+	for (size_t i = 0, k = 0; i < N; i++)
+	{
+		if (!scan.getScanRangeValidity(i)) continue;
+		if (k++ % step) continue;
+
+		const double a = ang0 + i * dA;
+		const double r = scan.getScanRange(i);
+		double gx, gy, gz;
+		scan.sensorPose.composePoint(
+			r * std::cos(a), r * std::sin(a), 0, gx, gy, gz);
+		addBeam(static_cast<float>(gx), static_cast<float>(gy));
+	}
+}
+
+void ScanLikelihoodKernel::evaluate(
+	const ParticlesSoA& particles, const LikelihoodField& field,
+	double* log_lik) const
+{
+	const KernelArgs args(particles, beam_x_, beam_y_, field, log_lik);
+
+	size_t done = 0;
+#if defined(SCAN_KERNEL_HAVE_AVX2)
+	if (cpuHasAVX2())
+		done = field.isQuantized() ? evaluateAVX2<true>(args)
+								   : evaluateAVX2<false>(args);
+#elif defined(SCAN_KERNEL_HAVE_NEON)
+	done = evaluateNEON(args);
+#endif
+	if (field.isQuantized())
+		evaluateScalar(args, field.quantizedData(), done);
+	else
+		evaluateScalar(args, field.data(), done);
+}
+
+const char* ScanLikelihoodKernel::implementation()
+{
+#if defined(SCAN_KERNEL_HAVE_AVX2)
+	if (cpuHasAVX2()) return "avx2";
+#elif defined(SCAN_KERNEL_HAVE_NEON)
+	return "neon";
+#endif
+	return "scalar";
+}
@@ -0,0 +1,101 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt_localization/worker_pool.h>
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t num_threads)
+{
+	num_threads = std::max<size_t>(1, num_threads);
+	for (size_t i = 0; i < num_threads; i++)
+		threads_.emplace_back(&WorkerPool::work, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	for (auto& t : threads_) t.join();
+}
+
+size_t WorkerPool::add(std::function<void()> task)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	tasks_.emplace_back();
+	tasks_.back().run = std::move(task);
+	return tasks_.size() - 1;
+}
+
+void WorkerPool::notify(size_t id)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto& task = tasks_.at(id);
+		if (task.queued) return;
+		task.queued = true;
+		// Queued again by work() when it finishes
+		if (task.running) return;
+		ready_.push_back(id);
+	}
+	cv_.notify_one();
+}
+
+void WorkerPool::work()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;)
+	{
+		cv_.wait(lock, [this] { return stop_ || !ready_.empty(); });
+		if (stop_) return;
+		const size_t id = ready_.front();
+		ready_.pop_front();
+		auto& task = tasks_[id];
+		task.queued = false;
+		task.running = true;
+
+		lock.unlock();
+		task.run();
+		lock.lock();
+
+		task.running = false;
+		if (task.queued)
+		{
+			ready_.push_back(id);
+			cv_.notify_one();
+		}
+	}
+}
@@ -0,0 +1,429 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+/**
+ * Offline benchmark of the localization: replays a rawlog through
+ * PFLocalizationCore::observation() as fast as possible, and reports the
+ * update rate, the time of each stage of the updates, the particle counts
+ * and, given a reference trajectory, the pose error, as JSON. E.g.:
+ *
+ *   mrpt_localization_benchmark -c tutorial/pf-localization.ini \
+ *     -r tutorial/driving_in_office.rawlog -m tutorial/map.simplemap -s 1
+ **/
+
+#include <mrpt/3rdparty/tclap/CmdLine.h>
+#include <mrpt/core/bits_math.h>
+#include <mrpt/io/CFileGZInputStream.h>
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt/obs/CActionRobotMovement2D.h>
+#include <mrpt/obs/CObservationOdometry.h>
+#include <mrpt/obs/CRawlog.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt/serialization/CArchive.h>
+#include <mrpt/system/CTicTac.h>
+#include <mrpt/system/datetime.h>
+#include <mrpt/system/filesystem.h>
+#include <mrpt_localization/mrpt_localization.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using mrpt::obs::CActionRobotMovement2D;
+using mrpt::obs::CObservation;
+using mrpt::obs::CRawlog;
+
+namespace
+{
+std::string jsonString(const std::string& s)
+{
+	std::string out = "\"";
+	for (const char c : s)
+	{
+		if (c == '"' || c == '\\') out += '\\';
+		out += c;
+	}
+	return out + '"';
+}
+
+/** Samples of a quantity, summarized by their mean and percentiles */
+class Samples
+{
+   public:
+	void add(double v) { values_.push_back(v); }
+	size_t size() const { return values_.size(); }
+
+	double mean() const
+	{
+		double sum = 0;
+		for (const double v : values_) sum += v;
+		return values_.empty() ? 0 : sum / values_.size();
+	}
+
+	/** p in [0, 1], nearest rank */
+	double percentile(double p)
+	{
+		if (values_.empty()) return 0;
+		const double rank = std::ceil(p * values_.size());
+		const size_t k = std::min(
+			values_.size() - 1,
+			rank > 1 ? static_cast<size_t>(rank) - 1 : size_t(0));
+		std::nth_element(values_.begin(), values_.begin() + k, values_.end());
+		return values_[k];
+	}
+
+	double max() const
+	{
+		return values_.empty()
+			? 0
+			: *std::max_element(values_.begin(), values_.end());
+	}
+
+	double rms() const
+	{
+		double sum = 0;
+		for (const double v : values_) sum += v * v;
+		return values_.empty() ? 0 : std::sqrt(sum / values_.size());
+	}
+
+	/** JSON object with the summary, values scaled by factor */
+	std::string json(double factor = 1)
+	{
+		return mrpt::format(
+			"{\"count\": %zu, \"mean\": %.6g, \"p50\": %.6g, \"p95\": %.6g, "
+			"\"max\": %.6g}",
+			size(), factor * mean(), factor * percentile(0.5),
+			factor * percentile(0.95), factor * max());
+	}
+
+   private:
+	std::vector<double> values_;
+};
+
+/**
+ * Reference trajectory, a text file with rows of "timestamp x y phi", the
+ * timestamps in seconds (mrpt::Clock::toDouble()); lines starting with '%' or
+ * '#' are comments
+ **/
+class ReferenceTrajectory
+{
+   public:
+	bool load(const std::string& file)
+	{
+		std::ifstream f(file);
+		if (!f) return false;
+		std::string line;
+		while (std::getline(f, line))
+		{
+			if (line.empty() || line[0] == '%' || line[0] == '#') continue;
+			std::istringstream row(line);
+			double t;
+			mrpt::math::TPose2D p;
+			if (!(row >> t >> p.x >> p.y >> p.phi)) continue;
+			if (!times_.empty() && t <= times_.back()) continue;
+			times_.push_back(t);
+			poses_.push_back(p);
+		}
+		return !times_.empty();
+	}
+
+	/** Pose at time t, false if t is outside of the trajectory */
+	bool interpolate(double t, mrpt::math::TPose2D& pose) const
+	{
+		const auto it = std::lower_bound(times_.begin(), times_.end(), t);
+		if (it == times_.end()) return false;
+		const size_t i = it - times_.begin();
+		if (times_[i] == t)
+		{
+			pose = poses_[i];
+			return true;
+		}
+		if (i == 0) return false;
+
+		const double s = (t - times_[i - 1]) / (times_[i] - times_[i - 1]);
+		const auto& a = poses_[i - 1];
+		const auto& b = poses_[i];
+		pose.x = a.x + s * (b.x - a.x);
+		pose.y = a.y + s * (b.y - a.y);
+		pose.phi = mrpt::math::wrapToPi(
+			a.phi + s * mrpt::math::wrapToPi(b.phi - a.phi));
+		return true;
+	}
+
+   private:
+	std::vector<double> times_;
+	std::vector<mrpt::math::TPose2D> poses_;
+};
+
+class PFLocalizationBenchmark : public PFLocalization
+{
+   public:
+	PFLocalizationBenchmark() : PFLocalization(new Parameters(this)) {}
+	~PFLocalizationBenchmark() { delete param_; }
+
+	std::string ini_file, rawlog_file, map_file, reference_file;
+	std::vector<double> init_pose;	///< x, y, phi; empty: from the ini file
+	double init_std_xy = 0.20;	///< m
+	double init_std_phi = 0.10;	 ///< rad
+	size_t max_entries = 0;	 ///< 0: the whole rawlog
+
+	/** Replays the rawlog, false on errors */
+	bool run();
+	/** Writes the results as JSON */
+	void writeJSON(std::ostream& out);
+
+   private:
+	ReferenceTrajectory reference_;
+	Samples observation_times_;	///< PFLocalizationCore::observation() (s)
+	Samples update_times_;	 ///< PF update (s)
+	Samples prediction_times_, weighting_times_,
+		resampling_times_;	///< update stages (s)
+	Samples evaluations_;  ///< scan kernel beam-particle evaluations
+	Samples particles_, ess_;
+	Samples error_xy_, error_phi_;	///< against the reference (m, rad)
+	size_t num_entries_ = 0, num_observations_ = 0, num_updates_ = 0;
+	double replay_time_ = 0;  ///< wall time of the replay (s)
+	double filter_time_ = 0;  ///< time spent in observation() (s)
+
+	void process(
+		const CSensoryFrame::Ptr& sf,
+		const mrpt::poses::CPose2D& odometry);
+};
+
+bool PFLocalizationBenchmark::run()
+{
+	param_->ini_file = ini_file;
+	param_->map_file = map_file;
+	param_->gui_mrpt = false;
+	init();
+	if (init_pose.size() == 3)
+	{
+		auto cov = mrpt::math::CMatrixDouble33::Zero();
+		cov(0, 0) = cov(1, 1) = mrpt::square(init_std_xy);
+		cov(2, 2) = mrpt::square(init_std_phi);
+		initial_pose_ = mrpt::poses::CPosePDFGaussian(
+			mrpt::poses::CPose2D(init_pose[0], init_pose[1], init_pose[2]),
+			cov);
+	}
+	if (!reference_file.empty() && !reference_.load(reference_file))
+	{
+		std::cerr << "Could not read the reference trajectory "
+				  << reference_file << std::endl;
+		return false;
+	}
+
+	mrpt::io::CFileGZInputStream rawlog_stream;
+	if (!rawlog_stream.open(rawlog_file))
+	{
+		std::cerr << "Could not open the rawlog " << rawlog_file << std::endl;
+		return false;
+	}
+	auto rs = mrpt::serialization::archiveFrom(rawlog_stream);
+
+	// Rawlogs of (action, sensory frame) pairs provide odometry increments,
+	// the ones of observations absolute odometry readings
+	mrpt::poses::CPose2D odometry;
+	size_t entry = 0;
+	mrpt::system::CTicTac replay_timer;
+	for (;;)
+	{
+		if (max_entries && num_entries_ >= max_entries) break;
+		CActionCollection::Ptr action;
+		CSensoryFrame::Ptr sf;
+		CObservation::Ptr obs;
+		if (!CRawlog::getActionObservationPairOrObservation(
+				rs, action, sf, obs, entry))
+			break;
+		num_entries_++;
+
+		if (action)
+		{
+			if (const auto move = action->getBestMovementEstimation())
+				odometry = odometry + move->rawOdometryIncrementReading;
+		}
+		if (sf && sf->size()) process(sf, odometry);
+		if (!obs) continue;
+		if (const auto odo =
+				std::dynamic_pointer_cast<CObservationOdometry>(obs))
+		{
+			odometry = odo->odometry;
+			continue;
+		}
+		sf = CSensoryFrame::Create();
+		sf->insert(obs);
+		process(sf, odometry);
+	}
+	replay_time_ = replay_timer.Tac();
+	return true;
+}
+
+void PFLocalizationBenchmark::process(
+	const CSensoryFrame::Ptr& sf, const mrpt::poses::CPose2D& odometry)
+{
+	auto odo = CObservationOdometry::Create();
+	odo->timestamp = sf->getObservationByIndex(0)->timestamp;
+	odo->odometry = odometry;
+
+	const size_t updates = update_counter_;
+	mrpt::system::CTicTac timer;
+	observation(sf, odo);
+	const double t = timer.Tac();
+	num_observations_++;
+	filter_time_ += t;
+	observation_times_.add(t);
+	if (update_counter_ == updates) return;	 // skipped
+	num_updates_++;
+
+	update_times_.add(update_time_);
+	const auto& stats = pdf_.last_update_stats;
+	prediction_times_.add(stats.prediction_time);
+	weighting_times_.add(stats.weighting_time);
+	resampling_times_.add(update_diagnostics_.resampling_time);
+	if (stats.used_scan_kernel) evaluations_.add(stats.num_evaluations);
+	particles_.add(pose_stats_.num_particles);
+	ess_.add(pose_stats_.ess);
+
+	mrpt::math::TPose2D ref;
+	if (reference_.interpolate(
+			mrpt::Clock::toDouble(odo->timestamp), ref))
+	{
+		const auto& est = pose_stats_.dominantPose();
+		error_xy_.add(std::hypot(est.x() - ref.x, est.y() - ref.y));
+		error_phi_.add(std::abs(mrpt::math::wrapToPi(est.phi() - ref.phi)));
+	}
+}
+
+void PFLocalizationBenchmark::writeJSON(std::ostream& out)
+{
+	const auto& est = pose_stats_.dominantPose();
+	out << "{\n"
+		<< "  \"rawlog\": " << jsonString(rawlog_file) << ",\n"
+		<< "  \"ini_file\": " << jsonString(ini_file) << ",\n"
+		<< "  \"entries\": " << num_entries_ << ",\n"
+		<< "  \"observations\": " << num_observations_ << ",\n"
+		<< "  \"updates\": " << num_updates_ << ",\n"
+		<< mrpt::format(
+			   "  \"replay_time_s\": %.6g,\n"
+			   "  \"filter_time_s\": %.6g,\n"
+			   "  \"updates_per_s\": %.6g,\n",
+			   replay_time_, filter_time_,
+			   filter_time_ > 0 ? num_updates_ / filter_time_ : 0.0)
+		<< "  \"observation_ms\": " << observation_times_.json(1e3) << ",\n"
+		<< "  \"update_ms\": " << update_times_.json(1e3) << ",\n"
+		<< "  \"prediction_ms\": " << prediction_times_.json(1e3) << ",\n"
+		<< "  \"weighting_ms\": " << weighting_times_.json(1e3) << ",\n"
+		<< "  \"resampling_ms\": " << resampling_times_.json(1e3) << ",\n"
+		<< "  \"scan_kernel_evaluations\": " << evaluations_.json() << ",\n"
+		<< "  \"particles\": " << particles_.json() << ",\n"
+		<< "  \"ess\": " << ess_.json() << ",\n"
+		<< mrpt::format(
+			   "  \"final_pose\": [%.6f, %.6f, %.6f],\n", est.x(), est.y(),
+			   est.phi());
+	if (error_xy_.size())
+		out << mrpt::format(
+				   "  \"error_xy_rmse_m\": %.6g,\n"
+				   "  \"error_phi_rmse_rad\": %.6g,\n",
+				   error_xy_.rms(), error_phi_.rms())
+			<< "  \"error_xy_m\": " << error_xy_.json() << ",\n"
+			<< "  \"error_phi_rad\": " << error_phi_.json() << ",\n";
+	out << "  \"reference_poses\": " << error_xy_.size() << "\n}\n";
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+	TCLAP::CmdLine cmd(
+		"Replays a rawlog through the particle filter localization as fast as "
+		"possible and reports its performance as JSON",
+		' ', "");
+	TCLAP::ValueArg<std::string> arg_ini(
+		"c", "config", "Configuration file, like tutorial/pf-localization.ini",
+		true, "", "file.ini", cmd);
+	TCLAP::ValueArg<std::string> arg_rawlog(
+		"r", "rawlog", "Rawlog to replay", true, "", "file.rawlog", cmd);
+	TCLAP::ValueArg<std::string> arg_map(
+		"m", "map", "Map file, instead of the one of the configuration file",
+		false, "", "file.simplemap", cmd);
+	TCLAP::ValueArg<std::string> arg_reference(
+		"g", "reference",
+		"Reference trajectory, rows of \"timestamp x y phi\"", false, "",
+		"file.txt", cmd);
+	TCLAP::ValueArg<std::string> arg_init(
+		"i", "init-pose",
+		"Initial pose \"x y phi\" (m, m, rad), instead of the init_PDF_* area "
+		"of the configuration file",
+		false, "", "\"x y phi\"", cmd);
+	TCLAP::ValueArg<std::string> arg_json(
+		"o", "output", "JSON output file, the standard output by default",
+		false, "", "file.json", cmd);
+	TCLAP::ValueArg<unsigned int> arg_seed(
+		"s", "seed", "Seed of the random generator, for repeatable runs",
+		false, 0, "seed", cmd);
+	TCLAP::ValueArg<size_t> arg_max_entries(
+		"n", "max-entries", "Stop after this number of rawlog entries", false,
+		0, "N", cmd);
+	if (!cmd.parse(argc, argv)) return 0;	// --help
+
+	mrpt::random::getRandomGenerator().randomize(arg_seed.getValue());
+
+	PFLocalizationBenchmark benchmark;
+	benchmark.ini_file = arg_ini.getValue();
+	benchmark.rawlog_file = arg_rawlog.getValue();
+	benchmark.map_file = arg_map.getValue();
+	benchmark.reference_file = arg_reference.getValue();
+	benchmark.max_entries = arg_max_entries.getValue();
+	if (arg_init.isSet())
+	{
+		std::istringstream init(arg_init.getValue());
+		double v;
+		while (init >> v) benchmark.init_pose.push_back(v);
+		if (benchmark.init_pose.size() != 3)
+		{
+			std::cerr << "--init-pose expects \"x y phi\"" << std::endl;
+			return 1;
+		}
+	}
+
+	if (!benchmark.run()) return 1;
+
+	if (arg_json.isSet())
+	{
+		std::ofstream out(arg_json.getValue());
+		benchmark.writeJSON(out);
+	}
+	else
+		benchmark.writeJSON(std::cout);
+	return 0;
+}
@@ -31,7 +31,8 @@
  **                       *
  ***********************************************************************************/
 
-#include <geometry_msgs/PoseArray.h>
+#include <mrpt/core/format.h>
+#include <mrpt/math/wrap2pi.h>
 #include <mrpt/obs/CObservationBeaconRanges.h>
 #include <mrpt/obs/CObservationRobotPose.h>
 #include <mrpt/ros1bridge/laser_scan.h>
@@ -43,6 +44,10 @@
 #include <pose_cov_ops/pose_cov_ops.h>
 
 #include <boost/interprocess/sync/scoped_lock.hpp>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
 
 using namespace mrpt::obs;
 using namespace mrpt::system;
@@ -50,11 +55,94 @@ using namespace mrpt::system;
 #include <mrpt/maps/COccupancyGridMap2D.h>
 
 #include "mrpt_localization_node.h"
+#include "mrpt_localization_node_defaults.h"
 using mrpt::maps::COccupancyGridMap2D;
 
+/**
+ * Copies the parameters of the private namespace that the robot does not
+ * set into its own private namespace, so that the robots of a multi-robot
+ * server only need to set what is specific to them
+ **/
+static void inheritParameters(
+	ros::NodeHandle& private_nh, const std::set<std::string>& skip,
+	const std::string& robot)
+{
+	XmlRpc::XmlRpcValue params;
+	if (!ros::param::get(private_nh.getNamespace(), params) ||
+		params.getType() != XmlRpc::XmlRpcValue::TypeStruct)
+		return;
+	for (auto it = params.begin(); it != params.end(); ++it)
+	{
+		if (skip.count(it->first)) continue;
+		const std::string key = robot + "/" + it->first;
+		if (!private_nh.hasParam(key)) private_nh.setParam(key, it->second);
+	}
+	if (!private_nh.hasParam(robot + "/tf_prefix"))
+		private_nh.setParam(robot + "/tf_prefix", robot);
+}
+
+/**
+ * Localizes the robots of ~robots in one process, each of them in its own
+ * namespace. Their filters share the map of the first one, and they are
+ * updated by a pool of ~worker_threads threads.
+ **/
+static int runMultiRobot(const std::vector<std::string>& robots)
+{
+	ros::NodeHandle private_nh("~");
+	// Each robot needs its own trace file
+	std::set<std::string> skip = {
+		"robots", "worker_threads", "diagnostics_trace_file"};
+	for (const auto& robot : robots)
+		skip.insert(robot.substr(0, robot.find('/')));
+	for (const auto& robot : robots)
+		inheritParameters(private_nh, skip, robot);
+
+	int num_threads;
+	private_nh.param<int>(
+		"worker_threads", num_threads,
+		std::min<int>(robots.size(), std::thread::hardware_concurrency()));
+	double rate;
+	private_nh.param<double>(
+		"rate", rate, MRPT_LOCALIZATION_NODE_DEFAULT_RATE);
+	ROS_INFO(
+		"Multi-robot server: %zu robots, %i worker threads", robots.size(),
+		num_threads);
+
+	// The pool is destroyed first: no update runs once the filters are gone
+	std::vector<std::unique_ptr<PFLocalizationNode>> nodes;
+	WorkerPool pool(std::max(1, num_threads));
+	for (const auto& robot : robots)
+	{
+		ros::NodeHandle nh(robot);
+		const PFLocalizationNode* map_owner =
+			nodes.empty() ? nullptr : nodes.front().get();
+		nodes.push_back(
+			std::make_unique<PFLocalizationNode>(nh, robot, map_owner, &pool));
+		// The first one waits for the map the others share
+		nodes.back()->init();
+		if (!ros::ok()) return 0;
+	}
+
+	for (ros::Rate r(rate); ros::ok();)
+	{
+		for (auto& node : nodes) node->loopOnce();
+		ros::spinOnce();
+		r.sleep();
+	}
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
 	ros::init(argc, argv, "localization");
+
+	// Several robots in one process, if ~robots lists their namespaces
+	std::string robots_param;
+	ros::NodeHandle("~").getParam("robots", robots_param);
+	std::vector<std::string> robots;
+	mrpt::system::tokenize(robots_param, " ,\t\n", robots);
+	if (!robots.empty()) return runMultiRobot(robots);
+
 	ros::NodeHandle nh;
 	PFLocalizationNode my_node(nh);
 	my_node.init();
@@ -62,13 +150,40 @@ int main(int argc, char** argv)
 	return 0;
 }
 
-PFLocalizationNode::~PFLocalizationNode() {}
-PFLocalizationNode::PFLocalizationNode(ros::NodeHandle& n)
-	: PFLocalization(new PFLocalizationNode::Parameters(this)),
+PFLocalizationNode::~PFLocalizationNode()
+{
+	if (odometry_spinner_)
+	{
+		odometry_spinner_->stop();
+		sub_odometry_.shutdown();
+	}
+	if (filter_thread_.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex_);
+			stop_filter_thread_ = true;
+		}
+		queue_cv_.notify_one();
+		filter_thread_.join();
+	}
+}
+PFLocalizationNode::PFLocalizationNode(
+	ros::NodeHandle& n, const std::string& robot,
+	const PFLocalizationNode* map_owner, WorkerPool* worker_pool)
+	: PFLocalization(new PFLocalizationNode::Parameters(
+		  this, robot.empty() ? "~" : "~" + robot)),
 	  nh_(n),
+	  robot_(robot),
+	  worker_pool_(worker_pool),
 	  first_map_received_(false),
-	  loop_count_(0)
+	  loop_count_(0),
+	  timing_update_counter_(0),
+	  clusters_update_counter_(0),
+	  num_scan_sources_(0)
 {
+	map_owner_ = map_owner;
+	// Even with one worker, global localization runs in the loop thread
+	concurrent_updates_ = worker_pool != nullptr;
 }
 
 PFLocalizationNode::Parameters* PFLocalizationNode::param()
@@ -96,8 +211,27 @@ void PFLocalizationNode::init()
 	sub_init_pose_ = nh_.subscribe(
 		"initialpose", 1, &PFLocalizationNode::callbackInitialpose, this);
 
-	sub_odometry_ =
-		nh_.subscribe("odom", 1, &PFLocalizationNode::callbackOdometry, this);
+	if (param()->pose_extrapolation)
+	{
+		// Not delayed until the next loop iteration, so that the pose is
+		// published as soon as the odometry arrives
+		ros::NodeHandle odometry_nh(nh_);
+		odometry_nh.setCallbackQueue(&odometry_queue_);
+		sub_odometry_ = odometry_nh.subscribe(
+			"odom", 10, &PFLocalizationNode::callbackOdometry, this);
+		odometry_spinner_ =
+			std::make_unique<ros::AsyncSpinner>(1, &odometry_queue_);
+		odometry_spinner_->start();
+	}
+	else
+		sub_odometry_ = nh_.subscribe(
+			"odom", 10, &PFLocalizationNode::callbackOdometry, this);
+	service_global_localization_ = nh_.advertiseService(
+		"global_localization", &PFLocalizationNode::globalLocalizationCallback,
+		this);
+	service_reset_sensor_poses_ = nh_.advertiseService(
+		"reset_sensor_poses", &PFLocalizationNode::resetSensorPosesCallback,
+		this);
 
 	// Subscribe to one or more laser sources:
 	std::vector<std::string> sources;
@@ -113,6 +247,7 @@ void PFLocalizationNode::init()
 		{
 			sub_sensors_[i] = nh_.subscribe(
 				sources[i], 1, &PFLocalizationNode::callbackLaser, this);
+			num_scan_sources_++;
 		}
 		else if (sources[i].find("beacon") != std::string::npos)
 		{
@@ -126,46 +261,99 @@ void PFLocalizationNode::init()
 		}
 	}
 
-	if (!param()->map_file.empty())
+	if (!param()->map_file.empty() && !map_owner_)
 	{
-		if (metric_map_->countMapsByClass<COccupancyGridMap2D>())
-		{
-			mrpt::ros1bridge::toROS(
-				*metric_map_->mapByClass<COccupancyGridMap2D>(), resp_.map);
-		}
-		pub_map_ = nh_.advertise<nav_msgs::OccupancyGrid>("map", 1, true);
+		// The map shared by the robots of a multi-robot server is published
+		// once, out of their namespaces
+		ros::NodeHandle map_nh = robot_.empty() ? nh_ : ros::NodeHandle();
+		pub_map_ = map_nh.advertise<nav_msgs::OccupancyGrid>("map", 1, true);
 		pub_metadata_ =
-			nh_.advertise<nav_msgs::MapMetaData>("map_metadata", 1, true);
-		service_map_ = nh_.advertiseService(
+			map_nh.advertise<nav_msgs::MapMetaData>("map_metadata", 1, true);
+		service_map_ = map_nh.advertiseService(
 			"static_map", &PFLocalizationNode::mapCallback, this);
+
+		// Latched: only published again if the map changes
+		if (metric_map_->countMapsByClass<COccupancyGridMap2D>())
+			publishMap();
 	}
 	pub_particles_ =
 		nh_.advertise<geometry_msgs::PoseArray>("particlecloud", 1, true);
+	pub_particles_compact_ = nh_.advertise<std_msgs::Float32MultiArray>(
+		"particlecloud_compact", 1, true);
 
 	pub_pose_ = nh_.advertise<geometry_msgs::PoseWithCovarianceStamped>(
 		"mrpt_pose", 2, true);
+
+	pub_sample_size_ =
+		nh_.advertise<std_msgs::UInt32>("pf_max_sample_size", 1, true);
+	pub_update_time_ = nh_.advertise<std_msgs::Float64>("pf_update_time", 1);
+	pub_clusters_ =
+		nh_.advertise<geometry_msgs::PoseArray>("pose_clusters", 1, true);
+	pub_cluster_stats_ = nh_.advertise<std_msgs::Float64MultiArray>(
+		"pose_clusters_stats", 1, true);
+	// The diagnostics of all the nodes share the global topic, where the
+	// status names tell them apart
+	if (param()->diagnostics_period > 0)
+		pub_diagnostics_ =
+			nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+	if (!param()->diagnostics_trace_file.empty())
+	{
+		diagnostics_trace_.open(param()->diagnostics_trace_file);
+		if (diagnostics_trace_)
+			diagnostics_trace_
+				<< "stamp,observation_age,total_time,beam_selection_time,"
+				   "prefetch_time,prediction_time,weighting_time,"
+				   "resampling_time,filter_time,statistics_time,ess,"
+				   "num_particles,num_evaluations\n";
+		else
+			ROS_WARN(
+				"Can not write the diagnostics trace file %s",
+				param()->diagnostics_trace_file.c_str());
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(filter_mutex_);
+		updatePoseStatistics();
+		updateSnapshot();
+	}
+	if (worker_pool_)
+		worker_id_ = worker_pool_->add([this] { processNextObservation(); });
+	else if (param()->async_update)
+		filter_thread_ = std::thread(&PFLocalizationNode::filterThread, this);
 }
 
 void PFLocalizationNode::loop()
 {
 	ROS_INFO("loop");
-	for (ros::Rate rate(param()->rate); ros::ok(); loop_count_++)
+	for (ros::Rate rate(param()->rate); ros::ok();)
 	{
-		param()->update(loop_count_);
-
-		if ((loop_count_ % param()->map_update_skip == 0) &&
-			(metric_map_->countMapsByClass<COccupancyGridMap2D>()))
-			publishMap();
-		if (loop_count_ % param()->particlecloud_update_skip == 0)
-			publishParticles();
-		if (param()->tf_broadcast) publishTF();
-		if (param()->pose_broadcast) publishPose();
-
+		loopOnce();
 		ros::spinOnce();
 		rate.sleep();
 	}
 }
 
+void PFLocalizationNode::loopOnce()
+{
+	param()->update(loop_count_);
+
+	if (loop_count_ % param()->particlecloud_update_skip == 0)
+		publishParticles();
+	if (param()->tf_broadcast) publishTF();
+	if (param()->pose_broadcast) publishPose();
+	publishFilterTiming();
+	publishClusters();
+	publishDiagnostics();
+
+	// Do not wait forever for a laser that stopped publishing
+	if (pending_scans_ &&
+		(ros::Time::now() - pending_scans_since_).toSec() >
+			param()->sensor_sync_window)
+		flushScans();
+	flushRobotPoses();
+	loop_count_++;
+}
+
 bool PFLocalizationNode::waitForTransform(
 	mrpt::poses::CPose3D& des, const std::string& target_frame,
 	const std::string& source_frame, const ros::Time& time,
@@ -206,12 +394,14 @@ void PFLocalizationNode::callbackLaser(const sensor_msgs::LaserScan& _msg)
 	{
 		updateSensorPose(_msg.header.frame_id);
 	}
-	else if (state_ != IDLE)  // updating filter; we must be moving or
-	// update_while_stopped set to true
+	else
 	{
-		if (param()->update_sensor_pose)
+		// updating filter only if we are moving or update_while_stopped set
+		// to true, or to apply a new initial pose
+		const bool update = state_ != IDLE || initialPosePending();
+		if (update && param()->update_sensor_pose)
 		{
-			updateSensorPose(_msg.header.frame_id);
+			refreshSensorPose(_msg.header.frame_id);
 		}
 		// mrpt::poses::CPose3D pose = laser_poses_[_msg.header.frame_id];
 		// ROS_INFO("LASER POSE %4.3f, %4.3f, %4.3f, %4.3f, %4.3f, %4.3f",
@@ -219,15 +409,53 @@ void PFLocalizationNode::callbackLaser(const sensor_msgs::LaserScan& _msg)
 		mrpt::ros1bridge::fromROS(
 			_msg, laser_poses_[_msg.header.frame_id], *laser);
 
-		auto sf = CSensoryFrame::Create();
-		CObservationOdometry::Ptr odometry;
-		odometryForCallback(odometry, _msg.header);
+		// Kept for global localization, also while stopped
+		last_scans_[_msg.header.frame_id] = laser;
 
-		CObservation::Ptr obs = CObservation::Ptr(laser);
+		if (update) aggregateScan(laser, _msg.header);
+	}
+}
+
+void PFLocalizationNode::aggregateScan(
+	const CObservation2DRangeScan::Ptr& scan, const std_msgs::Header& header)
+{
+	if (num_scan_sources_ < 2 || param()->sensor_sync_window <= 0)
+	{
+		auto sf = CSensoryFrame::Create();
+		CObservation::Ptr obs = CObservation::Ptr(scan);
 		sf->insert(obs);
-		observation(sf, odometry);
-		if (param()->gui_mrpt) show3DDebug(sf);
+		processObservation(sf, header);
+		return;
+	}
+
+	// A second scan of the same laser, or one out of the window, starts a
+	// new batch
+	if (pending_scans_ &&
+		(pending_scan_frames_.count(header.frame_id) ||
+		 std::abs((header.stamp - pending_scans_header_.stamp).toSec()) >
+			 param()->sensor_sync_window))
+		flushScans();
+
+	if (!pending_scans_)
+	{
+		pending_scans_ = CSensoryFrame::Create();
+		pending_scans_header_ = header;
+		pending_scans_since_ = ros::Time::now();
 	}
+	CObservation::Ptr obs = CObservation::Ptr(scan);
+	pending_scans_->insert(obs);
+	pending_scan_frames_.insert(header.frame_id);
+
+	if (pending_scan_frames_.size() >= num_scan_sources_) flushScans();
+}
+
+void PFLocalizationNode::flushScans()
+{
+	if (!pending_scans_) return;
+	CSensoryFrame::Ptr sf;
+	std::swap(sf, pending_scans_);
+	pending_scan_frames_.clear();
+	processObservation(sf, pending_scans_header_);
 }
 
 void PFLocalizationNode::callbackBeacon(
@@ -245,12 +473,12 @@ void PFLocalizationNode::callbackBeacon(
 	{
 		updateSensorPose(_msg.header.frame_id);
 	}
-	else if (state_ != IDLE)  // updating filter; we must be moving or
-	// update_while_stopped set to true
+	else if (state_ != IDLE || initialPosePending())  // updating filter; we
+	// must be moving or update_while_stopped set to true
 	{
 		if (param()->update_sensor_pose)
 		{
-			updateSensorPose(_msg.header.frame_id);
+			refreshSensorPose(_msg.header.frame_id);
 		}
 		// mrpt::poses::CPose3D pose = beacon_poses_[_msg.header.frame_id];
 		// ROS_INFO("BEACON POSE %4.3f, %4.3f, %4.3f, %4.3f, %4.3f, %4.3f",
@@ -259,22 +487,15 @@ void PFLocalizationNode::callbackBeacon(
 			_msg, beacon_poses_[_msg.header.frame_id], *beacon);
 
 		auto sf = CSensoryFrame::Create();
-		CObservationOdometry::Ptr odometry;
-		odometryForCallback(odometry, _msg.header);
-
 		CObservation::Ptr obs = CObservation::Ptr(beacon);
 		sf->insert(obs);
-		observation(sf, odometry);
-		if (param()->gui_mrpt) show3DDebug(sf);
+		processObservation(sf, _msg.header);
 	}
 }
 
 void PFLocalizationNode::callbackRobotPose(
 	const geometry_msgs::PoseWithCovarianceStamped& _msg)
 {
-	using namespace mrpt::maps;
-	using namespace mrpt::obs;
-
 	time_last_input_ = ros::Time::now();
 
 	// Robot pose externally provided; we update filter regardless state_
@@ -284,45 +505,111 @@ void PFLocalizationNode::callbackRobotPose(
 	// XXX admittedly an arbitrary choice; feel free to open an issue if you
 	// think it doesn't make sense
 
-	static std::string base_frame_id = param()->base_frame_id;
-	static std::string global_frame_id = param()->global_frame_id;
+	auto& source = robot_pose_sources_[_msg.header.frame_id];
+
+	// Latest wins: poses arriving faster than robot_pose_min_period wait
+	// (replaced by the newer ones) until flushRobotPoses()
+	if (param()->robot_pose_min_period > 0 &&
+		(time_last_input_ - source.last_update).toSec() <
+			param()->robot_pose_min_period)
+	{
+		source.pending = _msg;
+		return;
+	}
+	source.pending.reset();
+	processRobotPose(source, _msg);
+}
+
+void PFLocalizationNode::flushRobotPoses()
+{
+	const ros::Time now = ros::Time::now();
+	for (auto& s : robot_pose_sources_)
+	{
+		auto& source = s.second;
+		if (!source.pending ||
+			(now - source.last_update).toSec() < param()->robot_pose_min_period)
+			continue;
+		const auto pose = std::move(*source.pending);
+		source.pending.reset();
+		processRobotPose(source, pose);
+	}
+}
 
+bool PFLocalizationNode::updateRobotPoseTransform(
+	RobotPoseSource& source, const std::string& frame_id)
+{
+	const ros::Time now = ros::Time::now();
+	if (source.has_transform &&
+		(now - source.transform_checked).toSec() <
+			param()->robot_pose_tf_check_period)
+		return true;
+	source.transform_checked = now;
+
+	const std::string& global_frame_id = param()->global_frame_id;
 	geometry_msgs::TransformStamped map_to_obs_tf_msg;
 	try
 	{
+		// Only the first lookup waits for the transform
 		map_to_obs_tf_msg = tf_buffer_.lookupTransform(
-			global_frame_id, _msg.header.frame_id, ros::Time(0.0),
-			ros::Duration(0.5));
+			global_frame_id, frame_id, ros::Time(0.0),
+			ros::Duration(source.has_transform ? 0.0 : 0.5));
 	}
 	catch (const tf2::TransformException& e)
 	{
 		ROS_WARN(
 			"Failed to get transform target_frame (%s) to source_frame (%s): "
 			"%s",
-			global_frame_id.c_str(), _msg.header.frame_id.c_str(), e.what());
-		return;
+			global_frame_id.c_str(), frame_id.c_str(), e.what());
+		// Keep using the last one, if any
+		return source.has_transform;
 	}
 	tf2::Transform map_to_obs_tf;
 	tf2::fromMsg(map_to_obs_tf_msg.transform, map_to_obs_tf);
 
-	// Transform observation into global frame, including covariance. For that,
-	// we must first obtain
-	// the global frame -> observation frame tf as a Pose msg, as required by
+	// The global frame -> observation frame tf as a Pose msg, as required by
 	// pose_cov_ops::compose
 	geometry_msgs::Pose map_to_obs_pose;
 	tf2::toMsg(map_to_obs_tf, map_to_obs_pose);
 
+	const auto& old_pose = source.global_to_source;
+	if (source.has_transform &&
+		(map_to_obs_pose.position.x != old_pose.position.x ||
+		 map_to_obs_pose.position.y != old_pose.position.y ||
+		 map_to_obs_pose.position.z != old_pose.position.z ||
+		 map_to_obs_pose.orientation.x != old_pose.orientation.x ||
+		 map_to_obs_pose.orientation.y != old_pose.orientation.y ||
+		 map_to_obs_pose.orientation.z != old_pose.orientation.z ||
+		 map_to_obs_pose.orientation.w != old_pose.orientation.w))
+		ROS_INFO(
+			"Transform from %s to %s changed", global_frame_id.c_str(),
+			frame_id.c_str());
+	source.global_to_source = map_to_obs_pose;
+	source.has_transform = true;
+	return true;
+}
+
+void PFLocalizationNode::processRobotPose(
+	RobotPoseSource& source,
+	const geometry_msgs::PoseWithCovarianceStamped& _msg)
+{
+	using namespace mrpt::obs;
+
+	source.last_update = ros::Time::now();
+	if (!updateRobotPoseTransform(source, _msg.header.frame_id)) return;
+
+	// Transform observation into global frame, including covariance
 	geometry_msgs::PoseWithCovarianceStamped obs_pose_world;
 	obs_pose_world.header.stamp = _msg.header.stamp;
-	obs_pose_world.header.frame_id = global_frame_id;
-	pose_cov_ops::compose(map_to_obs_pose, _msg.pose, obs_pose_world.pose);
+	obs_pose_world.header.frame_id = param()->global_frame_id;
+	pose_cov_ops::compose(
+		source.global_to_source, _msg.pose, obs_pose_world.pose);
 
 	// Ensure the covariance matrix can be inverted (no zeros in the diagonal)
-	for (unsigned int i = 0; i < obs_pose_world.pose.covariance.size(); ++i)
+	for (unsigned int i = 0; i < 6; ++i)
 	{
-		if (i / 6 == i % 6 && obs_pose_world.pose.covariance[i] <= 0.0)
-			obs_pose_world.pose.covariance[i] =
-				std::numeric_limits<double>().infinity();
+		auto& variance = obs_pose_world.pose.covariance[i * 7];
+		if (variance <= 0.0)
+			variance = std::numeric_limits<double>().infinity();
 	}
 
 	// Covert the received pose into an observation the filter can integrate
@@ -333,44 +620,211 @@ void PFLocalizationNode::callbackRobotPose(
 	feature->pose = mrpt::ros1bridge::fromROS(obs_pose_world.pose);
 
 	auto sf = CSensoryFrame::Create();
-	CObservationOdometry::Ptr odometry;
-	odometryForCallback(odometry, _msg.header);
-
 	CObservation::Ptr obs = CObservation::Ptr(feature);
 	sf->insert(obs);
+	processObservation(sf, _msg.header);
+}
+
+void PFLocalizationNode::processObservation(
+	CSensoryFrame::Ptr sf, const std_msgs::Header& header)
+{
+	if (!param()->async_update && !worker_pool_)
+	{
+		updateWithObservation(sf, header);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex_);
+		// Latest wins: a slow filter always gets the newest observations
+		const size_t queue_size =
+			std::max(1, param()->observation_queue_size);
+		while (queue_.size() >= queue_size)
+		{
+			queue_.pop_front();
+			ROS_DEBUG_THROTTLE(2.0, "Filter busy; dropping observations");
+			std::lock_guard<std::mutex> diagnostics_lock(diagnostics_mutex_);
+			diagnostics_.dropped_observations++;
+		}
+		queue_.push_back({std::move(sf), header});
+	}
+	if (worker_pool_)
+		worker_pool_->notify(worker_id_);
+	else
+		queue_cv_.notify_one();
+}
+
+void PFLocalizationNode::updateWithObservation(
+	const CSensoryFrame::Ptr& sf, const std_msgs::Header& header)
+{
+	CObservationOdometry::Ptr odometry;
+	if (!odometryForCallback(odometry, header))
+	{
+		ROS_WARN_THROTTLE(
+			2.0, "No odometry at the time of the observation; dropping it");
+		std::lock_guard<std::mutex> diagnostics_lock(diagnostics_mutex_);
+		diagnostics_.no_odometry_observations++;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(filter_mutex_);
+	{
+		std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+		if (pending_initial_pose_)
+		{
+			initial_pose_ = *pending_initial_pose_;
+			pending_initial_pose_.reset();
+			update_counter_ = 0;
+			state_ = INIT;
+		}
+	}
+	const size_t updates = update_counter_;
 	observation(sf, odometry);
+	if (update_counter_ != updates)
+	{
+		update_odometry_.reset();
+		if (odometry) update_odometry_ = odometry->odometry;
+	}
+	updateSnapshot();
+	if (update_counter_ != updates) recordDiagnostics(header);
 	if (param()->gui_mrpt) show3DDebug(sf);
 }
 
-void PFLocalizationNode::odometryForCallback(
+void PFLocalizationNode::filterThread()
+{
+	for (;;)
+	{
+		PendingObservation next;
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex_);
+			queue_cv_.wait(
+				lock, [this] { return stop_filter_thread_ || !queue_.empty(); });
+			if (stop_filter_thread_) return;
+			next = std::move(queue_.front());
+			queue_.pop_front();
+		}
+		updateWithObservation(next.sf, next.header);
+	}
+}
+
+void PFLocalizationNode::processNextObservation()
+{
+	PendingObservation next;
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex_);
+		if (queue_.empty()) return;
+		next = std::move(queue_.front());
+		queue_.pop_front();
+		// After the robots already waiting for a worker
+		if (!queue_.empty()) worker_pool_->notify(worker_id_);
+	}
+	updateWithObservation(next.sf, next.header);
+}
+
+void PFLocalizationNode::updateSnapshot()
+{
+	auto s = std::make_shared<PoseSnapshot>();
+	s->stats = pose_stats_;
+	s->stamp = time_last_update_;
+	s->update_counter = update_counter_;
+	s->update_time = update_time_;
+	s->max_sample_size = pdf_.options.KLD_params.KLD_maxSampleSize;
+	s->odometry = update_odometry_;
+
+	std::lock_guard<std::mutex> lock(snapshot_mutex_);
+	snapshot_ = std::move(s);
+}
+
+std::shared_ptr<const PFLocalizationNode::PoseSnapshot>
+	PFLocalizationNode::snapshot()
+{
+	std::lock_guard<std::mutex> lock(snapshot_mutex_);
+	return snapshot_;
+}
+
+void PFLocalizationNode::recordDiagnostics(const std_msgs::Header& header)
+{
+	const auto& d = update_diagnostics_;
+	// From the sensor to the new estimate
+	const double age = (ros::Time::now() - header.stamp).toSec();
+
+	if (diagnostics_trace_.is_open())
+		diagnostics_trace_ << mrpt::format(
+			"%.6f,%.6f,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6f,%zu,%zu\n",
+			header.stamp.toSec(), age, d.total_time, d.beam_selection_time,
+			d.prefetch_time, d.prediction_time, d.weighting_time,
+			d.resampling_time, d.filter_time, d.statistics_time, d.ess,
+			d.num_particles, d.num_evaluations);
+
+	if (param()->diagnostics_period <= 0) return;
+	std::lock_guard<std::mutex> lock(diagnostics_mutex_);
+	auto& w = diagnostics_;
+	w.updates++;
+	w.total.add(d.total_time);
+	w.beam_selection.add(d.beam_selection_time);
+	w.prefetch.add(d.prefetch_time);
+	if (d.stages_measured)
+	{
+		w.prediction.add(d.prediction_time);
+		w.weighting.add(d.weighting_time);
+		w.resampling.add(d.resampling_time);
+	}
+	w.filter.add(d.filter_time);
+	w.statistics.add(d.statistics_time);
+	w.ess.add(d.ess);
+	w.observation_age.add(age);
+	w.num_particles = d.num_particles;
+}
+
+bool PFLocalizationNode::odometryForCallback(
 	CObservationOdometry::Ptr& _odometry, const std_msgs::Header& _msg_header)
 {
 	std::string base_frame_id = param()->base_frame_id;
 	std::string odom_frame_id = param()->odom_frame_id;
-	mrpt::poses::CPose3D poseOdom;
-	if (this->waitForTransform(
-			poseOdom, odom_frame_id, base_frame_id, _msg_header.stamp,
-			ros::Duration(1.0)))
+
+	// Look the odometry up in tf only if the odom topic does not cover the
+	// stamp of the observation, and never wait for it: that would stall the
+	// filter thread, or the ROS callbacks without async_update
+	mrpt::poses::CPose2D poseOdom;
+	if (!odom_buffer_.interpolate(
+			mrpt::ros1bridge::fromROS(_msg_header.stamp), poseOdom))
 	{
-		_odometry = CObservationOdometry::Create();
-		_odometry->sensorLabel = odom_frame_id;
-		_odometry->hasEncodersInfo = false;
-		_odometry->hasVelocities = false;
-		_odometry->odometry.x() = poseOdom.x();
-		_odometry->odometry.y() = poseOdom.y();
-		_odometry->odometry.phi() = poseOdom.yaw();
+		if (!tf_buffer_.canTransform(
+				odom_frame_id, base_frame_id, _msg_header.stamp))
+			// Odometry which lags behind the observation is not there yet;
+			// without any odometry, the filter goes on without it
+			return !tf_buffer_.canTransform(
+				odom_frame_id, base_frame_id, ros::Time(0));
+
+		mrpt::poses::CPose3D poseOdom3D;
+		if (!this->waitForTransform(
+				poseOdom3D, odom_frame_id, base_frame_id, _msg_header.stamp,
+				ros::Duration(0)))
+			return false;
+		poseOdom = mrpt::poses::CPose2D(poseOdom3D);
 	}
+
+	_odometry = CObservationOdometry::Create();
+	_odometry->sensorLabel = odom_frame_id;
+	_odometry->hasEncodersInfo = false;
+	_odometry->hasVelocities = false;
+	_odometry->odometry = poseOdom;
+	return true;
 }
 
 bool PFLocalizationNode::waitForMap()
 {
 	int wait_counter = 0;
-	int wait_limit = 10;
+	// The other robots of a multi-robot server share the map as soon as this
+	// returns, and it can not change once they use it
+	const int wait_limit =
+		worker_pool_ ? std::numeric_limits<int>::max() : 10;
 
+	ros::NodeHandle map_nh = robot_.empty() ? nh_ : ros::NodeHandle();
 	if (param()->use_map_topic)
 	{
 		sub_map_ =
-			nh_.subscribe("map", 1, &PFLocalizationNode::callbackMap, this);
+			map_nh.subscribe("map", 1, &PFLocalizationNode::callbackMap, this);
 		ROS_INFO("Subscribed to map topic.");
 
 		while (!first_map_received_ && ros::ok() && wait_counter < wait_limit)
@@ -387,7 +841,7 @@ bool PFLocalizationNode::waitForMap()
 	}
 	else
 	{
-		client_map_ = nh_.serviceClient<nav_msgs::GetMap>("static_map");
+		client_map_ = map_nh.serviceClient<nav_msgs::GetMap>("static_map");
 		nav_msgs::GetMap srv;
 		while (!client_map_.call(srv) && ros::ok() && wait_counter < wait_limit)
 		{
@@ -410,7 +864,9 @@ bool PFLocalizationNode::waitForMap()
 
 void PFLocalizationNode::callbackMap(const nav_msgs::OccupancyGrid& msg)
 {
-	if (param()->first_map_only && first_map_received_)
+	// The filters of the other robots of a multi-robot server may be reading
+	// the map, which is only set before they start (see waitForMap())
+	if ((param()->first_map_only || worker_pool_) && first_map_received_)
 	{
 		return;
 	}
@@ -421,16 +877,28 @@ void PFLocalizationNode::callbackMap(const nav_msgs::OccupancyGrid& msg)
 	first_map_received_ = true;
 }
 
-void PFLocalizationNode::updateSensorPose(std::string _frame_id)
+void PFLocalizationNode::refreshSensorPose(const std::string& frame_id)
 {
-	mrpt::poses::CPose3D pose;
+	const ros::Time now = ros::Time::now();
+	const ros::Time& checked = sensor_pose_checked_[frame_id];
+	// A time jump (e.g. a restarted bag) looks the pose up again
+	if (now >= checked &&
+		(now - checked).toSec() < param()->sensor_pose_check_period)
+		return;
+	updateSensorPose(frame_id);
+}
 
+void PFLocalizationNode::updateSensorPose(std::string _frame_id)
+{
+	sensor_pose_checked_[_frame_id] = ros::Time::now();
 	std::string base_frame_id = param()->base_frame_id;
 
 	geometry_msgs::TransformStamped transformStmp;
 	try
 	{
-		ros::Duration timeout(1.0);
+		// Wait only for sensors not seen yet; refreshing a cached pose must
+		// not delay the observation
+		ros::Duration timeout(laser_poses_.count(_frame_id) ? 0.0 : 1.0);
 
 		transformStmp = tf_buffer_.lookupTransform(
 			base_frame_id, _frame_id, ros::Time(0), timeout);
@@ -446,22 +914,7 @@ void PFLocalizationNode::updateSensorPose(std::string _frame_id)
 	tf2::Transform transform;
 	tf2::fromMsg(transformStmp.transform, transform);
 
-	tf2::Vector3 translation = transform.getOrigin();
-	tf2::Quaternion quat = transform.getRotation();
-	pose.x() = translation.x();
-	pose.y() = translation.y();
-	pose.z() = translation.z();
-	tf2::Matrix3x3 Rsrc(quat);
-	mrpt::math::CMatrixDouble33 Rdes;
-	for (int c = 0; c < 3; c++)
-	{
-		for (int r = 0; r < 3; r++)
-		{
-			Rdes(r, c) = Rsrc.getRow(r)[c];
-		}
-	}
-
-	pose.setRotationMatrix(Rdes);
+	const mrpt::poses::CPose3D pose = mrpt::ros1bridge::fromROS(transform);
 	laser_poses_[_frame_id] = pose;
 	beacon_poses_[_frame_id] = pose;
 }
@@ -471,16 +924,80 @@ void PFLocalizationNode::callbackInitialpose(
 {
 	const geometry_msgs::PoseWithCovariance& pose = _msg.pose;
 
-	// SE(3) -> SE(2) explicit conversion:
-	initial_pose_ =
-		mrpt::poses::CPosePDFGaussian(mrpt::ros1bridge::fromROS(pose));
+	// SE(3) -> SE(2) explicit conversion; the filter is reset with it before
+	// the next update, which sets state_ to INIT under filter_mutex_. An
+	// update in progress must not initialize the filter with the old pose.
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex_);
+		pending_initial_pose_ =
+			mrpt::poses::CPosePDFGaussian(mrpt::ros1bridge::fromROS(pose));
+	}
+}
+
+bool PFLocalizationNode::initialPosePending()
+{
+	std::lock_guard<std::mutex> lock(queue_mutex_);
+	return pending_initial_pose_.has_value();
+}
+
+bool PFLocalizationNode::globalLocalizationCallback(
+	std_srvs::Empty::Request& req, std_srvs::Empty::Response& res)
+{
+	if (last_scans_.empty())
+	{
+		ROS_WARN("Global localization requires a laser scan");
+		return false;
+	}
+	auto sf = CSensoryFrame::Create();
+	for (const auto& scan : last_scans_)
+	{
+		CObservation::Ptr obs = CObservation::Ptr(scan.second);
+		sf->insert(obs);
+	}
+
+	std::lock_guard<std::mutex> lock(filter_mutex_);
+	if (!globalLocalization(*sf)) return false;
+	{
+		std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+		pending_initial_pose_.reset();
+	}
+	update_odometry_.reset();
+	updateSnapshot();
+	return true;
+}
 
-	update_counter_ = 0;
-	state_ = INIT;
+bool PFLocalizationNode::resetSensorPosesCallback(
+	std_srvs::Empty::Request& req, std_srvs::Empty::Response& res)
+{
+	ROS_INFO("Sensor poses reset; they will be looked up again in tf");
+	laser_poses_.clear();
+	beacon_poses_.clear();
+	sensor_pose_checked_.clear();
+	return true;
 }
 
 void PFLocalizationNode::callbackOdometry(const nav_msgs::Odometry& _msg)
 {
+	if (_msg.header.frame_id == param()->odom_frame_id &&
+		_msg.child_frame_id == param()->base_frame_id)
+	{
+		const mrpt::poses::CPose2D odometry(
+			mrpt::ros1bridge::fromROS(_msg.pose.pose));
+		odom_buffer_.insert(
+			mrpt::ros1bridge::fromROS(_msg.header.stamp), odometry);
+		odometry_received_ = ros::Time::now().toSec();
+		if (param()->pose_broadcast && param()->pose_extrapolation)
+			publishExtrapolatedPose(_msg.header.stamp, odometry);
+	}
+	else
+	{
+		ROS_WARN_ONCE(
+			"Odometry in frames %s -> %s instead of %s -> %s; it will be "
+			"looked up in tf",
+			_msg.header.frame_id.c_str(), _msg.child_frame_id.c_str(),
+			param()->odom_frame_id.c_str(), param()->base_frame_id.c_str());
+	}
+
 	// We always update the filter if update_while_stopped is true, regardless
 	// robot is moving or
 	// not; otherwise, update filter if we are moving or at initialization (100
@@ -506,66 +1023,343 @@ void PFLocalizationNode::callbackOdometry(const nav_msgs::Odometry& _msg)
 
 void PFLocalizationNode::updateMap(const nav_msgs::OccupancyGrid& _msg)
 {
+	std::lock_guard<std::mutex> lock(filter_mutex_);
 	ASSERT_(metric_map_->countMapsByClass<COccupancyGridMap2D>());
 	mrpt::ros1bridge::fromROS(
 		_msg, *metric_map_->mapByClass<COccupancyGridMap2D>());
+	onMapUpdated();
+
+	// Keep the map we serve up to date
+	if (pub_map_) publishMap();
 }
 
 bool PFLocalizationNode::mapCallback(
 	nav_msgs::GetMap::Request& req, nav_msgs::GetMap::Response& res)
 {
 	ROS_INFO("mapCallback: service requested!\n");
-	res = resp_;
+	// Converted on request rather than kept, large maps are expensive to
+	// hold twice
+	std::lock_guard<std::mutex> lock(filter_mutex_);
+	if (const auto grid = metric_map_->mapByClass<COccupancyGridMap2D>())
+		res.map = gridMessage(*grid);
 	return true;
 }
 
+nav_msgs::OccupancyGrid PFLocalizationNode::gridMessage(
+	const COccupancyGridMap2D& grid)
+{
+	nav_msgs::OccupancyGrid msg;
+	mrpt::ros1bridge::toROS(grid, msg);
+	msg.header.stamp = ros::Time::now();
+	msg.header.frame_id = param()->global_frame_id;
+	msg.header.seq = loop_count_;
+	return msg;
+}
+
 void PFLocalizationNode::publishMap()
 {
-	resp_.map.header.stamp = ros::Time::now();
-	resp_.map.header.frame_id = param()->global_frame_id;
-	resp_.map.header.seq = loop_count_;
-	if (pub_map_.getNumSubscribers() > 0)
+	// The latched publisher keeps the only copy of the message
+	const nav_msgs::OccupancyGrid msg =
+		gridMessage(*metric_map_->mapByClass<COccupancyGridMap2D>());
+	pub_map_.publish(msg);
+	pub_metadata_.publish(msg.info);
+}
+
+void PFLocalizationNode::publishParticles()
+{
+	const bool poses = pub_particles_.getNumSubscribers() > 0;
+	const bool compact = pub_particles_compact_.getNumSubscribers() > 0;
+	if (!poses && !compact) return;
+
+	// Do not wait for an update in progress, try again the next time
+	std::unique_lock<std::mutex> lock(filter_mutex_, std::try_to_lock);
+	if (!lock.owns_lock()) return;
+
+	const auto& particles = pdf_.m_particles;
+	double max_log_w = -std::numeric_limits<double>::infinity();
+	for (const auto& p : particles) max_log_w = std::max(max_log_w, p.log_w);
+	particle_weights_.resize(particles.size());
+	double sum_w = 0;
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		particle_weights_[i] = std::exp(particles[i].log_w - max_log_w);
+		sum_w += particle_weights_[i];
+	}
+	for (auto& w : particle_weights_) w /= sum_w;
+
+	if (compact) publishCompactParticles();
+	if (poses) publishParticlePoses();
+}
+
+/**
+ * @brief Publish all the particles as rows of (x, y, yaw, weight) floats,
+ * in the global frame
+ */
+void PFLocalizationNode::publishCompactParticles()
+{
+	const auto& particles = pdf_.m_particles;
+	auto& layout = particles_compact_.layout;
+	layout.dim.resize(2);
+	layout.dim[0].label = "particle";
+	layout.dim[0].size = particles.size();
+	layout.dim[0].stride = 4 * particles.size();
+	layout.dim[1].label = "x_y_yaw_weight";
+	layout.dim[1].size = 4;
+	layout.dim[1].stride = 4;
+
+	auto& data = particles_compact_.data;
+	data.resize(4 * particles.size());
+	for (size_t i = 0; i < particles.size(); i++)
 	{
-		pub_map_.publish(resp_.map);
+		const auto& p = particles[i].d;
+		data[4 * i + 0] = p.x;
+		data[4 * i + 1] = p.y;
+		data[4 * i + 2] = p.phi;
+		data[4 * i + 3] = particle_weights_[i];
 	}
-	if (pub_metadata_.getNumSubscribers() > 0)
+	pub_particles_compact_.publish(particles_compact_);
+}
+
+void PFLocalizationNode::publishParticlePoses()
+{
+	selectParticles();
+
+	particle_poses_.header.frame_id = param()->global_frame_id;
+	particle_poses_.header.stamp = ros::Time::now();
+	particle_poses_.header.seq = loop_count_;
+	particle_poses_.poses.resize(particle_selection_.size());
+	for (size_t k = 0; k < particle_selection_.size(); k++)
 	{
-		pub_metadata_.publish(resp_.map.info);
+		const auto& p = pdf_.m_particles[particle_selection_[k]].d;
+		auto& pose = particle_poses_.poses[k];
+		pose.position.x = p.x;
+		pose.position.y = p.y;
+		pose.position.z = 0;
+		pose.orientation.x = 0;
+		pose.orientation.y = 0;
+		pose.orientation.z = std::sin(0.5 * p.phi);
+		pose.orientation.w = std::cos(0.5 * p.phi);
 	}
+	pub_particles_.publish(particle_poses_);
 }
 
-void PFLocalizationNode::publishParticles()
+void PFLocalizationNode::selectParticles()
 {
-	if (pub_particles_.getNumSubscribers() > 0)
+	const auto& particles = pdf_.m_particles;
+	const std::string& mode = param()->particlecloud_decimation;
+	particle_selection_.clear();
+
+	if (mode == "binned" && param()->particlecloud_bin_size > 0)
 	{
-		geometry_msgs::PoseArray poseArray;
-		poseArray.header.frame_id = param()->global_frame_id;
-		poseArray.header.stamp = ros::Time::now();
-		poseArray.header.seq = loop_count_;
-		poseArray.poses.resize(pdf_.particlesCount());
-		for (size_t i = 0; i < pdf_.particlesCount(); i++)
+		// Heaviest particle of each cell and yaw sector
+		constexpr int YAW_SECTORS = 16;
+		const double res = param()->particlecloud_bin_size;
+		std::unordered_map<int64_t, size_t> best;
+		best.reserve(particles.size());
+		for (size_t i = 0; i < particles.size(); i++)
 		{
-			const auto p = mrpt::math::TPose3D(pdf_.getParticlePose(i));
-			poseArray.poses[i] = mrpt::ros1bridge::toROS_Pose(p);
+			const auto& p = particles[i].d;
+			const int64_t cx = static_cast<int64_t>(std::floor(p.x / res));
+			const int64_t cy = static_cast<int64_t>(std::floor(p.y / res));
+			const int64_t cphi = std::min<int64_t>(
+				YAW_SECTORS - 1,
+				static_cast<int64_t>(
+					mrpt::math::wrapTo2Pi(p.phi) * YAW_SECTORS / (2 * M_PI)));
+			const int64_t key =
+				((cx & 0xFFFFFF) << 28) | ((cy & 0xFFFFFF) << 4) | cphi;
+			auto it = best.emplace(key, i).first;
+			if (particle_weights_[i] > particle_weights_[it->second])
+				it->second = i;
 		}
-		mrpt::poses::CPose2D p;
-		pub_particles_.publish(poseArray);
+		for (const auto& b : best) particle_selection_.push_back(b.second);
+	}
+	else
+	{
+		particle_selection_.resize(particles.size());
+		std::iota(particle_selection_.begin(), particle_selection_.end(), 0);
+	}
+
+	const size_t max_poses = param()->particlecloud_max_poses;
+	if ((mode == "top_k" || mode == "binned") && max_poses > 0 &&
+		particle_selection_.size() > max_poses)
+	{
+		std::nth_element(
+			particle_selection_.begin(),
+			particle_selection_.begin() + max_poses, particle_selection_.end(),
+			[this](size_t a, size_t b) {
+				return particle_weights_[a] > particle_weights_[b];
+			});
+		particle_selection_.resize(max_poses);
 	}
 }
 
+/**
+ * @brief Publish the duration of the last filter update and the maximum
+ * number of particles chosen for the following ones
+ */
+void PFLocalizationNode::publishFilterTiming()
+{
+	const auto estimate = snapshot();
+	if (timing_update_counter_ == estimate->update_counter) return;
+	timing_update_counter_ = estimate->update_counter;
+
+	std_msgs::Float64 update_time;
+	update_time.data = estimate->update_time;
+	pub_update_time_.publish(update_time);
+
+	std_msgs::UInt32 sample_size;
+	sample_size.data = estimate->max_sample_size;
+	pub_sample_size_.publish(sample_size);
+}
+
+/**
+ * @brief Publish the duration of the update stages, the effective sample
+ * size, the number of particles and the age of the observations, aggregated
+ * over the last diagnostics_period
+ */
+void PFLocalizationNode::publishDiagnostics()
+{
+	if (param()->diagnostics_period <= 0) return;
+	const ros::Time now = ros::Time::now();
+	// A time jump (e.g. a restarted bag) starts a new window
+	if (diagnostics_since_.isZero() || now < diagnostics_since_)
+		diagnostics_since_ = now;
+	const double period = (now - diagnostics_since_).toSec();
+	if (period < param()->diagnostics_period) return;
+	diagnostics_since_ = now;
+
+	DiagnosticsWindow w;
+	{
+		std::lock_guard<std::mutex> lock(diagnostics_mutex_);
+		std::swap(w, diagnostics_);
+	}
+
+	diagnostic_msgs::DiagnosticStatus status;
+	status.name = ros::this_node::getName() + ": particle filter";
+	if (!robot_.empty()) status.name += " (" + nh_.getNamespace() + ")";
+	status.hardware_id = "none";
+	if (w.dropped_observations)
+	{
+		status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+		status.message = "Observations dropped, the filter is too slow";
+	}
+	else if (w.no_odometry_observations)
+	{
+		status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+		status.message = "Observations dropped, no odometry at their time";
+	}
+	else
+	{
+		status.level = diagnostic_msgs::DiagnosticStatus::OK;
+		status.message = w.updates ? "Updating" : "No updates";
+	}
+
+	auto add = [&status](const std::string& key, const std::string& value) {
+		diagnostic_msgs::KeyValue kv;
+		kv.key = key;
+		kv.value = value;
+		status.values.push_back(kv);
+	};
+	using Stat = DiagnosticsWindow::Stat;
+	auto addTime = [&add](const std::string& key, const Stat& stat) {
+		if (!stat.count) return;
+		add(key + " mean (ms)", mrpt::format("%.3f", 1e3 * stat.mean()));
+		add(key + " max (ms)", mrpt::format("%.3f", 1e3 * stat.max));
+	};
+	add("updates", std::to_string(w.updates));
+	add("update rate (Hz)", mrpt::format("%.2f", w.updates / period));
+	add("dropped observations", std::to_string(w.dropped_observations));
+	add("observations without odometry",
+		std::to_string(w.no_odometry_observations));
+	add("particles", std::to_string(w.num_particles));
+	if (w.ess.count)
+	{
+		add("ESS min", mrpt::format("%.3f", w.ess.min));
+		add("ESS mean", mrpt::format("%.3f", w.ess.mean()));
+	}
+	if (w.observation_age.count)
+	{
+		add("observation age mean (s)",
+			mrpt::format("%.3f", w.observation_age.mean()));
+		add("observation age max (s)",
+			mrpt::format("%.3f", w.observation_age.max));
+	}
+	addTime("update", w.total);
+	addTime("beam selection", w.beam_selection);
+	addTime("prefetch", w.prefetch);
+	addTime("prediction", w.prediction);
+	addTime("weighting", w.weighting);
+	addTime("resampling", w.resampling);
+	addTime("filter", w.filter);
+	addTime("statistics", w.statistics);
+
+	diagnostic_msgs::DiagnosticArray msg;
+	msg.header.stamp = now;
+	msg.status.push_back(status);
+	pub_diagnostics_.publish(msg);
+}
+
+/**
+ * @brief Publish the heaviest clusters of particles: their means as a
+ * PoseArray, and rows of (weight, x, y, yaw, 9 covariance values) doubles,
+ * both in the global frame and by decreasing weight
+ */
+void PFLocalizationNode::publishClusters()
+{
+	const auto estimate = snapshot();
+	if (clusters_update_counter_ == estimate->update_counter) return;
+	clusters_update_counter_ = estimate->update_counter;
+	const auto& clusters = estimate->stats.clusters;
+
+	cluster_poses_.header.frame_id = param()->global_frame_id;
+	cluster_poses_.header.stamp = mrpt::ros1bridge::toROS(estimate->stamp);
+	cluster_poses_.poses.resize(clusters.size());
+	for (size_t c = 0; c < clusters.size(); c++)
+		cluster_poses_.poses[c] =
+			mrpt::ros1bridge::toROS_Pose(clusters[c].mean);
+	pub_clusters_.publish(cluster_poses_);
+
+	constexpr size_t COLS = 13;
+	auto& layout = cluster_stats_.layout;
+	layout.dim.resize(2);
+	layout.dim[0].label = "cluster";
+	layout.dim[0].size = clusters.size();
+	layout.dim[0].stride = COLS * clusters.size();
+	layout.dim[1].label = "weight_x_y_yaw_cov";
+	layout.dim[1].size = COLS;
+	layout.dim[1].stride = COLS;
+
+	auto& data = cluster_stats_.data;
+	data.resize(COLS * clusters.size());
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		const auto& cluster = clusters[c];
+		double* row = &data[COLS * c];
+		row[0] = cluster.weight;
+		row[1] = cluster.mean.x();
+		row[2] = cluster.mean.y();
+		row[3] = cluster.mean.phi();
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++) row[4 + 3 * i + j] = cluster.cov(i, j);
+	}
+	pub_cluster_stats_.publish(cluster_stats_);
+}
+
 /**
  * @brief Publish map -> odom tf; as the filter provides map -> base, we
  * multiply it by base -> odom
  */
 void PFLocalizationNode::publishTF()
 {
-	static std::string base_frame_id = param()->base_frame_id;
-	static std::string odom_frame_id = param()->odom_frame_id;
-	static std::string global_frame_id = param()->global_frame_id;
+	const std::string& base_frame_id = param()->base_frame_id;
+	const std::string& odom_frame_id = param()->odom_frame_id;
+	const std::string& global_frame_id = param()->global_frame_id;
 
-	const mrpt::poses::CPose2D robotPoseFromPF = [this]() {
-		return pdf_.getMeanVal();
-	}();
+	const auto estimate = snapshot();
+	// The heaviest mode, the mean of a multimodal distribution may be nowhere
+	// near any of the particles
+	const mrpt::poses::CPose2D& robotPoseFromPF =
+		estimate->stats.dominantPose();
 
 	tf2::Transform baseOnMap_tf;
 	tf2::fromMsg(mrpt::ros1bridge::toROS_Pose(robotPoseFromPF), baseOnMap_tf);
@@ -573,7 +1367,7 @@ void PFLocalizationNode::publishTF()
 	ros::Time time_last_update(0.0);
 	if (state_ == RUN)
 	{
-		time_last_update = mrpt::ros1bridge::toROS(time_last_update_);
+		time_last_update = mrpt::ros1bridge::toROS(estimate->stamp);
 
 		// Last update time can be too far in the past if we where not updating
 		// filter, due to robot stopped or no
@@ -654,13 +1448,45 @@ void PFLocalizationNode::publishTF()
 	tf_broadcaster_.sendTransform(tfGeom);
 }
 
+namespace
+{
+/** The pose and its covariance, converting from 3-D to 6-D */
+geometry_msgs::PoseWithCovariance toROSPoseWithCovariance(
+	const mrpt::poses::CPose2D& mean, const mrpt::math::CMatrixDouble33& cov)
+{
+	geometry_msgs::PoseWithCovariance p;
+	p.pose = mrpt::ros1bridge::toROS_Pose(mean);
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			int ros_i = i;
+			int ros_j = j;
+			if (i == 2 || j == 2)
+			{
+				ros_i = i == 2 ? 5 : i;
+				ros_j = j == 2 ? 5 : j;
+			}
+			p.covariance[ros_i * 6 + ros_j] = cov(i, j);
+		}
+	}
+	return p;
+}
+}  // namespace
+
 /**
- * @brief Publish the current pose of the robot
+ * @brief Publish the current pose of the robot: the mean of the heaviest
+ * cluster of particles, like the tf
  **/
 void PFLocalizationNode::publishPose()
 {
 	// cov for x, y, phi (meter, meter, radian)
-	const auto [cov, mean] = pdf_.getCovarianceAndMean();
+	const auto estimate = snapshot();
+	// Published with every odometry message instead, as long as it keeps
+	// coming
+	if (param()->pose_extrapolation && estimate->odometry &&
+		ros::Time::now().toSec() - odometry_received_ < 2.0 / param()->rate)
+		return;
 
 	geometry_msgs::PoseWithCovarianceStamped p;
 
@@ -673,28 +1499,34 @@ void PFLocalizationNode::publishPose()
 	}
 	else
 	{
-		p.header.stamp = mrpt::ros1bridge::toROS(time_last_update_);
+		p.header.stamp = mrpt::ros1bridge::toROS(estimate->stamp);
 	}
 
-	// Copy in the pose
-	p.pose.pose = mrpt::ros1bridge::toROS_Pose(mean);
+	p.pose = toROSPoseWithCovariance(
+		estimate->stats.dominantPose(), estimate->stats.dominantCov());
+	pub_pose_.publish(p);
+}
 
-	// Copy in the covariance, converting from 3-D to 6-D
-	for (int i = 0; i < 3; i++)
-	{
-		for (int j = 0; j < 3; j++)
-		{
-			int ros_i = i;
-			int ros_j = j;
-			if (i == 2 || j == 2)
-			{
-				ros_i = i == 2 ? 5 : i;
-				ros_j = j == 2 ? 5 : j;
-			}
-			p.pose.covariance[ros_i * 6 + ros_j] = cov(i, j);
-		}
-	}
+/**
+ * @brief Publish the pose of the robot at the time of an odometry message:
+ * the last estimate composed with the odometry increment since its update.
+ * Only the uncertainty of the estimate is propagated, not the one of the
+ * odometry; the particles are not modified.
+ **/
+void PFLocalizationNode::publishExtrapolatedPose(
+	const ros::Time& stamp, const mrpt::poses::CPose2D& odometry)
+{
+	const auto estimate = snapshot();
+	if (!estimate->odometry || state_ == INIT) return;
 
+	geometry_msgs::PoseWithCovarianceStamped p;
+	p.header.frame_id = param()->global_frame_id;
+	p.header.stamp = stamp;
+	pose_cov_ops::compose(
+		toROSPoseWithCovariance(
+			estimate->stats.dominantPose(), estimate->stats.dominantCov()),
+		mrpt::ros1bridge::toROS_Pose(odometry - *estimate->odometry),
+		p.pose);
 	pub_pose_.publish(p);
 }
 
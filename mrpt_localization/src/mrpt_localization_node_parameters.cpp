@@ -34,8 +34,9 @@
 #include "mrpt_localization_node.h"
 #include "mrpt_localization_node_defaults.h"
 
-PFLocalizationNode::Parameters::Parameters(PFLocalizationNode* p)
-	: PFLocalization::Parameters(p), node("~")
+PFLocalizationNode::Parameters::Parameters(
+	PFLocalizationNode* p, const std::string& ns)
+	: PFLocalization::Parameters(p), node(ns), reconfigure_server_(node)
 {
 	node.param<double>("transform_tolerance", transform_tolerance, 0.1);
 	ROS_INFO("transform_tolerance: %f", transform_tolerance);
@@ -60,14 +61,29 @@ PFLocalizationNode::Parameters::Parameters(PFLocalizationNode* p)
 	ROS_INFO("map_file: %s", map_file.c_str());
 	node.getParam("sensor_sources", sensor_sources);
 	ROS_INFO("sensor_sources: %s", sensor_sources.c_str());
+	node.getParam("update_min_d", update_min_d);
+	ROS_INFO("update_min_d: %f", update_min_d);
+	node.getParam("update_min_a", update_min_a);
+	ROS_INFO("update_min_a: %f", update_min_a);
 	node.param<std::string>("global_frame_id", global_frame_id, "map");
 	ROS_INFO("global_frame_id: %s", global_frame_id.c_str());
 	node.param<std::string>("odom_frame_id", odom_frame_id, "odom");
 	ROS_INFO("odom_frame_id: %s", odom_frame_id.c_str());
 	node.param<std::string>("base_frame_id", base_frame_id, "base_link");
 	ROS_INFO("base_frame_id: %s", base_frame_id.c_str());
+	node.param<std::string>("tf_prefix", tf_prefix, "");
+	if (!tf_prefix.empty())
+	{
+		odom_frame_id = tf_prefix + "/" + odom_frame_id;
+		base_frame_id = tf_prefix + "/" + base_frame_id;
+		ROS_INFO(
+			"tf_prefix: %s (%s, %s)", tf_prefix.c_str(), odom_frame_id.c_str(),
+			base_frame_id.c_str());
+	}
 	node.param<bool>("pose_broadcast", pose_broadcast, false);
 	ROS_INFO("pose_broadcast: %s", pose_broadcast ? "true" : "false");
+	node.param<bool>("pose_extrapolation", pose_extrapolation, false);
+	ROS_INFO("pose_extrapolation: %s", pose_extrapolation ? "true" : "false");
 	node.param<bool>("tf_broadcast", tf_broadcast, true);
 	ROS_INFO("tf_broadcast: %s", tf_broadcast ? "true" : "false");
 	node.param<bool>("use_map_topic", use_map_topic, false);
@@ -86,6 +102,46 @@ PFLocalizationNode::Parameters::Parameters(PFLocalizationNode* p)
 	ROS_INFO("initial_pose_std_xy: %f m", init_std_xy);
 	node.param<double>("initial_pose_std_phi", init_std_phi, init_std_phi); // radians
 	ROS_INFO("initial_pose_std_phi: %f rad", init_std_phi);
+	node.param<bool>("async_update", async_update, false);
+	ROS_INFO("async_update: %s", async_update ? "true" : "false");
+	node.param<int>(
+		"observation_queue_size", observation_queue_size,
+		MRPT_LOCALIZATION_NODE_DEFAULT_OBSERVATION_QUEUE_SIZE);
+	ROS_INFO("observation_queue_size: %i", observation_queue_size);
+	node.param<double>("sensor_sync_window", sensor_sync_window, 0.0);
+	ROS_INFO("sensor_sync_window: %f", sensor_sync_window);
+	node.param<double>("robot_pose_min_period", robot_pose_min_period, 0.0);
+	ROS_INFO("robot_pose_min_period: %f", robot_pose_min_period);
+	node.param<double>(
+		"robot_pose_tf_check_period", robot_pose_tf_check_period, 1.0);
+	ROS_INFO("robot_pose_tf_check_period: %f", robot_pose_tf_check_period);
+	node.param<double>(
+		"sensor_pose_check_period", sensor_pose_check_period, 1.0);
+	ROS_INFO("sensor_pose_check_period: %f", sensor_pose_check_period);
+	node.param<std::string>(
+		"particlecloud_decimation", particlecloud_decimation, "none");
+	ROS_INFO("particlecloud_decimation: %s", particlecloud_decimation.c_str());
+	node.param<int>(
+		"particlecloud_max_poses", particlecloud_max_poses,
+		MRPT_LOCALIZATION_NODE_DEFAULT_PARTICLECLOUD_MAX_POSES);
+	if (particlecloud_max_poses < 0)
+	{
+		ROS_WARN(
+			"particlecloud_max_poses must not be negative, using 0 (no "
+			"limit) instead of %i",
+			particlecloud_max_poses);
+		particlecloud_max_poses = 0;
+	}
+	ROS_INFO("particlecloud_max_poses: %i", particlecloud_max_poses);
+	node.param<double>(
+		"particlecloud_bin_size", particlecloud_bin_size,
+		MRPT_LOCALIZATION_NODE_DEFAULT_PARTICLECLOUD_BIN_SIZE);
+	ROS_INFO("particlecloud_bin_size: %f", particlecloud_bin_size);
+	node.param<double>("diagnostics_period", diagnostics_period, 0.0);
+	ROS_INFO("diagnostics_period: %f", diagnostics_period);
+	node.param<std::string>(
+		"diagnostics_trace_file", diagnostics_trace_file, "");
+	ROS_INFO("diagnostics_trace_file: %s", diagnostics_trace_file.c_str());
 
 	reconfigure_cb_ = boost::bind(
 		&PFLocalizationNode::Parameters::callbackParameters, this, _1, _2);
@@ -106,14 +162,6 @@ void PFLocalizationNode::Parameters::update(const unsigned long& loop_count)
 			ROS_INFO(
 				"particlecloud_update_skip: %i", particlecloud_update_skip);
 	}
-	{
-		int v = map_update_skip;
-		node.param<int>(
-			"map_update_skip", map_update_skip,
-			MRPT_LOCALIZATION_NODE_DEFAULT_MAP_UPDATE_SKIP);
-		if (v != map_update_skip)
-			ROS_INFO("map_update_skip: %i", map_update_skip);
-	}
 }
 
 void PFLocalizationNode::Parameters::callbackParameters(
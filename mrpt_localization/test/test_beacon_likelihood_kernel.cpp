@@ -0,0 +1,206 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt/maps/CBeaconMap.h>
+#include <mrpt/obs/CObservationBeaconRanges.h>
+#include <mrpt/poses/CPoint3D.h>
+#include <mrpt/poses/CPose2D.h>
+#include <mrpt_localization/beacon_likelihood_kernel.h>
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+using mrpt::maps::CBeacon;
+using mrpt::maps::CBeaconMap;
+using mrpt::obs::CObservationBeaconRanges;
+using mrpt::poses::CPoint3D;
+using mrpt::poses::CPose2D;
+
+namespace
+{
+/** 40 beacons with IDs 100, 107, ... over a 20 x 20 m area */
+CBeaconMap makeMap(std::mt19937& rng)
+{
+	std::uniform_real_distribution<double> xy(-10, 10), z(0, 3), a(-0.2, 0.2);
+	CBeaconMap map;
+	map.likelihoodOptions.rangeStd = 0.1f;
+	for (int k = 0; k < 40; k++)
+	{
+		CBeacon b;
+		b.m_ID = 100 + 7 * k;
+		b.m_typePDF = CBeacon::pdfGauss;
+		b.m_locationGauss.mean = CPoint3D(xy(rng), xy(rng), z(rng));
+		// Covariance A.A^T, positive semidefinite with correlations
+		double A[3][3];
+		for (auto& row : A)
+			for (double& v : row) v = a(rng);
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+			{
+				double v = 0;
+				for (int i = 0; i < 3; i++) v += A[r][i] * A[c][i];
+				b.m_locationGauss.cov(r, c) = v;
+			}
+		map.push_back(b);
+	}
+	return map;
+}
+
+void addRange(CObservationBeaconRanges& obs, int32_t id, float range)
+{
+	CObservationBeaconRanges::TMeasurement m;
+	m.sensorLocationOnRobot = CPoint3D(0.1, -0.05, 0.4);
+	m.beaconID = id;
+	m.sensedDistance = range;
+	obs.sensedData.push_back(m);
+}
+
+/**
+ * Ranges to 10 known beacons, to an unknown ID, and non-positive and NaN
+ * ranges to known beacons
+ **/
+CObservationBeaconRanges makeObservation(std::mt19937& rng)
+{
+	CObservationBeaconRanges obs;
+	obs.minSensorDistance = 0.1f;
+	obs.maxSensorDistance = 30.0f;
+	std::uniform_real_distribution<float> range(0.5f, 15.0f);
+	for (int k = 0; k < 10; k++) addRange(obs, 100 + 7 * 3 * k, range(rng));
+	addRange(obs, 101, range(rng));
+	addRange(obs, 100, 0.0f);
+	addRange(obs, 107, -1.0f);
+	addRange(obs, 114, std::numeric_limits<float>::quiet_NaN());
+	return obs;
+}
+
+std::vector<CPose2D> randomPoses(size_t count, std::mt19937& rng)
+{
+	std::uniform_real_distribution<double> xy(-10, 10), phi(-M_PI, M_PI);
+	std::vector<CPose2D> poses;
+	for (size_t i = 0; i < count; i++)
+		poses.emplace_back(xy(rng), xy(rng), phi(rng));
+	return poses;
+}
+
+ParticlesSoA toParticles(const std::vector<CPose2D>& poses)
+{
+	ParticlesSoA particles;
+	particles.resize(poses.size());
+	for (size_t i = 0; i < poses.size(); i++)
+		particles.set(i, poses[i].x(), poses[i].y(), poses[i].phi());
+	return particles;
+}
+
+/** Compares the kernel with CBeaconMap for every pose */
+void expectMatchesBeaconMap(
+	const CBeaconMap& map, const CObservationBeaconRanges& obs,
+	const std::vector<CPose2D>& poses)
+{
+	BeaconLikelihoodKernel kernel;
+	kernel.setMap(map);
+	ASSERT_EQ(kernel.size(), map.size());
+
+	// The kernel adds to the output
+	std::vector<double> log_lik(poses.size(), 1.0);
+	kernel.evaluate(toParticles(poses), obs, log_lik.data());
+	for (size_t i = 0; i < poses.size(); i++)
+	{
+		const double expected =
+			1.0 + map.computeObservationLikelihood(obs, poses[i]);
+		EXPECT_NEAR(log_lik[i], expected, 1e-3 + 1e-4 * std::abs(expected))
+			<< "particle " << i << " of " << poses.size();
+	}
+}
+}  // namespace
+
+TEST(BeaconLikelihoodKernel, matchesBeaconMap)
+{
+	std::mt19937 rng(1);
+	const CBeaconMap map = makeMap(rng);
+	const CObservationBeaconRanges obs = makeObservation(rng);
+	// Counts that leave a tail for the scalar code after the SIMD blocks
+	for (size_t count : {1, 3, 8, 13, 1001})
+		expectMatchesBeaconMap(map, obs, randomPoses(count, rng));
+}
+
+TEST(BeaconLikelihoodKernel, unknownAndInvalidRanges)
+{
+	std::mt19937 rng(2);
+	const CBeaconMap map = makeMap(rng);
+	CObservationBeaconRanges obs;
+	obs.minSensorDistance = 0.1f;
+	obs.maxSensorDistance = 30.0f;
+	addRange(obs, 101, 5.0f);
+	addRange(obs, 102, 7.0f);
+	addRange(obs, 100, 0.0f);
+	addRange(obs, 107, std::numeric_limits<float>::quiet_NaN());
+	expectMatchesBeaconMap(map, obs, randomPoses(11, rng));
+
+	// Only the unknown IDs count, each with the uniform density
+	BeaconLikelihoodKernel kernel;
+	kernel.setMap(map);
+	const auto poses = randomPoses(11, rng);
+	std::vector<double> log_lik(poses.size(), 0.0);
+	kernel.evaluate(toParticles(poses), obs, log_lik.data());
+	const double uniform =
+		-std::log(obs.maxSensorDistance - obs.minSensorDistance);
+	for (double v : log_lik) EXPECT_NEAR(v, 2 * uniform, 1e-9);
+}
+
+TEST(BeaconLikelihoodKernel, leavesOtherMapsToBeaconMap)
+{
+	std::mt19937 rng(3);
+	BeaconLikelihoodKernel kernel;
+
+	CBeaconMap non_gaussian = makeMap(rng);
+	non_gaussian.get(5).m_typePDF = CBeacon::pdfMonteCarlo;
+	kernel.setMap(non_gaussian);
+	EXPECT_EQ(kernel.size(), 0u);
+
+	CBeaconMap repeated_id = makeMap(rng);
+	repeated_id.get(5).m_ID = repeated_id.get(4).m_ID;
+	kernel.setMap(repeated_id);
+	EXPECT_EQ(kernel.size(), 0u);
+
+	kernel.setMap(makeMap(rng));
+	EXPECT_EQ(kernel.size(), 40u);
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,151 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt/obs/CObservation2DRangeScan.h>
+#include <mrpt/obs/CSensoryFrame.h>
+#include <mrpt_localization/beam_selector.h>
+
+#include <vector>
+
+using mrpt::obs::CObservation2DRangeScan;
+using mrpt::obs::CSensoryFrame;
+
+namespace
+{
+/** Scan of num_rays valid rays of 5 m, except for max-range every 10th */
+CObservation2DRangeScan::Ptr makeScan(size_t num_rays, bool max_range)
+{
+	auto scan = CObservation2DRangeScan::Create();
+	scan->maxRange = 10.0f;
+	scan->resizeScan(num_rays);
+	for (size_t i = 0; i < num_rays; i++)
+	{
+		scan->setScanRange(i, max_range && i % 10 == 0 ? 10.0f : 5.0f);
+		scan->setScanRangeValidity(i, true);
+	}
+	return scan;
+}
+
+std::vector<CObservation2DRangeScan::Ptr> scansOf(const CSensoryFrame& sf)
+{
+	std::vector<CObservation2DRangeScan::Ptr> scans;
+	for (const auto& obs : sf)
+		if (auto scan = std::dynamic_pointer_cast<CObservation2DRangeScan>(obs))
+			scans.push_back(scan);
+	return scans;
+}
+
+std::vector<size_t> validRays(const CObservation2DRangeScan& scan)
+{
+	std::vector<size_t> rays;
+	for (size_t i = 0; i < scan.getScanSize(); i++)
+		if (scan.getScanRangeValidity(i)) rays.push_back(i);
+	return rays;
+}
+
+/** Selector whose budget fits max_evaluations beam-particle evaluations */
+BeamSelector makeSelector(double max_evaluations)
+{
+	BeamSelector selector;
+	selector.addMeasurement(1e-3, 1000000);  // 1 ns per evaluation
+	selector.time_budget = max_evaluations * 1e-9;
+	return selector;
+}
+}  // namespace
+
+TEST(BeamSelector, withoutBudgetDropsOnlyMaxRangeRays)
+{
+	CSensoryFrame sf;
+	sf.insert(makeScan(100, true));
+	BeamSelector selector;
+	CSensoryFrame out;
+	EXPECT_EQ(selector.apply(sf, 1000, 1, out), 90u);
+
+	const auto scans = scansOf(out);
+	ASSERT_EQ(scans.size(), 1u);
+	for (size_t i : validRays(*scans[0])) EXPECT_NE(i % 10, 0u);
+	EXPECT_EQ(validRays(*scans[0]).size(), 90u);
+
+	// The input scan is not modified
+	EXPECT_EQ(validRays(*scansOf(sf)[0]).size(), 100u);
+}
+
+TEST(BeamSelector, quotaIsSpreadAcrossStrata)
+{
+	CSensoryFrame sf;
+	sf.insert(makeScan(1000, false));
+	auto selector = makeSelector(100 * 1000);
+	CSensoryFrame out;
+
+	for (int round = 0; round < 20; round++)
+	{
+		EXPECT_EQ(selector.apply(sf, 1000, 1, out), 100u);
+		const auto rays = validRays(*scansOf(out)[0]);
+		ASSERT_EQ(rays.size(), 100u);
+		// One ray in each stratum of 10 consecutive rays
+		for (size_t q = 0; q < rays.size(); q++) EXPECT_EQ(rays[q] / 10, q);
+	}
+
+	// With decimation, the budget is for the evaluated rays
+	EXPECT_EQ(selector.apply(sf, 1000, 5, out), 100u);
+	EXPECT_EQ(validRays(*scansOf(out)[0]).size(), 500u);
+
+	// But never less than min_rays
+	selector.min_rays = 200;
+	EXPECT_EQ(selector.apply(sf, 1000, 1, out), 200u);
+}
+
+TEST(BeamSelector, quotaIsSplitAmongScans)
+{
+	CSensoryFrame sf;
+	sf.insert(makeScan(1000, false));
+	sf.insert(makeScan(500, false));
+	sf.insert(makeScan(3, false));
+	auto selector = makeSelector(150 * 1000);
+	CSensoryFrame out;
+
+	// The last scan gets a quota of 0 rays
+	EXPECT_EQ(selector.apply(sf, 1000, 1, out), 150u);
+	const auto scans = scansOf(out);
+	ASSERT_EQ(scans.size(), 3u);
+	EXPECT_EQ(validRays(*scans[0]).size(), 100u);
+	EXPECT_EQ(validRays(*scans[1]).size(), 50u);
+	EXPECT_TRUE(validRays(*scans[2]).empty());
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,127 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt/maps/COccupancyGridMap2D.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt_localization/free_cell_index.h>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using mrpt::maps::COccupancyGridMap2D;
+
+namespace
+{
+/** Free cells of the grid: every third column, and row 4 */
+bool isFree(int cx, int cy) { return cx % 3 == 0 || cy == 4; }
+
+/** 20 x 10 cells of 10 cm */
+void makeGrid(COccupancyGridMap2D& grid)
+{
+	grid.setSize(-1.0f, 1.0f, -0.5f, 0.5f, 0.1f, 0.1f);
+	for (int cy = 0; cy < 10; cy++)
+		for (int cx = 0; cx < 20; cx++)
+			if (isFree(cx, cy)) grid.setCell(cx, cy, 0.9f);
+}
+}  // namespace
+
+TEST(FreeCellIndex, samplesOnlyFreeCells)
+{
+	COccupancyGridMap2D grid;
+	makeGrid(grid);
+	FreeCellIndex index;
+	index.build(grid);
+	ASSERT_EQ(index.size(), 7u * 10 + 13);
+
+	mrpt::random::CRandomGenerator rng(1);
+	std::vector<mrpt::math::TPoint2D> points;
+	const float inf = std::numeric_limits<float>::max();
+	const size_t count = 83 * 200;
+	ASSERT_TRUE(index.sample(count, -inf, inf, -inf, inf, rng, points));
+	ASSERT_EQ(points.size(), count);
+
+	std::vector<size_t> hits(200, 0);
+	for (const auto& p : points)
+	{
+		const int cx = static_cast<int>(std::floor((p.x + 1.0) / 0.1));
+		const int cy = static_cast<int>(std::floor((p.y + 0.5) / 0.1));
+		ASSERT_TRUE(cx >= 0 && cx < 20 && cy >= 0 && cy < 10);
+		hits[cy * 20 + cx]++;
+	}
+	// 200 samples per free cell on average, within 7 standard deviations
+	for (int cy = 0; cy < 10; cy++)
+		for (int cx = 0; cx < 20; cx++)
+			if (isFree(cx, cy))
+				EXPECT_NEAR(hits[cy * 20 + cx], 200.0, 7 * std::sqrt(200.0));
+			else
+				EXPECT_EQ(hits[cy * 20 + cx], 0u) << cx << ", " << cy;
+
+	// Cells whose centers are in a box: columns 2 to 4 of rows 3 to 5
+	ASSERT_TRUE(index.sample(1000, -0.8f, -0.5f, -0.2f, 0.07f, rng, points));
+	for (const auto& p : points)
+	{
+		const int cx = static_cast<int>(std::floor((p.x + 1.0) / 0.1));
+		const int cy = static_cast<int>(std::floor((p.y + 0.5) / 0.1));
+		EXPECT_TRUE(cx >= 2 && cx <= 4 && cy >= 3 && cy <= 5);
+		EXPECT_TRUE(isFree(cx, cy));
+	}
+
+	// No free cell in the box
+	EXPECT_FALSE(index.sample(10, -0.58f, -0.42f, 0.2f, 0.4f, rng, points));
+}
+
+TEST(FreeCellIndex, drawIndexIsUniform)
+{
+	mrpt::random::CRandomGenerator rng(2);
+	EXPECT_EQ(FreeCellIndex::drawIndex(rng, 1), 0u);
+
+	// The modulo of 32 bit draws would favor the lower half of this range
+	const uint32_t n = 0xC0000000u;
+	size_t lower = 0;
+	const size_t draws = 100000;
+	for (size_t i = 0; i < draws; i++)
+	{
+		const uint32_t k = FreeCellIndex::drawIndex(rng, n);
+		ASSERT_LT(k, n);
+		if (k < n / 2) lower++;
+	}
+	EXPECT_NEAR(lower, draws / 2, 5 * std::sqrt(draws / 4.0));
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
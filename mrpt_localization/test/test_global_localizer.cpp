@@ -0,0 +1,137 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt_localization/global_localizer.h>
+
+#include <cmath>
+#include <vector>
+
+namespace
+{
+const float RESOLUTION = 0.05f;
+const int SIZE_X = 200;
+const int SIZE_Y = 160;
+
+/** 10 x 8 m room with a few obstacles, so that it has no symmetries */
+std::vector<uint8_t> makeRoom()
+{
+	std::vector<uint8_t> occupied(static_cast<size_t>(SIZE_X) * SIZE_Y, 0);
+	const auto occupy = [&](int x0, int y0, int x1, int y1) {
+		for (int y = y0; y <= y1; y++)
+			for (int x = x0; x <= x1; x++)
+				occupied[static_cast<size_t>(y) * SIZE_X + x] = 1;
+	};
+	occupy(0, 0, SIZE_X - 1, 1);
+	occupy(0, SIZE_Y - 2, SIZE_X - 1, SIZE_Y - 1);
+	occupy(0, 0, 1, SIZE_Y - 1);
+	occupy(SIZE_X - 2, 0, SIZE_X - 1, SIZE_Y - 1);
+	occupy(50, 30, 65, 55);
+	occupy(120, 100, 160, 110);
+	occupy(30, 100, 35, 140);
+	occupy(150, 20, 155, 60);
+	return occupied;
+}
+
+/** Points where the beams of a 360 degree scan hit the obstacles */
+void simulateScan(
+	const std::vector<uint8_t>& occupied, const mrpt::math::TPose2D& pose,
+	std::vector<float>& xs, std::vector<float>& ys)
+{
+	for (int i = 0; i < 360; i++)
+	{
+		const double a = i * M_PI / 180;
+		const double ca = std::cos(pose.phi + a), sa = std::sin(pose.phi + a);
+		for (double r = 0; r < 8.0; r += 0.01)
+		{
+			const int cx = static_cast<int>((pose.x + r * ca) / RESOLUTION);
+			const int cy = static_cast<int>((pose.y + r * sa) / RESOLUTION);
+			if (occupied[static_cast<size_t>(cy) * SIZE_X + cx])
+			{
+				xs.push_back(static_cast<float>(r * std::cos(a)));
+				ys.push_back(static_cast<float>(r * std::sin(a)));
+				break;
+			}
+		}
+	}
+}
+}  // namespace
+
+TEST(GlobalLocalizer, findsThePoseInARoom)
+{
+	const auto occupied = makeRoom();
+	std::vector<uint8_t> free_cells(occupied.size());
+	for (size_t i = 0; i < occupied.size(); i++) free_cells[i] = !occupied[i];
+
+	LikelihoodField::Params params;
+	params.max_range = 10.0f;
+	for (bool quantized : {false, true})
+	{
+		const GlobalLocalizer::Pyramid pyramid(
+			LikelihoodField::Create(
+				occupied, SIZE_X, SIZE_Y, 0.0f, 0.0f, RESOLUTION, params,
+				quantized),
+			&free_cells);
+		GlobalLocalizer localizer;
+
+		for (const auto& pose :
+			 {mrpt::math::TPose2D(6.3, 4.1, 2.2),
+			  mrpt::math::TPose2D(2.02, 6.51, -0.7)})
+		{
+			std::vector<float> xs, ys;
+			simulateScan(occupied, pose, xs, ys);
+			ASSERT_GT(xs.size(), 300u);
+
+			const auto hypotheses = localizer.localize(pyramid, xs, ys);
+			ASSERT_FALSE(hypotheses.empty());
+			const auto& best = hypotheses.front().pose;
+			EXPECT_LE(std::abs(best.x - pose.x), RESOLUTION)
+				<< best.asString();
+			EXPECT_LE(std::abs(best.y - pose.y), RESOLUTION)
+				<< best.asString();
+			EXPECT_LE(
+				std::abs(mrpt::math::wrapToPi(best.phi - pose.phi)),
+				localizer.params.angular_resolution)
+				<< best.asString();
+			for (size_t i = 1; i < hypotheses.size(); i++)
+				EXPECT_LE(hypotheses[i].score, hypotheses[i - 1].score);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,159 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt_localization/likelihood_field.h>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+const float RESOLUTION = 0.05f;
+
+/** Not a whole number of tiles, so that border tiles are padded */
+const int SIZE_X = 150;
+const int SIZE_Y = 90;
+
+LikelihoodField::Params testParams()
+{
+	LikelihoodField::Params params;
+	params.max_range = 10.0f;
+	return params;
+}
+
+std::vector<uint8_t> randomObstacles(unsigned int seed, double density)
+{
+	std::mt19937 rng(seed);
+	std::bernoulli_distribution occupied(density);
+	std::vector<uint8_t> mask(static_cast<size_t>(SIZE_X) * SIZE_Y);
+	for (auto& cell : mask) cell = occupied(rng);
+	return mask;
+}
+
+double logLikelihood(double d_sq, const LikelihoodField::Params& p)
+{
+	const double max_sq = double(p.max_corrs_distance) * p.max_corrs_distance;
+	const double Q = -1.0 / (2.0 * p.std_hit * p.std_hit);
+	return std::log(
+		p.z_random / p.max_range +
+		p.z_hit * std::exp(Q * std::min(d_sq, max_sq)));
+}
+
+/** Value of the cell from the nearest obstacle, searched by brute force */
+double bruteForce(
+	const std::vector<uint8_t>& mask, int cx, int cy,
+	const LikelihoodField::Params& p)
+{
+	double best = std::numeric_limits<double>::infinity();
+	if (cx < SIZE_X - 1 && cy < SIZE_Y - 1)
+		for (int y = 0; y < SIZE_Y; y++)
+			for (int x = 0; x < SIZE_X; x++)
+				if (mask[static_cast<size_t>(y) * SIZE_X + x])
+				{
+					const double dx = x - cx, dy = y - cy;
+					best = std::min(best, dx * dx + dy * dy);
+				}
+	return logLikelihood(best * RESOLUTION * RESOLUTION, p);
+}
+}  // namespace
+
+TEST(LikelihoodField, distanceTransformMatchesBruteForce)
+{
+	const auto params = testParams();
+	for (double density : {0.0, 0.002, 0.02, 0.3})
+	{
+		const auto mask = randomObstacles(1, density);
+		const auto lf = LikelihoodField::Create(
+			mask, SIZE_X, SIZE_Y, -1.0f, 2.0f, RESOLUTION, params);
+		ASSERT_FALSE(lf->isQuantized());
+		EXPECT_EQ(lf->tilesX(), 3);
+		EXPECT_EQ(lf->tilesY(), 2);
+		EXPECT_NEAR(lf->outOfMapValue(), logLikelihood(1e9, params), 1e-5);
+		for (int cy = 0; cy < SIZE_Y; cy++)
+			for (int cx = 0; cx < SIZE_X; cx++)
+				ASSERT_NEAR(
+					lf->cell(cx, cy), bruteForce(mask, cx, cy, params), 1e-5)
+					<< "density " << density << " cell " << cx << "," << cy;
+	}
+}
+
+TEST(LikelihoodField, quantizedCellsMatchFloatCells)
+{
+	const auto params = testParams();
+	const auto mask = randomObstacles(2, 0.01);
+	const auto lf = LikelihoodField::Create(
+		mask, SIZE_X, SIZE_Y, 0.0f, 0.0f, RESOLUTION, params);
+	const auto qlf = LikelihoodField::Create(
+		mask, SIZE_X, SIZE_Y, 0.0f, 0.0f, RESOLUTION, params, true);
+	ASSERT_TRUE(qlf->isQuantized());
+	EXPECT_EQ(qlf->outOfMapValue(), lf->outOfMapValue());
+
+	const float tolerance = 0.5f * qlf->quantizationScale() + 1e-5f;
+	for (int cy = 0; cy < SIZE_Y; cy++)
+		for (int cx = 0; cx < SIZE_X; cx++)
+			ASSERT_NEAR(qlf->cell(cx, cy), lf->cell(cx, cy), tolerance);
+}
+
+TEST(LikelihoodField, logLikelihoodOfPoints)
+{
+	const auto mask = randomObstacles(3, 0.05);
+	const auto lf = LikelihoodField::Create(
+		mask, SIZE_X, SIZE_Y, -1.0f, 2.0f, RESOLUTION, testParams());
+	const float out = lf->outOfMapValue();
+
+	// Cell (3, 4), anywhere within it
+	EXPECT_EQ(lf->logLikelihood(-1.0f + 0.151f, 2.0f + 0.201f), lf->cell(3, 4));
+	EXPECT_EQ(lf->logLikelihood(-1.0f + 0.199f, 2.0f + 0.249f), lf->cell(3, 4));
+
+	// Out of the map on each side
+	EXPECT_EQ(lf->logLikelihood(-1.01f, 3.0f), out);
+	EXPECT_EQ(lf->logLikelihood(0.0f, 1.99f), out);
+	const float x_max = -1.0f + SIZE_X * RESOLUTION;
+	const float y_max = 2.0f + SIZE_Y * RESOLUTION;
+	EXPECT_EQ(lf->logLikelihood(x_max + 0.01f, 3.0f), out);
+	EXPECT_EQ(lf->logLikelihood(0.0f, y_max + 0.01f), out);
+
+	// The last row and column
+	EXPECT_EQ(lf->cell(SIZE_X - 1, 10), out);
+	EXPECT_EQ(lf->cell(10, SIZE_Y - 1), out);
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,124 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt/system/datetime.h>
+#include <mrpt_localization/odometry_buffer.h>
+
+#include <cmath>
+
+using mrpt::poses::CPose2D;
+using mrpt::system::time_tToTimestamp;
+
+namespace
+{
+/** Samples every 20 ms from t = 100 s to 100.18 s, turning across +-pi */
+void fill(OdometryBuffer& buffer)
+{
+	for (int i = 0; i < 10; i++)
+	{
+		const double phi = mrpt::math::wrapToPi(3.1 + 0.01 * i);
+		buffer.insert(
+			time_tToTimestamp(100.0 + 0.02 * i),
+			CPose2D(0.01 * i, -0.02 * i, phi));
+	}
+}
+}  // namespace
+
+TEST(OdometryBuffer, interpolatesBetweenSamples)
+{
+	OdometryBuffer buffer;
+	fill(buffer);
+	CPose2D pose;
+
+	ASSERT_TRUE(buffer.interpolate(time_tToTimestamp(100.04), pose));
+	EXPECT_NEAR(pose.x(), 0.02, 1e-6);
+	EXPECT_NEAR(pose.y(), -0.04, 1e-6);
+	EXPECT_NEAR(pose.phi(), 3.12, 1e-6);
+
+	// Half way between the samples 4 and 5, across +-pi
+	ASSERT_TRUE(buffer.interpolate(time_tToTimestamp(100.09), pose));
+	EXPECT_NEAR(pose.x(), 0.045, 1e-6);
+	EXPECT_NEAR(pose.y(), -0.09, 1e-6);
+	EXPECT_NEAR(pose.phi(), mrpt::math::wrapToPi(3.145), 1e-6);
+}
+
+TEST(OdometryBuffer, extrapolatesUpToTheLimit)
+{
+	OdometryBuffer buffer;
+	fill(buffer);
+	CPose2D pose;
+
+	// 0.07 s after the newest sample, at the last velocity
+	ASSERT_TRUE(buffer.interpolate(time_tToTimestamp(100.25), pose));
+	EXPECT_NEAR(pose.x(), 0.125, 1e-6);
+	EXPECT_NEAR(pose.y(), -0.25, 1e-6);
+	EXPECT_NEAR(pose.phi(), mrpt::math::wrapToPi(3.225), 1e-6);
+
+	EXPECT_FALSE(buffer.interpolate(time_tToTimestamp(100.29), pose));
+	buffer.max_extrapolation = 0.2;
+	EXPECT_TRUE(buffer.interpolate(time_tToTimestamp(100.29), pose));
+}
+
+TEST(OdometryBuffer, rejectsStampsOutOfTheInterval)
+{
+	OdometryBuffer buffer;
+	CPose2D pose;
+	EXPECT_FALSE(buffer.interpolate(time_tToTimestamp(100.0), pose));
+
+	fill(buffer);
+	EXPECT_FALSE(buffer.interpolate(time_tToTimestamp(99.99), pose));
+	EXPECT_TRUE(buffer.interpolate(time_tToTimestamp(100.0), pose));
+
+	// Samples older than max_age are dropped
+	buffer.max_age = 1.0;
+	buffer.insert(time_tToTimestamp(101.1), CPose2D(1, 1, 0));
+	EXPECT_FALSE(buffer.interpolate(time_tToTimestamp(100.05), pose));
+	EXPECT_TRUE(buffer.interpolate(time_tToTimestamp(100.15), pose));
+
+	// An older stamp (a restarted bag) starts over
+	buffer.insert(time_tToTimestamp(50.0), CPose2D(2, 0, 0));
+	EXPECT_FALSE(buffer.interpolate(time_tToTimestamp(100.15), pose));
+	ASSERT_TRUE(buffer.interpolate(time_tToTimestamp(50.05), pose));
+	EXPECT_EQ(pose.x(), 2.0);
+
+	buffer.clear();
+	EXPECT_TRUE(buffer.empty());
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
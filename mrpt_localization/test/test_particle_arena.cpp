@@ -0,0 +1,170 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt_localization/particle_arena.h>
+
+#include <cmath>
+#include <vector>
+
+namespace
+{
+/** Arena whose particle i has x = i and a weight proportional to w[i] */
+ParticleArena makeArena(const std::vector<double>& w)
+{
+	ParticleArena arena;
+	arena.resize(w.size());
+	for (size_t i = 0; i < w.size(); i++)
+	{
+		arena.x()[i] = i;
+		arena.y()[i] = 0;
+		arena.phi()[i] = 0;
+		arena.logW()[i] = std::log(w[i]) + 5;
+	}
+	return arena;
+}
+
+std::vector<size_t> countSelections(
+	ParticleArena& arena, size_t count, ParticleArena::Resampling method,
+	mrpt::random::CRandomGenerator& rng)
+{
+	std::vector<size_t> counts(arena.size(), 0);
+	const size_t* indices = arena.select(count, method, rng);
+	for (size_t k = 0; k < count; k++) counts.at(indices[k])++;
+	return counts;
+}
+}  // namespace
+
+TEST(ParticleArena, selectIsSorted)
+{
+	mrpt::random::CRandomGenerator rng(1);
+	auto arena = makeArena({0.3, 0.1, 0.05, 0.25, 0.2, 0.1});
+	for (auto method : {ParticleArena::Resampling::SYSTEMATIC,
+						ParticleArena::Resampling::STRATIFIED})
+		for (int round = 0; round < 100; round++)
+		{
+			const size_t* indices = arena.select(37, method, rng);
+			for (size_t k = 1; k < 37; k++)
+				EXPECT_LE(indices[k - 1], indices[k]);
+			EXPECT_LT(indices[36], arena.size());
+		}
+}
+
+TEST(ParticleArena, systematicCountsFollowWeights)
+{
+	mrpt::random::CRandomGenerator rng(2);
+	auto arena = makeArena({0.1, 0.2, 0.3, 0.4});
+	for (int round = 0; round < 100; round++)
+	{
+		// With one offset, each particle gets its share rounded up or down
+		const auto counts = countSelections(
+			arena, 1000, ParticleArena::Resampling::SYSTEMATIC, rng);
+		EXPECT_NEAR(counts[0], 100, 1);
+		EXPECT_NEAR(counts[1], 200, 1);
+		EXPECT_NEAR(counts[2], 300, 1);
+		EXPECT_NEAR(counts[3], 400, 1);
+	}
+}
+
+TEST(ParticleArena, stratifiedCountsFollowWeights)
+{
+	mrpt::random::CRandomGenerator rng(3);
+	auto arena = makeArena({0.1, 0.2, 0.3, 0.4});
+	std::vector<size_t> totals(4, 0);
+	for (int round = 0; round < 100; round++)
+	{
+		const auto counts = countSelections(
+			arena, 1000, ParticleArena::Resampling::STRATIFIED, rng);
+		size_t sum = 0;
+		for (size_t i = 0; i < 4; i++)
+		{
+			// Only the intervals across a boundary can go either way
+			EXPECT_NEAR(counts[i], 1000 * (i + 1) / 10, 2);
+			totals[i] += counts[i];
+			sum += counts[i];
+		}
+		EXPECT_EQ(sum, 1000u);
+	}
+	EXPECT_NEAR(totals[0], 10000, 20);
+	EXPECT_NEAR(totals[3], 40000, 20);
+}
+
+TEST(ParticleArena, systematicUsesOneOffset)
+{
+	mrpt::random::CRandomGenerator rng(4);
+	// Equal weights, half as many samples: one particle of every pair
+	auto arena = makeArena(std::vector<double>(10, 1.0));
+	size_t uneven_stratified = 0;
+	for (int round = 0; round < 50; round++)
+	{
+		const size_t* sys =
+			arena.select(5, ParticleArena::Resampling::SYSTEMATIC, rng);
+		for (size_t k = 1; k < 5; k++) EXPECT_EQ(sys[k] - sys[k - 1], 2u);
+
+		const size_t* strat =
+			arena.select(5, ParticleArena::Resampling::STRATIFIED, rng);
+		for (size_t k = 0; k < 5; k++)
+		{
+			EXPECT_GE(strat[k] + 1, 2 * k);
+			EXPECT_LE(strat[k], 2 * k + 1);
+		}
+		for (size_t k = 1; k < 5; k++)
+			if (strat[k] - strat[k - 1] != 2) uneven_stratified++;
+	}
+	EXPECT_GT(uneven_stratified, 0u);
+}
+
+TEST(ParticleArena, gatherAndRestore)
+{
+	auto arena = makeArena({0.1, 0.2, 0.3, 0.4});
+	const std::vector<size_t> indices = {0, 2, 2, 3, 3, 3};
+	arena.gather(indices.data(), indices.size());
+	ASSERT_EQ(arena.size(), indices.size());
+	for (size_t k = 0; k < indices.size(); k++)
+	{
+		EXPECT_EQ(arena.x()[k], indices[k]);
+		EXPECT_DOUBLE_EQ(
+			arena.logW()[k], std::log(0.1 * (indices[k] + 1)) + 5);
+	}
+
+	arena.restore();
+	ASSERT_EQ(arena.size(), 4u);
+	for (size_t i = 0; i < 4; i++) EXPECT_EQ(arena.x()[i], i);
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,159 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt_localization/particle_clusterer.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+using Particles = mrpt::poses::CPosePDFParticles::CParticleList;
+
+namespace
+{
+/** Appends count particles normally distributed around the pose */
+void addBlob(
+	Particles& particles, std::mt19937& rng, size_t count, double x,
+	double y, double phi, double sigma_xy, double sigma_phi,
+	double log_w = 0)
+{
+	std::normal_distribution<double> xy(0, sigma_xy), yaw(0, sigma_phi);
+	for (size_t i = 0; i < count; i++)
+	{
+		particles.emplace_back();
+		particles.back().d =
+			mrpt::math::TPose2D(x + xy(rng), y + xy(rng), phi + yaw(rng));
+		particles.back().log_w = log_w;
+	}
+}
+
+double angleDistance(double a, double b)
+{
+	return std::abs(std::remainder(a - b, 2 * M_PI));
+}
+}  // namespace
+
+TEST(ParticleClusterer, twoBlobs)
+{
+	std::mt19937 rng(1);
+	Particles particles;
+	addBlob(particles, rng, 400, -3.0, -2.0, -2.0, 0.1, 0.05);
+	addBlob(particles, rng, 600, 2.0, 1.0, 0.5, 0.1, 0.05);
+
+	ParticleClusterer clusterer;
+	std::vector<ParticleClusterer::Cluster> clusters;
+	clusterer.cluster(particles, clusters);
+	ASSERT_EQ(clusters.size(), 2u);
+	EXPECT_EQ(clusterer.boxes().size(), 2u);
+
+	// The heaviest first
+	EXPECT_EQ(clusters[0].num_particles, 600u);
+	EXPECT_NEAR(clusters[0].weight, 0.6, 1e-9);
+	EXPECT_NEAR(clusters[0].mean.x(), 2.0, 0.02);
+	EXPECT_NEAR(clusters[0].mean.y(), 1.0, 0.02);
+	EXPECT_LT(angleDistance(clusters[0].mean.phi(), 0.5), 0.01);
+	EXPECT_EQ(clusters[1].num_particles, 400u);
+	EXPECT_NEAR(clusters[1].weight, 0.4, 1e-9);
+	EXPECT_NEAR(clusters[1].mean.x(), -3.0, 0.02);
+	EXPECT_NEAR(clusters[1].mean.y(), -2.0, 0.02);
+	EXPECT_LT(angleDistance(clusters[1].mean.phi(), -2.0), 0.01);
+
+	// The covariance of each blob, not of the whole set
+	for (const auto& c : clusters)
+	{
+		EXPECT_NEAR(c.cov(0, 0), 0.01, 0.002);
+		EXPECT_NEAR(c.cov(1, 1), 0.01, 0.002);
+		EXPECT_NEAR(c.cov(2, 2), 0.0025, 0.0005);
+		EXPECT_NEAR(c.cov(0, 1), 0.0, 0.002);
+	}
+}
+
+TEST(ParticleClusterer, ordersByWeightNotCount)
+{
+	std::mt19937 rng(2);
+	Particles particles;
+	addBlob(particles, rng, 600, 2.0, 1.0, 0.5, 0.1, 0.05, -1.0);
+	addBlob(particles, rng, 400, -3.0, -2.0, -2.0, 0.1, 0.05);
+
+	ParticleClusterer clusterer;
+	std::vector<ParticleClusterer::Cluster> clusters;
+	clusterer.cluster(particles, clusters);
+	ASSERT_EQ(clusters.size(), 2u);
+	EXPECT_EQ(clusters[0].num_particles, 400u);
+	const double w = 400 / (400 + 600 * std::exp(-1.0));
+	EXPECT_NEAR(clusters[0].weight, w, 1e-9);
+	EXPECT_NEAR(clusters[1].weight, 1 - w, 1e-9);
+
+	clusterer.max_clusters = 1;
+	clusterer.cluster(particles, clusters);
+	ASSERT_EQ(clusters.size(), 1u);
+	EXPECT_EQ(clusters[0].num_particles, 400u);
+	EXPECT_EQ(clusterer.boxes().size(), 2u);
+}
+
+TEST(ParticleClusterer, blobAcrossYawWrap)
+{
+	std::mt19937 rng(3);
+	Particles particles;
+	addBlob(particles, rng, 500, 0.0, 0.0, M_PI, 0.1, 0.05);
+	for (auto& p : particles) p.d.phi = std::remainder(p.d.phi, 2 * M_PI);
+
+	ParticleClusterer clusterer;
+	std::vector<ParticleClusterer::Cluster> clusters;
+	clusterer.cluster(particles, clusters);
+	ASSERT_EQ(clusters.size(), 1u);
+	EXPECT_EQ(clusters[0].num_particles, 500u);
+	EXPECT_LT(angleDistance(clusters[0].mean.phi(), M_PI), 0.01);
+	EXPECT_NEAR(clusters[0].cov(2, 2), 0.0025, 0.0005);
+}
+
+TEST(ParticleClusterer, disabled)
+{
+	std::mt19937 rng(4);
+	Particles particles;
+	addBlob(particles, rng, 100, 0.0, 0.0, 0.0, 0.1, 0.05);
+
+	ParticleClusterer clusterer;
+	clusterer.max_clusters = 0;
+	std::vector<ParticleClusterer::Cluster> clusters(3);
+	clusterer.cluster(particles, clusters);
+	EXPECT_TRUE(clusters.empty());
+	EXPECT_TRUE(clusterer.boxes().empty());
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
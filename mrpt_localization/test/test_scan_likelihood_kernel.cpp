@@ -0,0 +1,356 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <mrpt/maps/COccupancyGridMap2D.h>
+#include <mrpt/obs/CObservation2DRangeScan.h>
+#include <mrpt/poses/CPose2D.h>
+#include <mrpt/poses/CPose3D.h>
+#include <mrpt_localization/likelihood_field.h>
+#include <mrpt_localization/scan_likelihood_kernel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using mrpt::maps::COccupancyGridMap2D;
+using mrpt::obs::CObservation2DRangeScan;
+using mrpt::poses::CPose2D;
+
+namespace
+{
+const float RESOLUTION = 0.05f;
+
+/**
+ * 6 x 4 m grid with the walls of a room and a pillar, and walls two cells
+ * away from the last row and column
+ **/
+void makeRoom(COccupancyGridMap2D& grid)
+{
+	grid.setSize(0.0f, 6.0f, 0.0f, 4.0f, RESOLUTION, 0.9f);
+	const auto occupy = [&](float x0, float y0, float x1, float y1) {
+		for (int cy = grid.y2idx(y0); cy <= grid.y2idx(y1); cy++)
+			for (int cx = grid.x2idx(x0); cx <= grid.x2idx(x1); cx++)
+				grid.setCell(cx, cy, 0.1f);
+	};
+	occupy(0.5f, 0.5f, 5.5f, 0.5f);
+	occupy(0.5f, 3.5f, 5.5f, 3.5f);
+	occupy(0.5f, 0.5f, 0.5f, 3.5f);
+	occupy(5.5f, 0.5f, 5.5f, 3.5f);
+	occupy(2.5f, 1.8f, 2.8f, 2.1f);
+	occupy(5.87f, 0.5f, 5.87f, 4.0f);
+	occupy(0.5f, 3.87f, 6.0f, 3.87f);
+
+	auto& lo = grid.likelihoodOptions;
+	lo.likelihoodMethod = COccupancyGridMap2D::lmLikelihoodField_Thrun;
+	lo.LF_alternateAverageMethod = false;
+	lo.LF_maxRange = 10.0f;
+	lo.enableLikelihoodCache = false;
+}
+
+/**
+ * Scan of ranges.size() beams over 270 degrees. Beams with a non-positive
+ * range are invalid and have the maximum range, as in scans converted from
+ * ROS messages.
+ **/
+CObservation2DRangeScan makeScan(const std::vector<float>& ranges)
+{
+	CObservation2DRangeScan scan;
+	scan.aperture = static_cast<float>(1.5 * M_PI);
+	scan.rightToLeft = true;
+	scan.maxRange = 10.0f;
+	scan.sensorPose = mrpt::poses::CPose3D(0.2, 0.05, 0.3, 0.1, 0, 0);
+	scan.resizeScan(ranges.size());
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		scan.setScanRange(i, ranges[i] > 0 ? ranges[i] : scan.maxRange);
+		scan.setScanRangeValidity(i, ranges[i] > 0);
+	}
+	return scan;
+}
+
+/**
+ * Ranges of num_beams beams, num_valid of them valid, long enough for some
+ * endpoints to be out of the map. Consecutive endpoints are a few
+ * centimeters apart at least, so that MRPT does not merge them.
+ **/
+std::vector<float> randomRanges(
+	size_t num_beams, size_t num_valid, std::mt19937& rng)
+{
+	std::vector<float> ranges(num_beams, 0.0f);
+	std::uniform_real_distribution<float> range(1.5f, 7.0f);
+	std::vector<size_t> beams(num_beams);
+	for (size_t i = 0; i < num_beams; i++) beams[i] = i;
+	std::shuffle(beams.begin(), beams.end(), rng);
+	for (size_t i = 0; i < num_valid; i++) ranges[beams[i]] = range(rng);
+	return ranges;
+}
+
+ParticlesSoA toParticles(const std::vector<CPose2D>& poses)
+{
+	ParticlesSoA particles;
+	particles.resize(poses.size());
+	for (size_t i = 0; i < poses.size(); i++)
+		particles.set(i, poses[i].x(), poses[i].y(), poses[i].phi());
+	return particles;
+}
+
+/** Random occupancy mask of a field which is not a whole number of tiles */
+LikelihoodField::Ptr randomField(bool quantized)
+{
+	const int size_x = 100, size_y = 70;
+	std::mt19937 rng(1);
+	std::bernoulli_distribution occupied(0.01);
+	std::vector<uint8_t> mask(static_cast<size_t>(size_x) * size_y);
+	for (auto& cell : mask) cell = occupied(rng);
+	LikelihoodField::Params params;
+	params.max_range = 10.0f;
+	return LikelihoodField::Create(
+		mask, size_x, size_y, -2.0f, 1.0f, RESOLUTION, params, quantized);
+}
+}  // namespace
+
+TEST(ScanLikelihoodKernel, addScanDecimation)
+{
+	std::mt19937 rng(1);
+	ScanLikelihoodKernel kernel;
+
+	// Scans with less than 10 valid beams are not decimated
+	kernel.addScan(makeScan(randomRanges(91, 9, rng)), 5);
+	EXPECT_EQ(kernel.size(), 9u);
+
+	kernel.clear();
+	kernel.addScan(makeScan(randomRanges(91, 10, rng)), 5);
+	EXPECT_EQ(kernel.size(), 2u);
+
+	kernel.clear();
+	kernel.addScan(makeScan(randomRanges(91, 61, rng)), 5);
+	EXPECT_EQ(kernel.size(), 13u);
+
+	kernel.clear();
+	kernel.addScan(makeScan(randomRanges(91, 20, rng)), 0);
+	EXPECT_EQ(kernel.size(), 20u);
+}
+
+TEST(ScanLikelihoodKernel, matchesFieldLookup)
+{
+	for (bool quantized : {false, true})
+	{
+		const auto lf = randomField(quantized);
+		const float x0 = lf->xMin() + 0.5f * RESOLUTION;
+		const float y0 = lf->yMin() + 0.5f * RESOLUTION;
+
+		// Endpoints at the center of cells, out of the map on every side,
+		// and in the last row and column
+		std::mt19937 rng(2);
+		std::uniform_int_distribution<int> offset(-110, 110);
+		ScanLikelihoodKernel kernel;
+		std::vector<int> beam_dx, beam_dy;
+		for (int j = 0; j < 200; j++)
+		{
+			beam_dx.push_back(offset(rng));
+			beam_dy.push_back(offset(rng));
+			kernel.addBeam(
+				beam_dx.back() * RESOLUTION, beam_dy.back() * RESOLUTION);
+		}
+
+		// Particles at the center of cells, at right angles, some out of
+		// the map
+		const int num_particles = 37;
+		std::uniform_int_distribution<int> cell_x(-5, lf->sizeX() + 4);
+		std::uniform_int_distribution<int> cell_y(-5, lf->sizeY() + 4);
+		std::uniform_int_distribution<int> quarter(-1, 2);
+		ParticlesSoA particles;
+		particles.resize(num_particles);
+		std::vector<int> cx(num_particles), cy(num_particles);
+		std::vector<int> q(num_particles);
+		for (int i = 0; i < num_particles; i++)
+		{
+			cx[i] = cell_x(rng);
+			cy[i] = cell_y(rng);
+			q[i] = quarter(rng);
+			particles.set(
+				i, x0 + cx[i] * RESOLUTION, y0 + cy[i] * RESOLUTION,
+				q[i] * M_PI / 2);
+		}
+
+		std::vector<double> log_lik(num_particles);
+		kernel.evaluate(particles, *lf, log_lik.data());
+
+		for (int i = 0; i < num_particles; i++)
+		{
+			// Rotation by q[i] quarters of a turn:
+			const int c[4] = {1, 0, -1, 0};
+			const int cq = c[(q[i] + 4) % 4];
+			const int sq = c[(q[i] + 3) % 4];
+			double expected = 0;
+			for (size_t j = 0; j < beam_dx.size(); j++)
+			{
+				const int x = cx[i] + cq * beam_dx[j] - sq * beam_dy[j];
+				const int y = cy[i] + sq * beam_dx[j] + cq * beam_dy[j];
+				const bool inside =
+					x >= 0 && y >= 0 && x < lf->sizeX() && y < lf->sizeY();
+				expected += inside ? lf->cell(x, y) : lf->outOfMapValue();
+			}
+			EXPECT_NEAR(log_lik[i], expected, 1e-3)
+				<< "particle " << i << (quantized ? " quantized" : "");
+		}
+	}
+}
+
+TEST(ScanLikelihoodKernel, simdMatchesScalar)
+{
+	// The last particles are left to the scalar code by the SIMD ones (8 at
+	// a time with AVX2, 4 with NEON): they repeat the poses of the first
+	const size_t head = 16, tail = 7;
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<double> x(-3.0, 4.0), y(0.0, 5.0);
+	std::uniform_real_distribution<double> phi(-M_PI, M_PI);
+	std::vector<CPose2D> poses;
+	for (size_t i = 0; i < head; i++)
+		poses.emplace_back(x(rng), y(rng), phi(rng));
+	for (size_t i = 0; i < tail; i++) poses.push_back(poses[i]);
+	const auto particles = toParticles(poses);
+
+	ScanLikelihoodKernel kernel;
+	std::uniform_real_distribution<float> beam(-6.0f, 6.0f);
+	for (int j = 0; j < 100; j++) kernel.addBeam(beam(rng), beam(rng));
+
+	for (bool quantized : {false, true})
+	{
+		const auto lf = randomField(quantized);
+		std::vector<double> log_lik(poses.size());
+		kernel.evaluate(particles, *lf, log_lik.data());
+		for (size_t i = 0; i < tail; i++)
+			EXPECT_NEAR(log_lik[head + i], log_lik[i], 1e-3)
+				<< ScanLikelihoodKernel::implementation() << " particle " << i
+				<< (quantized ? " quantized" : "");
+	}
+
+	// Without beams
+	ScanLikelihoodKernel empty;
+	std::vector<double> log_lik(poses.size(), 1.0);
+	empty.evaluate(particles, *randomField(true), log_lik.data());
+	for (double l : log_lik) EXPECT_EQ(l, 0.0);
+}
+
+TEST(ScanLikelihoodKernel, matchesOccupancyGridMap)
+{
+	COccupancyGridMap2D grid;
+	makeRoom(grid);
+
+	std::mt19937 rng(4);
+	std::uniform_real_distribution<double> x(1.0, 5.0), y(1.0, 3.0);
+	std::uniform_real_distribution<double> phi(-M_PI, M_PI);
+	std::vector<CPose2D> poses;
+	for (int i = 0; i < 13; i++) poses.emplace_back(x(rng), y(rng), phi(rng));
+	const auto particles = toParticles(poses);
+
+	for (bool quantized : {false, true})
+	{
+		const auto lf = LikelihoodField::Create(grid, std::string(), quantized);
+
+		// The field is read at the center of the cell of each endpoint, which
+		// moves its distance to the obstacles by up to half a cell diagonal:
+		// about 0.09 in the log-likelihood of a beam, with these parameters
+		const double tolerance_per_beam =
+			0.1 + (quantized ? 0.5 * lf->quantizationScale() : 0.0);
+
+		// Decimated and not decimated scans
+		for (size_t num_valid : {1, 6, 9, 10, 45, 91})
+			for (int round = 0; round < 5; round++)
+			{
+				const auto scan = makeScan(randomRanges(91, num_valid, rng));
+				ScanLikelihoodKernel kernel;
+				kernel.addScan(scan, grid.likelihoodOptions.LF_decimation);
+				std::vector<double> log_lik(poses.size());
+				kernel.evaluate(particles, *lf, log_lik.data());
+
+				for (size_t i = 0; i < poses.size(); i++)
+				{
+					const double expected = grid.computeObservationLikelihood(
+						scan, mrpt::poses::CPose3D(poses[i]));
+					const double tolerance = tolerance_per_beam * kernel.size();
+					EXPECT_NEAR(log_lik[i], expected, tolerance)
+						<< num_valid << " valid beams, particle " << i
+						<< (quantized ? " quantized" : "");
+				}
+			}
+	}
+}
+
+TEST(ScanLikelihoodKernel, lastRowAndColumnAreOutOfMap)
+{
+	COccupancyGridMap2D grid;
+	makeRoom(grid);
+	const auto lf = LikelihoodField::Create(grid);
+
+	// A single beam, 1 m straight ahead of the robot
+	std::vector<float> ranges(11, 0.0f);
+	ranges[5] = 1.0f;
+	auto scan = makeScan(ranges);
+	scan.sensorPose = mrpt::poses::CPose3D();
+	ScanLikelihoodKernel kernel;
+	kernel.addScan(scan, 5);
+	ASSERT_EQ(kernel.size(), 1u);
+
+	// Endpoints at the center of the last column, the last row, and the
+	// column before the last one, which is 1 cell away from a wall
+	const double last_x =
+		grid.getXMin() + (grid.getSizeX() - 0.5) * RESOLUTION;
+	const double last_y =
+		grid.getYMin() + (grid.getSizeY() - 0.5) * RESOLUTION;
+	const std::vector<CPose2D> poses = {
+		CPose2D(last_x - 1.0, 2.025, 0), CPose2D(3.025, last_y - 1.0, M_PI / 2),
+		CPose2D(last_x - 1.0 - RESOLUTION, 2.025, 0)};
+
+	std::vector<double> log_lik(poses.size());
+	kernel.evaluate(toParticles(poses), *lf, log_lik.data());
+	EXPECT_EQ(log_lik[0], lf->outOfMapValue());
+	EXPECT_EQ(log_lik[1], lf->outOfMapValue());
+	EXPECT_GT(log_lik[2], lf->outOfMapValue());
+	for (size_t i = 0; i < poses.size(); i++)
+		EXPECT_NEAR(
+			log_lik[i],
+			grid.computeObservationLikelihood(
+				scan, mrpt::poses::CPose3D(poses[i])),
+			1e-4)
+			<< "particle " << i;
+}
+
+int main(int argc, char** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
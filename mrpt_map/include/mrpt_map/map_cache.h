@@ -0,0 +1,63 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#pragma once
+
+#include <mrpt/config/CConfigFileBase.h>
+#include <mrpt/maps/CMultiMetricMap.h>
+
+#include <cstddef>
+#include <string>
+
+namespace mrpt_map
+{
+/**
+ * Loads a metric map like mrpt::ros1bridge::MapHdl::loadMap(), from a map
+ * file (e.g. a .simplemap) and the map definitions in the section_name
+ * sections of an ini file, through a content-addressed cache: the first
+ * time, the map is built as usual and saved to cache_dir in MRPT binary
+ * serialization, named after a hash of the map file contents, of those
+ * sections and of the MRPT version; later loads of the same inputs just
+ * read that file back.
+ * @param cache_dir directory of the cache, empty to disable it
+ * @param max_files maps kept in the cache; the least recently used ones are
+ *deleted when a new one is saved
+ * @return false if the map could not be loaded
+ **/
+bool loadMap(
+	mrpt::maps::CMultiMetricMap& metric_map,
+	const mrpt::config::CConfigFileBase& config, const std::string& map_file,
+	const std::string& section_name, const std::string& cache_dir,
+	bool debug, size_t max_files = 4);
+
+}  // namespace mrpt_map
@@ -0,0 +1,250 @@
+/***********************************************************************************
+ * Revised BSD License *
+ * Copyright (c) 2014, Markus Bader <markus.bader@tuwien.ac.at> *
+ * All rights reserved. *
+ *                                                                                 *
+ * Redistribution and use in source and binary forms, with or without *
+ * modification, are permitted provided that the following conditions are met: *
+ *     * Redistributions of source code must retain the above copyright *
+ *       notice, this list of conditions and the following disclaimer. *
+ *     * Redistributions in binary form must reproduce the above copyright *
+ *       notice, this list of conditions and the following disclaimer in the *
+ *       documentation and/or other materials provided with the distribution. *
+ *     * Neither the name of the Vienna University of Technology nor the *
+ *       names of its contributors may be used to endorse or promote products *
+ *       derived from this software without specific prior written permission. *
+ *                                                                                 *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND *
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ **
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL Markus Bader BE LIABLE FOR ANY *
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES *
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ **
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND *
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ **
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **                       *
+ ***********************************************************************************/
+
+#include <mrpt/core/format.h>
+#include <mrpt/io/CFileInputStream.h>
+#include <mrpt/io/CFileOutputStream.h>
+#include <mrpt/ros1bridge/map.h>
+#include <mrpt/serialization/CArchive.h>
+#include <mrpt/system/CDirectoryExplorer.h>
+#include <mrpt/system/CTicTac.h>
+#include <mrpt/system/filesystem.h>
+#include <mrpt/version.h>
+#include <mrpt_map/map_cache.h>
+#include <ros/console.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+const char CACHE_FILE_MAGIC[8] = {'M', 'R', 'P', 'T', 'M', 'M', '0', '1'};
+
+/** FNV-1a over 64-bit words, with an extra shift to mix high bits down */
+uint64_t hashBytes(uint64_t h, const void* data, size_t n)
+{
+	const uint64_t prime = 0x100000001b3ULL;
+	const auto* p = static_cast<const uint8_t*>(data);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint64_t w;
+		std::memcpy(&w, p + i, sizeof(w));
+		h = (h ^ w) * prime;
+		h ^= h >> 32;
+	}
+	for (; i < n; i++) h = (h ^ p[i]) * prime;
+	return h;
+}
+
+uint64_t hashString(uint64_t h, const std::string& s)
+{
+	// The size separates consecutive strings
+	const uint64_t size = s.size();
+	return hashBytes(hashBytes(h, &size, sizeof(size)), s.data(), s.size());
+}
+
+/** Hash of the cache inputs, false if the map file can not be read */
+bool cacheKey(
+	const mrpt::config::CConfigFileBase& config, const std::string& map_file,
+	const std::string& section_name, uint64_t& key)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	h = hashBytes(h, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+	h = hashString(h, MRPT_VERSION_STR);
+
+	// The map definitions: the section and its subsections (e.g.
+	// "metricMap_occupancyGrid_00_creationOpts")
+	std::vector<std::string> sections;
+	config.getAllSections(sections);
+	std::sort(sections.begin(), sections.end());
+	for (const auto& section : sections)
+	{
+		if (section.compare(0, section_name.size(), section_name) != 0)
+			continue;
+		std::vector<std::string> keys;
+		config.getAllKeys(section, keys);
+		std::sort(keys.begin(), keys.end());
+		h = hashString(h, section);
+		for (const auto& k : keys)
+		{
+			h = hashString(h, k);
+			h = hashString(h, config.read_string(section, k, ""));
+		}
+	}
+
+	std::ifstream f(map_file, std::ios::binary);
+	if (!f) return false;
+	std::vector<char> buffer(1 << 20);
+	while (f)
+	{
+		f.read(buffer.data(), buffer.size());
+		h = hashBytes(h, buffer.data(), f.gcount());
+	}
+	key = h;
+	return true;
+}
+
+/** Name of the cache file of a key, within the cache directory */
+std::string cacheFileName(uint64_t key)
+{
+	return mrpt::format("metric_map_%016" PRIx64 ".bin", key);
+}
+
+bool readCache(
+	const std::string& file, uint64_t key,
+	mrpt::maps::CMultiMetricMap& metric_map)
+{
+	if (!mrpt::system::fileExists(file)) return false;
+	try
+	{
+		mrpt::io::CFileInputStream in(file);
+		char magic[sizeof(CACHE_FILE_MAGIC)];
+		uint64_t file_key = 0;
+		if (in.Read(magic, sizeof(magic)) != sizeof(magic) ||
+			std::memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic)) ||
+			in.Read(&file_key, sizeof(file_key)) != sizeof(file_key) ||
+			file_key != key)
+			return false;
+		auto archive = mrpt::serialization::archiveFrom(in);
+		archive >> metric_map;
+	}
+	catch (const std::exception& e)
+	{
+		ROS_WARN("Could not read map cache %s: %s", file.c_str(), e.what());
+		return false;
+	}
+	return true;
+}
+
+/** Writes under a temporary name and renames it, so that other processes
+ * never read a partial file */
+bool writeCache(
+	const std::string& file, uint64_t key,
+	const mrpt::maps::CMultiMetricMap& metric_map)
+{
+	const std::string tmp_file = file + ".tmp" + std::to_string(::getpid());
+	try
+	{
+		mrpt::io::CFileOutputStream out;
+		if (!out.open(tmp_file)) return false;
+		out.Write(CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+		out.Write(&key, sizeof(key));
+		auto archive = mrpt::serialization::archiveFrom(out);
+		archive << metric_map;
+	}
+	catch (const std::exception&)
+	{
+		std::remove(tmp_file.c_str());
+		return false;
+	}
+	if (std::rename(tmp_file.c_str(), file.c_str()) != 0)
+	{
+		std::remove(tmp_file.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Deletes the least recently used cache files beyond max_files */
+void evictCache(const std::string& cache_dir, size_t max_files)
+{
+	mrpt::system::CDirectoryExplorer::TFileInfoList files;
+	mrpt::system::CDirectoryExplorer::explore(
+		cache_dir, FILE_ATTRIB_ARCHIVE, files);
+	files.erase(
+		std::remove_if(
+			files.begin(), files.end(),
+			[](const mrpt::system::CDirectoryExplorer::TFileInfo& f) {
+				return f.name.compare(0, 11, "metric_map_") != 0 ||
+					mrpt::system::extractFileExtension(f.name) != "bin";
+			}),
+		files.end());
+	if (files.size() <= max_files) return;
+
+	std::sort(
+		files.begin(), files.end(),
+		[](const auto& a, const auto& b) { return a.modTime > b.modTime; });
+	for (size_t i = max_files; i < files.size(); i++)
+		std::remove(files[i].wholePath.c_str());
+}
+}  // namespace
+
+namespace mrpt_map
+{
+bool loadMap(
+	mrpt::maps::CMultiMetricMap& metric_map,
+	const mrpt::config::CConfigFileBase& config, const std::string& map_file,
+	const std::string& section_name, const std::string& cache_dir,
+	bool debug, size_t max_files)
+{
+	uint64_t key = 0;
+	if (cache_dir.empty() ||
+		!cacheKey(config, map_file, section_name, key))
+		return mrpt::ros1bridge::MapHdl::loadMap(
+			metric_map, config, map_file, section_name, debug);
+
+	mrpt::system::CTicTac tictac;
+	const std::string file = cache_dir + "/" + cacheFileName(key);
+	if (readCache(file, key, metric_map))
+	{
+		ROS_INFO(
+			"Map loaded from cache %s in %.3fs", file.c_str(), tictac.Tac());
+		// The modification time orders the files for evictCache()
+		::utime(file.c_str(), nullptr);
+		return true;
+	}
+
+	if (!mrpt::ros1bridge::MapHdl::loadMap(
+			metric_map, config, map_file, section_name, debug))
+		return false;
+	ROS_INFO("Map built from %s in %.3fs", map_file.c_str(), tictac.Tac());
+
+	if (!mrpt::system::createDirectory(cache_dir) ||
+		!writeCache(file, key, metric_map))
+		ROS_WARN("Could not save map cache: %s", file.c_str());
+	else
+	{
+		ROS_INFO("Map saved to cache: %s", file.c_str());
+		evictCache(cache_dir, std::max<size_t>(max_files, 1));
+	}
+	return true;
+}
+
+}  // namespace mrpt_map
@@ -36,6 +36,9 @@
 #include <mrpt/maps/COccupancyGridMap2D.h>
 #include <mrpt/ros1bridge/map.h>
 #include <mrpt/system/filesystem.h>	 // ASSERT_FILE_EXISTS_()
+#include <mrpt_map/map_cache.h>
+
+#include <algorithm>
 
 using namespace mrpt::config;
 using mrpt::maps::CMultiMetricMap;
@@ -71,6 +74,12 @@ void MapServer::init()
 		ROS_INFO("ini_file: %s", ini_file.c_str());
 		ROS_INFO("map_file: %s", map_file.c_str());
 
+		std::string map_cache_dir;
+		n_param_.param<std::string>("map_cache_dir", map_cache_dir, "");
+		ROS_INFO("map_cache_dir: %s", map_cache_dir.c_str());
+		int map_cache_max_files;
+		n_param_.param<int>("map_cache_max_files", map_cache_max_files, 4);
+
 		ASSERT_FILE_EXISTS_(ini_file);
 		ASSERT_FILE_EXISTS_(map_file);
 		CConfigFile config_file;
@@ -78,8 +87,9 @@ void MapServer::init()
 
 		metric_map_ = CMultiMetricMap::Create();
 
-		mrpt::ros1bridge::MapHdl::loadMap(
-			*metric_map_, config_file, map_file, "metricMap", debug_);
+		mrpt_map::loadMap(
+			*metric_map_, config_file, map_file, "metricMap", map_cache_dir,
+			debug_, std::max(1, map_cache_max_files));
 
 		grid = metric_map_->mapByClass<COccupancyGridMap2D>();
 	}